@@ -3,8 +3,25 @@
 const internal = require('bindings')('uma8.node');
 
 class Uma8 {
-    constructor() {
-        this._uma8 = internal.create();
+    constructor(external) {
+        // openAll hands in devices it has opened already
+        this._uma8 = external || internal.create();
+    }
+
+    static openAll(filter) {
+        return internal.openAll(filter || {}).map(function(result) {
+            if (result.uma8)
+                result.uma8 = new Uma8(result.uma8);
+            return result;
+        });
+    }
+
+    static exportMetrics(options) {
+        internal.exportMetrics(options);
+    }
+
+    static exporterStatus() {
+        return internal.exporterStatus();
     }
 
     enumerate() {
@@ -15,6 +32,122 @@ class Uma8 {
         internal.open(this._uma8, device);
     }
 
+    setPreview(options) {
+        internal.setPreview(this._uma8, options);
+    }
+
+    setTriggers(rules) {
+        internal.setTriggers(this._uma8, rules);
+    }
+
+    setHealth(options) {
+        internal.setHealth(this._uma8, options);
+    }
+
+    setLoudness(options) {
+        internal.setLoudness(this._uma8, options);
+    }
+
+    setGraph(nodes) {
+        internal.setGraph(this._uma8, nodes);
+    }
+
+    tap(name, options) {
+        internal.tap(this._uma8, name, options);
+    }
+
+    untap(name) {
+        return internal.untap(this._uma8, name);
+    }
+
+    readTap(name) {
+        return internal.readTap(this._uma8, name);
+    }
+
+    getLatestMetadata(out) {
+        return internal.getLatestMetadata(this._uma8, out);
+    }
+
+    setMetadataHistory(options) {
+        internal.setMetadataHistory(this._uma8, options);
+    }
+
+    metadataHistory(range) {
+        return internal.metadataHistory(this._uma8, range);
+    }
+
+    metadataSummary(options) {
+        return internal.metadataSummary(this._uma8, options);
+    }
+
+    loudness() {
+        return internal.loudness(this._uma8);
+    }
+
+    resetLoudness() {
+        internal.resetLoudness(this._uma8);
+    }
+
+    pipe(fd, options) {
+        internal.pipe(this._uma8, fd, options);
+    }
+
+    unpipe(fd) {
+        return internal.unpipe(this._uma8, fd);
+    }
+
+    streamRtp(options) {
+        internal.streamRtp(this._uma8, options);
+    }
+
+    stopRtp(host, port) {
+        return internal.stopRtp(this._uma8, host, port);
+    }
+
+    setDelivery(options) {
+        internal.setDelivery(this._uma8, options);
+    }
+
+    setAudioFormat(options) {
+        internal.setAudioFormat(this._uma8, options);
+    }
+
+    setIsoTuning(options) {
+        internal.setIsoTuning(this._uma8, options);
+    }
+
+    setTimestamps(options) {
+        internal.setTimestamps(this._uma8, options);
+    }
+
+    setRecorder(options) {
+        internal.setRecorder(this._uma8, options);
+    }
+
+    triggerRecorder(reason) {
+        return internal.triggerRecorder(this._uma8, reason);
+    }
+
+    setOccupancy(options) {
+        internal.setOccupancy(this._uma8, options);
+    }
+
+    stats() {
+        return internal.stats(this._uma8);
+    }
+
+    getReport(type, id, length) {
+        return internal.getReport(this._uma8, type, id, length);
+    }
+
+    setReport(type, id, data) {
+        return internal.setReport(this._uma8, type, id, data);
+    }
+
+    applyReports(reports, options) {
+        return internal.applyReports(this._uma8, reports, options);
+    }
+
     on(name, cb) {
         internal.on(this._uma8, name, cb);
     }
@@ -28,4 +161,70 @@ class Uma8 {
     }
 }
 
+class Selector {
+    constructor(options) {
+        this._selector = internal.createSelector(options || {});
+        this._sources = {};
+    }
+
+    add(uma8) {
+        const id = internal.selectorAdd(this._selector, uma8._uma8);
+        this._sources[id] = uma8;
+        return id;
+    }
+
+    remove(uma8) {
+        for (let id in this._sources) {
+            if (this._sources[id] === uma8)
+                delete this._sources[id];
+        }
+        return internal.selectorRemove(this._selector, uma8._uma8);
+    }
+
+    source(id) {
+        return this._sources[id];
+    }
+
+    scores() {
+        return internal.selectorScores(this._selector);
+    }
+
+    on(name, cb) {
+        internal.on(this._selector, name, cb);
+    }
+
+    removeListener(name, cb) {
+        return internal.removeListener(this._selector, name, cb);
+    }
+
+    removeAllListeners(name) {
+        return internal.removeAllListeners(this._selector, name);
+    }
+}
+
+class Batch {
+    constructor(options) {
+        this._batch = internal.batch(options);
+    }
+
+    cancel() {
+        internal.batchCancel(this._batch);
+    }
+
+    on(name, cb) {
+        internal.on(this._batch, name, cb);
+    }
+
+    removeListener(name, cb) {
+        return internal.removeListener(this._batch, name, cb);
+    }
+
+    removeAllListeners(name) {
+        return internal.removeAllListeners(this._batch, name);
+    }
+}
+
+Uma8.Selector = Selector;
+Uma8.Batch = Batch;
+
 module.exports = Uma8;
@@ -0,0 +1,153 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// the device delivers s32le 24khz 2ch interleaved audio
+struct Format
+{
+    enum { SampleRate = 24000, Channels = 2, SampleSize = 4, FrameSize = Channels * SampleSize };
+};
+
+inline float sampleToFloat(int32_t sample)
+{
+    return sample * (1.0f / 2147483648.0f);
+}
+
+inline int32_t floatToSample(float value)
+{
+    if (value >= 1.0f)
+        return INT32_MAX;
+    if (value <= -1.0f)
+        return INT32_MIN;
+    return static_cast<int32_t>(value * 2147483648.0f);
+}
+
+inline double powerToDb(double power)
+{
+    return 10. * log10(std::max(power, 1e-20));
+}
+
+inline double dbToPower(double db)
+{
+    return pow(10., db / 10.);
+}
+
+// mean square of all channels in count frames, relative to full scale
+inline double meanSquare(const int32_t* frames, size_t count)
+{
+    if (!count)
+        return 0.;
+    double sum = 0.;
+    const size_t samples = count * Format::Channels;
+    for (size_t i = 0; i < samples; ++i) {
+        const double s = sampleToFloat(frames[i]);
+        sum += s * s;
+    }
+    return sum / samples;
+}
+
+inline size_t msToFrames(double ms)
+{
+    return static_cast<size_t>(ms * Format::SampleRate / 1000.);
+}
+
+// direct form 2 transposed, coefficients normalized so a0 is 1
+struct Biquad
+{
+    double b0, b1, b2, a1, a2;
+    double z1, z2;
+
+    Biquad(double nb0 = 1., double nb1 = 0., double nb2 = 0., double na1 = 0., double na2 = 0.)
+        : b0(nb0), b1(nb1), b2(nb2), a1(na1), a2(na2), z1(0.), z2(0.)
+    {
+    }
+
+    double process(double x)
+    {
+        const double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+};
+
+// keeps the most recent frames, addressed by absolute frame position
+class History
+{
+public:
+    History(size_t frames = 0)
+        : mPosition(0)
+    {
+        resize(frames);
+    }
+
+    void resize(size_t frames)
+    {
+        mCapacity = frames;
+        mPosition = 0;
+        mSamples.assign(frames * Format::Channels, 0);
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+    // absolute position of the next frame to be written
+    uint64_t position() const { return mPosition; }
+
+    // the first position that's still available
+    uint64_t start() const { return mPosition > mCapacity ? mPosition - mCapacity : 0; }
+
+    void write(const int32_t* frames, size_t count)
+    {
+        if (!mCapacity)
+            return;
+        if (count > mCapacity) {
+            frames += (count - mCapacity) * Format::Channels;
+            mPosition += count - mCapacity;
+            count = mCapacity;
+        }
+        size_t offset = mPosition % mCapacity;
+        size_t remaining = count;
+        while (remaining) {
+            const size_t chunk = std::min(remaining, mCapacity - offset);
+            memcpy(&mSamples[offset * Format::Channels], frames, chunk * Format::FrameSize);
+            frames += chunk * Format::Channels;
+            remaining -= chunk;
+            offset = 0;
+        }
+        mPosition += count;
+    }
+
+    // copies count frames starting at position, frames that are no longer
+    // (or not yet) available are zeroed. returns the number of real frames
+    size_t read(uint64_t position, size_t count, int32_t* out) const
+    {
+        size_t copied = 0;
+        const uint64_t first = start();
+        for (size_t i = 0; i < count;) {
+            const uint64_t pos = position + i;
+            if (pos < first || pos >= mPosition) {
+                memset(out + i * Format::Channels, 0, Format::FrameSize);
+                ++i;
+                continue;
+            }
+            const size_t offset = pos % mCapacity;
+            const size_t chunk = std::min<uint64_t>({ count - i, mCapacity - offset, mPosition - pos });
+            memcpy(out + i * Format::Channels, &mSamples[offset * Format::Channels], chunk * Format::FrameSize);
+            copied += chunk;
+            i += chunk;
+        }
+        return copied;
+    }
+
+private:
+    size_t mCapacity;
+    uint64_t mPosition;
+    std::vector<int32_t> mSamples;
+};
+
+#endif
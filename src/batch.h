@@ -0,0 +1,315 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "utils.h"
+#include "pipeline.h"
+#include "wav.h"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+
+// runs recorded files through the same pipeline the devices use, spread
+// over a number of threads. for each file <output>/<name>.jsonl gets one
+// line per event, preview audio goes to <name>.<event>.wav (so
+// <name>.preview.wav unless a graph renames it) and trigger snippets to
+// <name>.snippet-<n>.wav
+class Batch
+{
+public:
+    struct Options
+    {
+        std::vector<std::string> files;
+        std::string output;
+        int threads = 0;
+        // treat all files as raw s32le captures instead of going by extension
+        bool raw = false;
+        PipelineSettings settings;
+    };
+
+    struct Progress
+    {
+        size_t index;
+        bool done;
+        uint64_t frames;
+        // wall clock ns spent on the file
+        uint64_t elapsed;
+        std::string error;
+    };
+
+    // notify is called from the worker threads whenever there's progress to take
+    Batch(const Options& options, const std::function<void()>& notify)
+        : mOptions(options), mNotify(notify), mNext(0), mRunning(0), mCancelled(false), mStarted(0)
+    {
+        // the preview files are 16 bit wavs whatever js asked for
+        mOptions.settings.previewOptions.format = Preview::s16();
+        for (NodeSpec& node : mOptions.settings.graph)
+            node.preview.format = Preview::s16();
+    }
+
+    ~Batch()
+    {
+        cancel();
+        join();
+    }
+
+    const Options& options() const { return mOptions; }
+
+    void start()
+    {
+        int threads = mOptions.threads;
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min<int>(threads, std::max<size_t>(mOptions.files.size(), 1));
+        mStarted = uv_hrtime();
+        mRunning = threads;
+        mThreads.resize(threads);
+        for (uv_thread_t& thread : mThreads)
+            uv_thread_create(&thread, Batch::run, this);
+    }
+
+    void cancel() { mCancelled = true; }
+
+    // joins the workers once they're all done
+    void join()
+    {
+        for (uv_thread_t& thread : mThreads)
+            uv_thread_join(&thread);
+        mThreads.clear();
+    }
+
+    bool finished() const { return mRunning == 0; }
+    uint64_t started() const { return mStarted; }
+
+    std::vector<Progress> take()
+    {
+        MutexLocker locker(&mMutex);
+        std::vector<Progress> ret;
+        ret.swap(mProgress);
+        return ret;
+    }
+
+private:
+    enum { ChunkFrames = 2400, ReportMs = 250 };
+
+    static void run(void* arg)
+    {
+        Batch* batch = static_cast<Batch*>(arg);
+        for (;;) {
+            const size_t index = batch->mNext++;
+            if (index >= batch->mOptions.files.size() || batch->mCancelled)
+                break;
+            batch->process(index);
+        }
+        --batch->mRunning;
+        batch->mNotify();
+    }
+
+    void report(const Progress& progress)
+    {
+        {
+            MutexLocker locker(&mMutex);
+            mProgress.push_back(progress);
+        }
+        mNotify();
+    }
+
+    static std::string baseName(const std::string& path)
+    {
+        const size_t slash = path.find_last_of('/');
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        const size_t dot = name.find_last_of('.');
+        if (dot != std::string::npos && dot > 0)
+            name.resize(dot);
+        return name;
+    }
+
+    static bool isRaw(const std::string& path)
+    {
+        const size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos)
+            return true;
+        const std::string ext = path.substr(dot + 1);
+        return ext != "wav" && ext != "WAV";
+    }
+
+    void process(size_t index)
+    {
+        const std::string& file = mOptions.files[index];
+        const uint64_t start = uv_hrtime();
+        Progress progress{ index, false, 0, 0, std::string() };
+
+        WavReader reader;
+        if (!reader.open(file, mOptions.raw || isRaw(file), &progress.error)) {
+            progress.done = true;
+            report(progress);
+            return;
+        }
+        const std::string base = mOptions.output + "/" + baseName(file);
+        FILE* out = fopen((base + ".jsonl").c_str(), "w");
+        if (!out) {
+            progress.done = true;
+            progress.error = "Can't write " + base + ".jsonl";
+            report(progress);
+            return;
+        }
+
+        Pipeline pipeline;
+        pipeline.configure(mOptions.settings);
+        // preview audio per event name, graphs can have more than one
+        std::map<std::string, WavWriter> previews;
+        int snippets = 0;
+        std::vector<int32_t> frames(ChunkFrames * Format::Channels);
+        std::vector<Event> events;
+        uint64_t lastReport = start;
+        std::string line;
+        for (;;) {
+            if (mCancelled) {
+                progress.error = "Cancelled";
+                break;
+            }
+            const size_t count = reader.read(&frames[0], ChunkFrames);
+            if (!count)
+                break;
+            pipeline.process(&frames[0], count, events);
+            for (Event& event : events) {
+                std::string extra;
+                const bool audio = event.data && event.properties.empty();
+                if (event.data) {
+                    if (audio) {
+                        WavWriter& preview = previews[event.name];
+                        if (!preview.isOpen())
+                            preview.open(base + "." + event.name + ".wav", pipeline.preview(event.name)->options().rate, 1, 16);
+                        preview.write(event.data, event.size);
+                    } else {
+                        const std::string name = base + ".snippet-" + std::to_string(snippets++) + ".wav";
+                        WavWriter snippet;
+                        if (snippet.open(name, Format::SampleRate, Format::Channels, 32)) {
+                            snippet.write(event.data, event.size);
+                            extra = ",\"" + event.dataName + "File\":" + quote(name);
+                        }
+                    }
+                    free(event.data);
+                }
+                if (!audio) {
+                    json(event, extra, &line);
+                    fwrite(line.data(), 1, line.size(), out);
+                }
+            }
+            events.clear();
+            progress.frames += count;
+
+            const uint64_t now = uv_hrtime();
+            if (now - lastReport >= ReportMs * 1000000ull) {
+                lastReport = now;
+                progress.elapsed = now - start;
+                report(progress);
+            }
+        }
+
+        if (Loudness* loudness = pipeline.loudness()) {
+            const Loudness::Values v = loudness->values();
+            Event summary("summary");
+            summary.add("position", static_cast<double>(pipeline.position()));
+            summary.add("integrated", v.integrated);
+            summary.add("range", v.range);
+            json(summary, std::string(), &line);
+            fwrite(line.data(), 1, line.size(), out);
+        }
+        fclose(out);
+
+        progress.done = true;
+        progress.elapsed = uv_hrtime() - start;
+        report(progress);
+    }
+
+    static std::string quote(const std::string& str)
+    {
+        std::string ret = "\"";
+        for (char c : str) {
+            switch (c) {
+            case '"':
+                ret += "\\\"";
+                break;
+            case '\\':
+                ret += "\\\\";
+                break;
+            case '\n':
+                ret += "\\n";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    ret += buf;
+                } else {
+                    ret += c;
+                }
+                break;
+            }
+        }
+        return ret + "\"";
+    }
+
+    static std::string number(double value)
+    {
+        // json has no infinity, -inf loudness is written as null
+        if (!std::isfinite(value))
+            return "null";
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", value);
+        return buf;
+    }
+
+    static void json(const Event& event, const std::string& extra, std::string* out)
+    {
+        std::string& line = *out;
+        line = "{\"name\":" + quote(event.name);
+        for (const Event::Property& prop : event.properties) {
+            line += "," + quote(prop.name) + ":";
+            switch (prop.type) {
+            case Event::Property::Number:
+                line += number(prop.number);
+                break;
+            case Event::Property::Boolean:
+                line += prop.number != 0. ? "true" : "false";
+                break;
+            case Event::Property::String:
+                line += quote(prop.string);
+                break;
+            case Event::Property::Numbers:
+            case Event::Property::Booleans:
+                line += "[";
+                for (size_t i = 0; i < prop.numbers.size(); ++i) {
+                    if (i)
+                        line += ",";
+                    if (prop.type == Event::Property::Booleans) {
+                        line += prop.numbers[i] != 0. ? "true" : "false";
+                    } else {
+                        line += number(prop.numbers[i]);
+                    }
+                }
+                line += "]";
+                break;
+            }
+        }
+        line += extra + "}\n";
+    }
+
+    Options mOptions;
+    std::function<void()> mNotify;
+    std::vector<uv_thread_t> mThreads;
+    std::atomic<size_t> mNext;
+    std::atomic<int> mRunning;
+    std::atomic<bool> mCancelled;
+    uint64_t mStarted;
+
+    Mutex mMutex;
+    std::vector<Progress> mProgress;
+};
+
+#endif
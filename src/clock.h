@@ -0,0 +1,222 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "utils.h"
+#include <uv.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// maps uv_hrtime() to a wall clock, CLOCK_REALTIME, CLOCK_TAI or a ptp
+// hardware clock. every interval the target clock is read between two
+// monotonic reads and a line through the recent offsets gives the offset
+// and drift, so mapping a time is only arithmetic. not thread safe, the
+// owner serializes updates and reads
+class ClockMapper
+{
+public:
+    enum Clock { Realtime, Tai, Phc };
+
+    struct Options
+    {
+        Clock clock = Realtime;
+        // the phc, /dev/ptp0 and the like
+        std::string device;
+        // ms between samples
+        double interval = 1000.;
+    };
+
+    struct Stats
+    {
+        uint64_t samples, steps;
+        // ns, target minus monotonic as of the last sample
+        double offset;
+        // ppm of the target clock against the monotonic one
+        double drift;
+        // ns, rms distance of the samples from the fitted line
+        double jitter;
+        // ns, how long the last read took, the bound on its error
+        double window;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return options.interval >= 10. && (options.clock != Phc || !options.device.empty());
+    }
+
+    static const char* clockName(Clock clock)
+    {
+        switch (clock) {
+        case Tai:
+            return "tai";
+        case Phc:
+            return "phc";
+        case Realtime:
+            break;
+        }
+        return "realtime";
+    }
+
+    ClockMapper(const Options& options)
+        : mOptions(options), mClockId(CLOCK_REALTIME), mFd(-1), mNext(0), mCount(0), mPos(0), mSamples(0), mSteps(0),
+          mRef(0), mRefOffset(0), mIntercept(0), mSlope(0), mJitter(0), mWindow(0)
+    {
+    }
+
+    ~ClockMapper()
+    {
+        if (mFd != -1)
+            ::close(mFd);
+    }
+
+    const Options& options() const { return mOptions; }
+
+    bool start(std::string* error)
+    {
+        switch (mOptions.clock) {
+        case Realtime:
+            mClockId = CLOCK_REALTIME;
+            break;
+        case Tai:
+#ifdef CLOCK_TAI
+            mClockId = CLOCK_TAI;
+            break;
+#else
+            *error = "CLOCK_TAI is not available";
+            return false;
+#endif
+        case Phc:
+#ifdef __linux__
+            EINTRWRAP(mFd, ::open(mOptions.device.c_str(), O_RDONLY | O_CLOEXEC));
+            if (mFd == -1) {
+                *error = "Can't open " + mOptions.device + ": " + strerror(errno);
+                return false;
+            }
+            // FD_TO_CLOCKID from the kernel's testptp
+            mClockId = static_cast<clockid_t>((~static_cast<unsigned int>(mFd) << 3) | 3);
+            break;
+#else
+            *error = "Hardware clocks are only supported on Linux";
+            return false;
+#endif
+        }
+        if (!sample()) {
+            *error = std::string("Can't read the ") + clockName(mOptions.clock) + " clock: " + strerror(errno);
+            return false;
+        }
+        mNext = uv_hrtime() + static_cast<uint64_t>(mOptions.interval * 1e6);
+        return true;
+    }
+
+    // takes a sample when one is due, now is uv_hrtime()
+    void update(uint64_t now)
+    {
+        if (now < mNext)
+            return;
+        sample();
+        mNext = now + static_cast<uint64_t>(mOptions.interval * 1e6);
+    }
+
+    // ns since the epoch of the target clock
+    int64_t map(uint64_t mono) const
+    {
+        const double x = static_cast<double>(static_cast<int64_t>(mono - mRef));
+        return static_cast<int64_t>(mono) + mRefOffset + static_cast<int64_t>(llround(mIntercept + mSlope * x));
+    }
+
+    Stats stats() const
+    {
+        return Stats{ mSamples, mSteps, static_cast<double>(mRefOffset) + mIntercept, mSlope * 1e6, mJitter, static_cast<double>(mWindow) };
+    }
+
+private:
+    enum { MaxSamples = 32, Tries = 3 };
+    // a sample this far off the line means the clock was stepped
+    enum { StepThreshold = 1000000 };
+
+    struct Sample
+    {
+        uint64_t mono;
+        int64_t offset;
+    };
+
+    bool sample()
+    {
+        // the narrowest of a few reads, preemption in between only widens them
+        Sample best = { 0, 0 };
+        uint64_t window = UINT64_MAX;
+        for (int i = 0; i < Tries; ++i) {
+            timespec ts;
+            const uint64_t before = uv_hrtime();
+            if (clock_gettime(mClockId, &ts) != 0)
+                return false;
+            const uint64_t after = uv_hrtime();
+            if (after - before < window) {
+                window = after - before;
+                best.mono = before + window / 2;
+                best.offset = static_cast<int64_t>(ts.tv_sec) * 1000000000ll + ts.tv_nsec - static_cast<int64_t>(best.mono);
+            }
+        }
+        mWindow = window;
+        if (mCount && fabs(static_cast<double>(map(best.mono) - (static_cast<int64_t>(best.mono) + best.offset))) > StepThreshold) {
+            // stepped, what we had doesn't apply anymore
+            mCount = mPos = 0;
+            ++mSteps;
+        }
+        mRing[mPos] = best;
+        mPos = (mPos + 1) % MaxSamples;
+        if (mCount < MaxSamples)
+            ++mCount;
+        ++mSamples;
+        fit(best);
+        return true;
+    }
+
+    // least squares through the samples, relative to the newest one to keep
+    // the numbers small
+    void fit(const Sample& newest)
+    {
+        mRef = newest.mono;
+        mRefOffset = newest.offset;
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (size_t i = 0; i < mCount; ++i) {
+            const double x = static_cast<double>(static_cast<int64_t>(mRing[i].mono - mRef));
+            const double y = static_cast<double>(mRing[i].offset - mRefOffset);
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        const double n = static_cast<double>(mCount);
+        const double var = sxx - sx * sx / n;
+        mSlope = var > 0 ? (sxy - sx * sy / n) / var : 0.;
+        mIntercept = (sy - mSlope * sx) / n;
+        double sq = 0;
+        for (size_t i = 0; i < mCount; ++i) {
+            const double x = static_cast<double>(static_cast<int64_t>(mRing[i].mono - mRef));
+            const double d = static_cast<double>(mRing[i].offset - mRefOffset) - (mIntercept + mSlope * x);
+            sq += d * d;
+        }
+        mJitter = sqrt(sq / n);
+    }
+
+    Options mOptions;
+    clockid_t mClockId;
+    int mFd;
+    uint64_t mNext;
+    Sample mRing[MaxSamples];
+    size_t mCount, mPos;
+    uint64_t mSamples, mSteps;
+    // the fitted offset is mRefOffset + mIntercept + mSlope * (mono - mRef)
+    uint64_t mRef;
+    int64_t mRefOffset;
+    double mIntercept, mSlope, mJitter;
+    uint64_t mWindow;
+};
+
+#endif
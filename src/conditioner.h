@@ -0,0 +1,55 @@
+#ifndef CONDITIONER_H
+#define CONDITIONER_H
+
+#include "audio.h"
+#include <math.h>
+
+// gain and an optional second order butterworth high pass, per sample so a
+// chain of these can be run in a single pass over the frames
+class Conditioner
+{
+public:
+    struct Options
+    {
+        // dB
+        double gain = 0.;
+        // Hz, 0 for none
+        double highpass = 0.;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return (options.gain >= -60. && options.gain <= 60.
+                && options.highpass >= 0. && options.highpass < Format::SampleRate / 2.);
+    }
+
+    Conditioner(const Options& options)
+        : mOptions(options), mGain(pow(10., options.gain / 20.))
+    {
+        if (options.highpass > 0.) {
+            const double w = 2. * M_PI * options.highpass / Format::SampleRate;
+            const double alpha = sin(w) / (2. * M_SQRT1_2);
+            const double a0 = 1. + alpha;
+            const double c = cos(w);
+            const Biquad hp((1. + c) / 2. / a0, -(1. + c) / a0, (1. + c) / 2. / a0, -2. * c / a0, (1. - alpha) / a0);
+            for (Biquad& filter : mFilters)
+                filter = hp;
+        }
+    }
+
+    const Options& options() const { return mOptions; }
+
+    double process(int channel, double x)
+    {
+        if (mOptions.highpass > 0.)
+            x = mFilters[channel].process(x);
+        return x * mGain;
+    }
+
+private:
+    Options mOptions;
+    double mGain;
+    Biquad mFilters[Format::Channels];
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include "audio.h"
+#include <string>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define CONVERT_F16C
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
+// sample encodings handed to js, for consumers that want less than s32le.
+// half floats and quantized int8 halve and quarter what float32 takes
+struct SampleFormat
+{
+    enum Type { S32, F32, F16, S16, S8 };
+
+    Type type = S32;
+    // s8 is quantized as round(x / scale) + zeroPoint for x in [-1, 1),
+    // the default uses the whole range
+    float scale = 1.f / 128.f;
+    int zeroPoint = 0;
+
+    static bool validate(const SampleFormat& format)
+    {
+        return format.scale > 0.f && isfinite(format.scale) && format.zeroPoint >= -128 && format.zeroPoint <= 127;
+    }
+
+    static const char* typeName(Type type)
+    {
+        switch (type) {
+        case F32:
+            return "f32le";
+        case F16:
+            return "f16le";
+        case S16:
+            return "s16le";
+        case S8:
+            return "s8";
+        case S32:
+            break;
+        }
+        return "s32le";
+    }
+
+    // the le suffix can be left out
+    static bool parse(const std::string& name, Type* type)
+    {
+        for (Type t : { S32, F32, F16, S16, S8 }) {
+            if (name == typeName(t) || name + "le" == typeName(t)) {
+                *type = t;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t sampleSize() const
+    {
+        switch (type) {
+        case F16:
+        case S16:
+            return 2;
+        case S8:
+            return 1;
+        case S32:
+        case F32:
+            break;
+        }
+        return 4;
+    }
+};
+
+// round to nearest even like the hardware does, audio never gets near the
+// limits but anything outside them still turns into inf or nan properly
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    const uint16_t sign = (x >> 16) & 0x8000;
+    x &= 0x7fffffff;
+    if (x >= 0x7f800000)
+        return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+    // 65520 and up round to inf
+    if (x >= 0x477ff000)
+        return sign | 0x7c00;
+    if (x < 0x38800000) {
+        // below the smallest normal half. adding 0.5 lines the mantissa up
+        // with the half's 2^-24 steps and the fpu does the rounding
+        float v;
+        memcpy(&v, &x, sizeof(v));
+        v += 0.5f;
+        uint32_t y;
+        memcpy(&y, &v, sizeof(y));
+        return sign | static_cast<uint16_t>(y - 0x3f000000);
+    }
+    // rebias the exponent and round off the 13 bits that go
+    x += 0xc8000fff + ((x >> 13) & 1);
+    return sign | static_cast<uint16_t>(x >> 13);
+}
+
+#ifdef CONVERT_F16C
+__attribute__((target("avx,f16c"))) inline void floatsToHalfF16c(const float* in, size_t count, uint16_t* out)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < count; ++i)
+        out[i] = floatToHalf(in[i]);
+}
+
+// f16c and the os saving the avx registers
+inline bool hasF16c()
+{
+    static const bool has = []() {
+        unsigned a, b, c, d;
+        if (!__get_cpuid(1, &a, &b, &c, &d))
+            return false;
+        const unsigned osxsave = 1u << 27, avx = 1u << 28, f16c = 1u << 29;
+        if ((c & (osxsave | avx | f16c)) != (osxsave | avx | f16c))
+            return false;
+        unsigned lo, hi;
+        __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (lo & 6) == 6;
+    }();
+    return has;
+}
+#endif
+
+inline void floatsToHalf(const float* in, size_t count, uint16_t* out)
+{
+#if defined(CONVERT_F16C)
+    if (hasF16c()) {
+        floatsToHalfF16c(in, count, out);
+        return;
+    }
+#elif defined(CONVERT_NEON)
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + i))));
+    in += i;
+    out += i;
+    count -= i;
+#endif
+    for (size_t i = 0; i < count; ++i)
+        out[i] = floatToHalf(in[i]);
+}
+
+// count samples in [-1, 1) into out, which has room for count samples of
+// the format
+inline void convertSamples(const SampleFormat& format, const float* in, size_t count, void* out)
+{
+    switch (format.type) {
+    case SampleFormat::S32: {
+        int32_t* o = static_cast<int32_t*>(out);
+        for (size_t i = 0; i < count; ++i)
+            o[i] = floatToSample(in[i]);
+        break; }
+    case SampleFormat::F32:
+        memcpy(out, in, count * sizeof(float));
+        break;
+    case SampleFormat::F16:
+        floatsToHalf(in, count, static_cast<uint16_t*>(out));
+        break;
+    case SampleFormat::S16: {
+        int16_t* o = static_cast<int16_t*>(out);
+        for (size_t i = 0; i < count; ++i)
+            o[i] = static_cast<int16_t>(std::min(std::max(lrintf(in[i] * 32768.f), -32768l), 32767l));
+        break; }
+    case SampleFormat::S8: {
+        int8_t* o = static_cast<int8_t*>(out);
+        const float inverse = 1.f / format.scale;
+        for (size_t i = 0; i < count; ++i)
+            o[i] = static_cast<int8_t>(std::min(std::max(lrintf(in[i] * inverse) + format.zeroPoint, -128l), 127l));
+        break; }
+    }
+}
+
+// s32 samples, converted through a small float block on the stack
+inline void convertSamples(const SampleFormat& format, const int32_t* in, size_t count, void* out)
+{
+    if (format.type == SampleFormat::S32) {
+        memcpy(out, in, count * sizeof(int32_t));
+        return;
+    }
+    enum { Block = 256 };
+    float block[Block];
+    uint8_t* o = static_cast<uint8_t*>(out);
+    const size_t size = format.sampleSize();
+    while (count) {
+        const size_t n = std::min<size_t>(count, Block);
+        for (size_t i = 0; i < n; ++i)
+            block[i] = sampleToFloat(in[i]);
+        convertSamples(format, block, n, o);
+        in += n;
+        o += n * size;
+        count -= n;
+    }
+}
+
+#endif
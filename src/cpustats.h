@@ -0,0 +1,92 @@
+#ifndef CPUSTATS_H
+#define CPUSTATS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// cpu time and context switches of one native thread. the counters are only
+// readable from the thread itself so it calls sample() now and then and
+// anyone can read the last sample
+class ThreadCpu
+{
+public:
+    struct Usage
+    {
+        // ms
+        double cpu;
+        uint64_t voluntary, involuntary;
+    };
+
+    ThreadCpu()
+    {
+        mCpu.store(0, std::memory_order_relaxed);
+        mVoluntary.store(0, std::memory_order_relaxed);
+        mInvoluntary.store(0, std::memory_order_relaxed);
+    }
+
+    // on the thread being measured
+    void sample()
+    {
+        timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+            mCpu.store(static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec, std::memory_order_relaxed);
+#ifdef RUSAGE_THREAD
+        rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+            mVoluntary.store(usage.ru_nvcsw, std::memory_order_relaxed);
+            mInvoluntary.store(usage.ru_nivcsw, std::memory_order_relaxed);
+        }
+#endif
+    }
+
+    Usage usage() const
+    {
+        return Usage{ mCpu.load(std::memory_order_relaxed) / 1e6, mVoluntary.load(std::memory_order_relaxed),
+                      mInvoluntary.load(std::memory_order_relaxed) };
+    }
+
+private:
+    std::atomic<uint64_t> mCpu, mVoluntary, mInvoluntary;
+};
+
+// wall clock time spent in a callback, written by the thread running it
+class CallTime
+{
+public:
+    struct Totals
+    {
+        uint64_t calls;
+        // ms
+        double total, max;
+    };
+
+    CallTime()
+    {
+        mCalls.store(0, std::memory_order_relaxed);
+        mTotal.store(0, std::memory_order_relaxed);
+        mMax.store(0, std::memory_order_relaxed);
+    }
+
+    // uv_hrtime() ns, single writer
+    void add(uint64_t start, uint64_t end)
+    {
+        const uint64_t ns = end > start ? end - start : 0;
+        mCalls.store(mCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        mTotal.store(mTotal.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > mMax.load(std::memory_order_relaxed))
+            mMax.store(ns, std::memory_order_relaxed);
+    }
+
+    Totals totals() const
+    {
+        return Totals{ mCalls.load(std::memory_order_relaxed), mTotal.load(std::memory_order_relaxed) / 1e6,
+                       mMax.load(std::memory_order_relaxed) / 1e6 };
+    }
+
+private:
+    std::atomic<uint64_t> mCalls, mTotal, mMax;
+};
+
+#endif
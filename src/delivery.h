@@ -0,0 +1,169 @@
+#ifndef DELIVERY_H
+#define DELIVERY_H
+
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// decides when the usb thread wakes up js and how many chunks js gets per
+// audio callback. in adaptive mode the batch and deadline follow the
+// measured event loop lag and drain time so the oldest chunk is delivered
+// within the target latency with as few callbacks as possible. times are
+// uv_hrtime() nanoseconds
+class Delivery
+{
+public:
+    enum Mode { Immediate, Fixed, Adaptive };
+
+    struct Options
+    {
+        Mode mode = Immediate;
+        // chunks per callback and ms to hold on to a chunk, for fixed
+        size_t batch = 1;
+        double deadline = 100.;
+        // ms, for adaptive
+        double targetLatency = 50.;
+    };
+
+    struct Stats
+    {
+        Mode mode;
+        size_t batch;
+        double deadline, targetLatency;
+        // averages in ms
+        double lag, drain, latency, period;
+        double callbacksPerSecond, chunksPerCallback;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return options.batch >= 1 && options.batch <= MaxBatch && options.deadline >= 0. && options.targetLatency > 0.;
+    }
+
+    static const char* modeName(Mode mode)
+    {
+        switch (mode) {
+        case Fixed:
+            return "fixed";
+        case Adaptive:
+            return "adaptive";
+        case Immediate:
+            break;
+        }
+        return "immediate";
+    }
+
+    Delivery()
+        : mBatch(1), mDeadline(0.), mLag(0.), mDrain(0.), mLatency(0.), mPeriod(0.),
+          mLastArrival(0), mWindowStart(0), mWindowCallbacks(0), mWindowChunks(0),
+          mCallbacksPerSecond(0.), mChunksPerCallback(0.)
+    {
+    }
+
+    void setOptions(const Options& options)
+    {
+        mOptions = options;
+        switch (options.mode) {
+        case Immediate:
+            mBatch = 1;
+            mDeadline = 0.;
+            break;
+        case Fixed:
+            mBatch = options.batch;
+            mDeadline = options.deadline;
+            break;
+        case Adaptive:
+            // start out chatty and grow from there
+            mBatch = 1;
+            mDeadline = 0.;
+            break;
+        }
+    }
+
+    const Options& options() const { return mOptions; }
+    size_t batch() const { return mBatch; }
+
+    // usb thread, a chunk arrived. returns true if js should be woken up
+    bool arrived(uint64_t now, size_t pending, uint64_t oldest)
+    {
+        if (mLastArrival)
+            mPeriod = average(mPeriod, (now - mLastArrival) / 1e6);
+        mLastArrival = now;
+        return due(now, pending, oldest);
+    }
+
+    // whether pending chunks, the oldest of which arrived at oldest, should go out
+    bool due(uint64_t now, size_t pending, uint64_t oldest) const
+    {
+        if (!pending)
+            return false;
+        if (mOptions.mode == Immediate)
+            return true;
+        return pending >= mBatch || (now - oldest) / 1e6 >= mDeadline;
+    }
+
+    // js thread, a drain ran from start to end after being signalled at
+    // signalled, delivering chunks of which the oldest arrived at oldest
+    void drained(uint64_t signalled, uint64_t start, uint64_t end, size_t chunks, uint64_t oldest)
+    {
+        mLag = average(mLag, start > signalled ? (start - signalled) / 1e6 : 0.);
+        mDrain = average(mDrain, (end - start) / 1e6);
+        if (chunks)
+            mLatency = average(mLatency, end > oldest ? (end - oldest) / 1e6 : 0.);
+
+        if (!mWindowStart)
+            mWindowStart = end;
+        ++mWindowCallbacks;
+        mWindowChunks += chunks;
+        if (end - mWindowStart >= 1000000000ull) {
+            const double seconds = (end - mWindowStart) / 1e9;
+            mCallbacksPerSecond = mWindowCallbacks / seconds;
+            mChunksPerCallback = mWindowCallbacks ? static_cast<double>(mWindowChunks) / mWindowCallbacks : 0.;
+            mWindowStart = end;
+            mWindowCallbacks = mWindowChunks = 0;
+        }
+
+        if (mOptions.mode == Adaptive && mPeriod > 0.)
+            adapt();
+    }
+
+    Stats stats() const
+    {
+        return Stats{ mOptions.mode, mBatch, mDeadline, mOptions.targetLatency, mLag, mDrain, mLatency,
+                      mPeriod, mCallbacksPerSecond, mChunksPerCallback };
+    }
+
+private:
+    enum { MaxBatch = 256 };
+
+    static double average(double current, double value)
+    {
+        return current == 0. ? value : current + 0.1 * (value - current);
+    }
+
+    void adapt()
+    {
+        // whatever the loop and the listeners cost comes off the budget,
+        // the rest is time we can spend collecting chunks
+        const double budget = std::max(mOptions.targetLatency - mLag - mDrain, 0.);
+        const size_t wanted = std::min<size_t>(std::max<size_t>(static_cast<size_t>(budget / mPeriod), 1), MaxBatch);
+        // grow slowly, shrink right away to protect the latency
+        if (wanted > mBatch) {
+            ++mBatch;
+        } else if (wanted < mBatch) {
+            mBatch = wanted;
+        }
+        mDeadline = std::max(budget - mPeriod, 0.);
+    }
+
+    Options mOptions;
+    size_t mBatch;
+    double mDeadline;
+    double mLag, mDrain, mLatency, mPeriod;
+    uint64_t mLastArrival, mWindowStart;
+    uint64_t mWindowCallbacks, mWindowChunks;
+    double mCallbacksPerSecond, mChunksPerCallback;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// something the pipeline wants to hand up to js. if there are no properties
+// the value is the buffer itself, otherwise an object with the buffer (if
+// any) stored under dataName. data is malloc'ed and owned by whoever ends
+// up consuming the event
+struct Event
+{
+    struct Property
+    {
+        enum Type { Number, Boolean, String, Numbers, Booleans } type;
+        std::string name;
+        double number;
+        std::string string;
+        std::vector<double> numbers;
+    };
+
+    Event(const std::string& n = std::string())
+        : name(n), data(nullptr), size(0)
+    {
+    }
+
+    void add(const std::string& key, double value)
+    {
+        properties.push_back(Property{ Property::Number, key, value, std::string(), std::vector<double>() });
+    }
+    void add(const std::string& key, bool value)
+    {
+        properties.push_back(Property{ Property::Boolean, key, value ? 1. : 0., std::string(), std::vector<double>() });
+    }
+    void add(const std::string& key, const std::string& value)
+    {
+        properties.push_back(Property{ Property::String, key, 0., value, std::vector<double>() });
+    }
+    void add(const std::string& key, const std::vector<double>& values)
+    {
+        properties.push_back(Property{ Property::Numbers, key, 0., std::string(), values });
+    }
+
+    void add(const std::string& key, const std::vector<bool>& values)
+    {
+        properties.push_back(Property{ Property::Booleans, key, 0., std::string(), std::vector<double>(values.begin(), values.end()) });
+    }
+
+    void setData(const void* bytes, size_t bytesSize, const std::string& key = std::string())
+    {
+        data = static_cast<uint8_t*>(malloc(bytesSize));
+        memcpy(data, bytes, bytesSize);
+        size = bytesSize;
+        dataName = key;
+    }
+
+    std::string name;
+    std::vector<Property> properties;
+    std::string dataName;
+    uint8_t* data;
+    size_t size;
+};
+
+#endif
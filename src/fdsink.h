@@ -0,0 +1,210 @@
+#ifndef FDSINK_H
+#define FDSINK_H
+
+#include "utils.h"
+#include "audio.h"
+#include "convert.h"
+#include "cpustats.h"
+#include <atomic>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// writes the converted stream to a file descriptor (pipe, fifo, socket)
+// from its own thread. the usb thread only copies into a bounded ring, if
+// the reader can't keep up whole chunks are dropped and counted
+class FdSink
+{
+public:
+    struct Options
+    {
+        int fd = -1;
+        SampleFormat format;
+        // ring size in bytes
+        size_t bufferSize = 1 << 20;
+        // ms of audio to collect before waking the writer
+        double batch = 20.;
+    };
+
+    struct Stats
+    {
+        uint64_t bytesWritten, writes, overruns, droppedBytes, backpressure;
+        size_t fill, maxFill;
+        std::string error;
+        // the writer thread
+        ThreadCpu::Usage cpu;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return options.fd >= 0 && options.bufferSize >= 4096 && options.batch >= 0. && SampleFormat::validate(options.format);
+    }
+
+    FdSink(const Options& options)
+        : mOptions(options), mRing(options.bufferSize), mHead(0), mTail(0), mStopped(false), mStarted(false)
+    {
+        mBatchBytes = std::min(msToFrames(options.batch) * Format::Channels * options.format.sampleSize(), options.bufferSize / 2);
+        mStats = Stats{ 0, 0, 0, 0, 0, 0, 0, std::string(), ThreadCpu::Usage{ 0., 0, 0 } };
+    }
+
+    ~FdSink()
+    {
+        stop();
+    }
+
+    const Options& options() const { return mOptions; }
+
+    bool start(std::string* error)
+    {
+        const int flags = fcntl(mOptions.fd, F_GETFL);
+        if (flags == -1 || fcntl(mOptions.fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            *error = std::string("Can't make fd non-blocking: ") + strerror(errno);
+            return false;
+        }
+        if (!mNotifier.isValid()) {
+            *error = std::string("Can't create notifier: ") + strerror(errno);
+            return false;
+        }
+        mStarted = true;
+        uv_thread_create(&mThread, FdSink::run, this);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!mStarted)
+            return;
+        mStopped = true;
+        mNotifier.notify();
+        uv_thread_join(&mThread);
+        mStarted = false;
+    }
+
+    // called from the usb thread
+    void push(const int32_t* frames, size_t count)
+    {
+        const size_t samples = count * Format::Channels;
+        const size_t bytes = samples * mOptions.format.sampleSize();
+        mConverted.resize(bytes);
+        convertSamples(mOptions.format, frames, samples, &mConverted[0]);
+        write(&mConverted[0], bytes);
+    }
+
+    // queues bytes as they are, from the usb thread
+    void write(const uint8_t* data, size_t bytes)
+    {
+        SpinLocker locker(&mLock);
+        const size_t fill = mHead - mTail;
+        if (!mStats.error.empty() || fill + bytes > mRing.size()) {
+            ++mStats.overruns;
+            mStats.droppedBytes += bytes;
+            return;
+        }
+        size_t offset = mHead % mRing.size();
+        const size_t first = std::min(bytes, mRing.size() - offset);
+        memcpy(&mRing[offset], data, first);
+        memcpy(&mRing[0], data + first, bytes - first);
+        mHead += bytes;
+        mStats.maxFill = std::max(mStats.maxFill, fill + bytes);
+        // the writer only waits while there's less than a batch, so only
+        // crossing the line needs a wakeup
+        if (fill < mBatchBytes && fill + bytes >= mBatchBytes)
+            mNotifier.notify();
+    }
+
+    Stats stats()
+    {
+        SpinLocker locker(&mLock);
+        Stats ret = mStats;
+        ret.fill = mHead - mTail;
+        ret.cpu = mCpu.usage();
+        return ret;
+    }
+
+private:
+    static void run(void* arg)
+    {
+        FdSink* sink = static_cast<FdSink*>(arg);
+        const size_t size = sink->mRing.size();
+        for (;;) {
+            sink->mCpu.sample();
+            iovec iov[2];
+            int iovcnt;
+            size_t pending;
+            bool wait;
+            {
+                SpinLocker locker(&sink->mLock);
+                wait = sink->mHead - sink->mTail < sink->mBatchBytes;
+            }
+            if (wait && !sink->mStopped) {
+                // wait for a batch, but don't sit on a partial one forever
+                sink->mNotifier.wait(static_cast<int>(std::max(sink->mOptions.batch, 1.)));
+            }
+            if (sink->mStopped)
+                break;
+            {
+                SpinLocker locker(&sink->mLock);
+                pending = sink->mHead - sink->mTail;
+                if (!pending)
+                    continue;
+                // the producer never touches [tail, head) so we can write it unlocked
+                const size_t offset = sink->mTail % size;
+                const size_t first = std::min(pending, size - offset);
+                iov[0].iov_base = &sink->mRing[offset];
+                iov[0].iov_len = first;
+                iov[1].iov_base = &sink->mRing[0];
+                iov[1].iov_len = pending - first;
+                iovcnt = pending > first ? 2 : 1;
+            }
+
+            ssize_t written;
+            EINTRWRAP(written, writev(sink->mOptions.fd, iov, iovcnt));
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    {
+                        SpinLocker locker(&sink->mLock);
+                        ++sink->mStats.backpressure;
+                    }
+                    // stop() pokes the notifier so this doesn't hold it up
+                    pollfd pfds[2] = { { sink->mOptions.fd, POLLOUT, 0 }, { sink->mNotifier.fd(), POLLIN, 0 } };
+                    int ret;
+                    EINTRWRAP(ret, poll(pfds, 2, 100));
+                    if (ret > 0 && (pfds[1].revents & POLLIN))
+                        sink->mNotifier.drain();
+                    continue;
+                }
+                // node ignores SIGPIPE so a reader going away ends up here as EPIPE
+                SpinLocker locker(&sink->mLock);
+                sink->mStats.error = strerror(errno);
+                break;
+            }
+            SpinLocker locker(&sink->mLock);
+            sink->mTail += written;
+            sink->mStats.bytesWritten += written;
+            ++sink->mStats.writes;
+        }
+        sink->mCpu.sample();
+    }
+
+    Options mOptions;
+    std::vector<uint8_t> mRing;
+    std::vector<uint8_t> mConverted;
+    size_t mBatchBytes;
+    // absolute byte positions, head is written by push and tail by the writer
+    uint64_t mHead, mTail;
+    std::atomic<bool> mStopped;
+    bool mStarted;
+    uv_thread_t mThread;
+    // only ever held for a memcpy or a few counters
+    SpinLock mLock;
+    Notifier mNotifier;
+    Stats mStats;
+    ThreadCpu mCpu;
+};
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "utils.h"
+#include "audio.h"
+#include "event.h"
+#include "conditioner.h"
+#include "preview.h"
+#include "triggers.h"
+#include "health.h"
+#include "loudness.h"
+#include "cpustats.h"
+#include "tap.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// one node of a processing graph as described from js. condition nodes
+// transform the stream and can feed other nodes, the others consume it
+// and produce events
+struct NodeSpec
+{
+    enum Type { Condition, Preview, Triggers, Health, Loudness };
+
+    std::string id;
+    Type type = Condition;
+    // "capture" or the id of a condition node
+    std::string input = "capture";
+    // the name the node's events go out under, the default for its type if empty
+    std::string event;
+    Conditioner::Options condition;
+    ::Preview::Options preview;
+    std::vector<::Triggers::Rule> triggers;
+    ::Health::Options health;
+    ::Loudness::Options loudness;
+    // nodes with the same id, type and version keep their state when the
+    // graph is rebuilt
+    uint64_t version = 0;
+
+    static const char* typeName(Type type)
+    {
+        switch (type) {
+        case Preview:
+            return "preview";
+        case Triggers:
+            return "triggers";
+        case Health:
+            return "health";
+        case Loudness:
+            return "loudness";
+        case Condition:
+            break;
+        }
+        return "condition";
+    }
+};
+
+// a validated, ready to run graph. buffers for every transformed stream
+// are allocated when it's built, chains of condition nodes with nothing
+// else hanging off them are fused into a single pass
+class Graph
+{
+public:
+    // frames per processing slice, longer chunks are split up
+    enum { MaxFrames = 2400 };
+
+    struct NodeStats
+    {
+        std::string id;
+        NodeSpec::Type type;
+        // the node that runs this one as part of its pass, empty if none
+        std::string fusedInto;
+        CallTime::Totals time;
+    };
+
+    typedef std::map<std::string, std::shared_ptr<Tap> > Taps;
+
+    // previous may be null, stages of nodes that didn't change are taken
+    // over. tapped nodes are attached to their taps
+    bool build(const std::vector<NodeSpec>& specs, const Graph* previous, std::string* error, const Taps* taps = nullptr)
+    {
+        std::unordered_map<std::string, size_t> ids;
+        for (size_t i = 0; i < specs.size(); ++i) {
+            const NodeSpec& spec = specs[i];
+            if (spec.id.empty() || spec.id == "capture") {
+                *error = "Graph node needs an id other than capture";
+                return false;
+            }
+            if (!ids.insert(std::make_pair(spec.id, i)).second) {
+                *error = "Duplicate graph node " + spec.id;
+                return false;
+            }
+            if (!validate(spec)) {
+                *error = "Invalid options for graph node " + spec.id;
+                return false;
+            }
+        }
+        std::vector<int> inputs(specs.size(), -1);
+        for (size_t i = 0; i < specs.size(); ++i) {
+            const NodeSpec& spec = specs[i];
+            if (spec.input == "capture")
+                continue;
+            auto it = ids.find(spec.input);
+            if (it == ids.end()) {
+                *error = "Graph node " + spec.id + " reads from unknown node " + spec.input;
+                return false;
+            }
+            if (specs[it->second].type != NodeSpec::Condition) {
+                *error = "Graph node " + spec.id + " can't read from " + spec.input + ", only condition nodes produce audio";
+                return false;
+            }
+            inputs[i] = static_cast<int>(it->second);
+        }
+
+        // topological order, anything left over is part of a cycle
+        std::vector<size_t> order;
+        std::vector<bool> placed(specs.size(), false);
+        while (order.size() < specs.size()) {
+            const size_t before = order.size();
+            for (size_t i = 0; i < specs.size(); ++i) {
+                if (!placed[i] && (inputs[i] == -1 || placed[inputs[i]])) {
+                    placed[i] = true;
+                    order.push_back(i);
+                }
+            }
+            if (order.size() == before) {
+                *error = "Graph has a cycle";
+                return false;
+            }
+        }
+
+        std::vector<size_t> consumers(specs.size(), 0);
+        for (int input : inputs) {
+            if (input != -1)
+                ++consumers[input];
+        }
+
+        mNodes.clear();
+        mNodes.reserve(specs.size());
+        std::vector<int> position(specs.size(), -1);
+        for (size_t i : order) {
+            const NodeSpec& spec = specs[i];
+            mNodes.emplace_back();
+            Node& node = mNodes.back();
+            node.spec = spec;
+            node.source = inputs[i] == -1 ? -1 : position[inputs[i]];
+            node.leader = -1;
+            node.tap = nullptr;
+            if (taps) {
+                auto tap = taps->find(spec.id);
+                if (tap != taps->end() && !tapFormat(spec).empty())
+                    node.tap = tap->second.get();
+            }
+            position[i] = static_cast<int>(mNodes.size() - 1);
+            if (!adopt(node, previous))
+                create(node);
+            // adopted nodes get fresh buffers too
+            if (node.preview) {
+                node.previewOutput.reserve(MaxFrames);
+                node.previewBytes.resize(MaxFrames * spec.preview.format.sampleSize());
+            }
+
+            if (spec.type != NodeSpec::Condition)
+                continue;
+            // a condition that is its input's only consumer joins its pass
+            // and works on the same buffer, unless the input's output has
+            // to be seen by a tap
+            if (node.source != -1 && consumers[inputs[i]] == 1 && !mNodes[node.source].tap) {
+                Node& source = mNodes[node.source];
+                const int leader = source.leader == -1 ? node.source : source.leader;
+                node.leader = leader;
+                mNodes[leader].chain.push_back(node.condition.get());
+            } else {
+                node.chain.push_back(node.condition.get());
+                node.buffer.assign(MaxFrames * Format::Channels, 0);
+            }
+        }
+        return true;
+    }
+
+    void process(const int32_t* frames, size_t count, uint64_t position, std::vector<Event>& events)
+    {
+        while (count) {
+            const size_t slice = std::min<size_t>(count, MaxFrames);
+            processSlice(frames, slice, position, events);
+            frames += slice * Format::Channels;
+            count -= slice;
+            position += slice;
+        }
+    }
+
+    // the first node of a type, for queries
+    ::Loudness* loudness() const
+    {
+        for (const Node& node : mNodes) {
+            if (node.loudness)
+                return node.loudness.get();
+        }
+        return nullptr;
+    }
+
+    ::Preview* preview(const std::string& event = std::string()) const
+    {
+        for (const Node& node : mNodes) {
+            if (node.preview && (event.empty() || eventName(node.spec) == event))
+                return node.preview.get();
+        }
+        return nullptr;
+    }
+
+    std::vector<NodeStats> stats() const
+    {
+        std::vector<NodeStats> ret;
+        for (const Node& node : mNodes) {
+            ret.push_back(NodeStats{ node.spec.id, node.spec.type, node.leader == -1 ? std::string() : mNodes[node.leader].spec.id,
+                                     node.time->totals() });
+        }
+        return ret;
+    }
+
+    static const char* defaultEvent(NodeSpec::Type type)
+    {
+        switch (type) {
+        case NodeSpec::Preview:
+            return "preview";
+        case NodeSpec::Triggers:
+            return "trigger";
+        case NodeSpec::Health:
+            return "health";
+        case NodeSpec::Loudness:
+            return "loudness";
+        case NodeSpec::Condition:
+            break;
+        }
+        return "";
+    }
+
+    // the format of what a node's tap gets, empty if there's nothing to tap
+    static std::string tapFormat(const NodeSpec& spec)
+    {
+        switch (spec.type) {
+        case NodeSpec::Condition:
+            return "s32le 2ch " + std::to_string(Format::SampleRate);
+        case NodeSpec::Preview:
+            return std::string(SampleFormat::typeName(spec.preview.format.type)) + " 1ch " + std::to_string(spec.preview.rate);
+        case NodeSpec::Triggers:
+        case NodeSpec::Health:
+        case NodeSpec::Loudness:
+            break;
+        }
+        return std::string();
+    }
+
+    static std::string eventName(const NodeSpec& spec)
+    {
+        return spec.event.empty() ? defaultEvent(spec.type) : spec.event;
+    }
+
+private:
+    struct Node
+    {
+        NodeSpec spec;
+        // index of the node whose output this reads, -1 for the capture
+        int source;
+        // index of the condition node whose pass this one runs in
+        int leader;
+        Tap* tap;
+        // for leaders, the conditions to run per sample in order
+        std::vector<Conditioner*> chain;
+        std::vector<int32_t> buffer;
+        std::shared_ptr<Conditioner> condition;
+        std::shared_ptr<::Preview> preview;
+        std::shared_ptr<::Triggers> triggers;
+        std::shared_ptr<::Health> health;
+        std::shared_ptr<::Loudness> loudness;
+        std::vector<float> previewOutput;
+        std::vector<uint8_t> previewBytes;
+        // shared with the next graph like the stage itself
+        std::shared_ptr<CallTime> time;
+    };
+
+    static bool validate(const NodeSpec& spec)
+    {
+        switch (spec.type) {
+        case NodeSpec::Condition:
+            return Conditioner::validate(spec.condition);
+        case NodeSpec::Preview:
+            return ::Preview::validate(spec.preview);
+        case NodeSpec::Triggers:
+            for (const ::Triggers::Rule& rule : spec.triggers) {
+                if (!::Triggers::validate(rule))
+                    return false;
+            }
+            return !spec.triggers.empty();
+        case NodeSpec::Health:
+        case NodeSpec::Loudness:
+            break;
+        }
+        return true;
+    }
+
+    static bool adopt(Node& node, const Graph* previous)
+    {
+        if (!previous)
+            return false;
+        for (const Node& old : previous->mNodes) {
+            if (old.spec.id == node.spec.id && old.spec.type == node.spec.type && old.spec.version == node.spec.version) {
+                node.condition = old.condition;
+                node.preview = old.preview;
+                node.triggers = old.triggers;
+                node.health = old.health;
+                node.loudness = old.loudness;
+                node.time = old.time;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void create(Node& node)
+    {
+        const NodeSpec& spec = node.spec;
+        node.time.reset(new CallTime);
+        switch (spec.type) {
+        case NodeSpec::Condition:
+            node.condition.reset(new Conditioner(spec.condition));
+            break;
+        case NodeSpec::Preview:
+            node.preview.reset(new ::Preview(spec.preview));
+            break;
+        case NodeSpec::Triggers:
+            node.triggers.reset(new ::Triggers(spec.triggers));
+            break;
+        case NodeSpec::Health:
+            node.health.reset(new ::Health(spec.health));
+            break;
+        case NodeSpec::Loudness:
+            node.loudness.reset(new ::Loudness(spec.loudness));
+            break;
+        }
+    }
+
+    const int32_t* output(int index, const int32_t* capture) const
+    {
+        if (index == -1)
+            return capture;
+        const Node& node = mNodes[index];
+        return node.leader == -1 ? node.buffer.data() : mNodes[node.leader].buffer.data();
+    }
+
+    void processSlice(const int32_t* frames, size_t count, uint64_t position, std::vector<Event>& events)
+    {
+        for (Node& node : mNodes) {
+            if (node.leader != -1) {
+                // a tapped node always ends its chain so the pass is done
+                if (node.tap)
+                    node.tap->write(mNodes[node.leader].buffer.data(), count * Format::FrameSize);
+                continue;
+            }
+            const uint64_t start = uv_hrtime();
+            const int32_t* in = output(node.source, frames);
+            const size_t first = events.size();
+            switch (node.spec.type) {
+            case NodeSpec::Condition: {
+                int32_t* out = node.buffer.data();
+                const size_t samples = count * Format::Channels;
+                for (size_t i = 0; i < samples; ++i) {
+                    const int channel = static_cast<int>(i % Format::Channels);
+                    double x = sampleToFloat(in[i]);
+                    for (Conditioner* condition : node.chain)
+                        x = condition->process(channel, x);
+                    out[i] = floatToSample(static_cast<float>(x));
+                }
+                if (node.tap)
+                    node.tap->write(out, count * Format::FrameSize);
+                break; }
+            case NodeSpec::Preview:
+                node.previewOutput.clear();
+                node.preview->process(in, count, node.previewOutput);
+                if (!node.previewOutput.empty()) {
+                    const size_t bytes = node.previewOutput.size() * node.spec.preview.format.sampleSize();
+                    convertSamples(node.spec.preview.format, node.previewOutput.data(), node.previewOutput.size(), node.previewBytes.data());
+                    if (node.tap)
+                        node.tap->write(node.previewBytes.data(), bytes);
+                    events.emplace_back("preview");
+                    events.back().setData(node.previewBytes.data(), bytes);
+                }
+                break;
+            case NodeSpec::Triggers:
+                node.triggers->process(in, count, position, events);
+                break;
+            case NodeSpec::Health:
+                node.health->process(in, count, position, events);
+                break;
+            case NodeSpec::Loudness:
+                node.loudness->process(in, count, position, events);
+                break;
+            }
+            if (!node.spec.event.empty()) {
+                for (size_t i = first; i < events.size(); ++i)
+                    events[i].name = node.spec.event;
+            }
+            node.time->add(start, uv_hrtime());
+        }
+    }
+
+    std::vector<Node> mNodes;
+};
+
+#endif
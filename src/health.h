@@ -0,0 +1,203 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include "audio.h"
+#include "event.h"
+#include <string>
+#include <vector>
+#include <math.h>
+
+// continuous per channel diagnostics, reported as one snapshot per interval
+class Health
+{
+public:
+    struct Options
+    {
+        // ms between snapshots
+        double interval = 10000.;
+        // dBFS below which a channel counts as silent
+        double silence = -90.;
+        // identical consecutive samples before they count as stuck
+        double stuckRun = 48.;
+        // dBFS at or above which a sample counts as clipped
+        double clipLevel = -0.1;
+        // fraction of a channel's power in mains hum before it's flagged
+        double humRatio = 0.5;
+        // correlation below which two active channels count as unrelated
+        double lowCorrelation = 0.1;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return (options.interval >= 100. && options.stuckRun >= 2. && options.clipLevel <= 0.
+                && options.humRatio > 0. && options.humRatio <= 1.);
+    }
+
+    Health(const Options& options)
+        : mOptions(options), mFrames(0), mBlockFrames(0), mSumXY(0.)
+    {
+        mClip = static_cast<int64_t>(2147483648. * pow(10., options.clipLevel / 20.));
+        for (int f = 0; f < NumHum; ++f)
+            mCoeffs[f] = 2. * cos(2. * M_PI * humFrequency(f) / Format::SampleRate);
+        for (Channel& channel : mChannels)
+            channel.last = 0;
+        reset();
+    }
+
+    void process(const int32_t* frames, size_t count, uint64_t position, std::vector<Event>& events)
+    {
+        const size_t blockFrames = msToFrames(HumBlockMs);
+        const size_t intervalFrames = msToFrames(mOptions.interval);
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t* frame = frames + i * Format::Channels;
+            for (int c = 0; c < Format::Channels; ++c) {
+                Channel& channel = mChannels[c];
+                const int32_t sample = frame[c];
+                const double s = sampleToFloat(sample);
+                channel.sum += s;
+                channel.sumSq += s * s;
+                channel.peak = std::max(channel.peak, fabs(s));
+                if (std::abs(static_cast<int64_t>(sample)) >= mClip)
+                    ++channel.clipped;
+                if (sample == channel.last) {
+                    if (++channel.run == static_cast<uint64_t>(mOptions.stuckRun)) {
+                        channel.stuck += channel.run;
+                    } else if (channel.run > static_cast<uint64_t>(mOptions.stuckRun)) {
+                        ++channel.stuck;
+                    }
+                } else {
+                    channel.run = 1;
+                    channel.last = sample;
+                }
+                for (int f = 0; f < NumHum; ++f) {
+                    const double q = s + mCoeffs[f] * channel.q1[f] - channel.q2[f];
+                    channel.q2[f] = channel.q1[f];
+                    channel.q1[f] = q;
+                }
+            }
+            mSumXY += sampleToFloat(frame[0]) * sampleToFloat(frame[1]);
+            if (++mBlockFrames == blockFrames) {
+                // power of a sinusoid at the bin is 2|X|^2 / N^2
+                for (Channel& channel : mChannels) {
+                    for (int f = 0; f < NumHum; ++f) {
+                        const double q1 = channel.q1[f], q2 = channel.q2[f];
+                        const double magSq = q1 * q1 + q2 * q2 - mCoeffs[f] * q1 * q2;
+                        channel.hum[f] += 2. * magSq / (static_cast<double>(blockFrames) * blockFrames);
+                        channel.q1[f] = channel.q2[f] = 0.;
+                    }
+                    ++channel.humBlocks;
+                }
+                mBlockFrames = 0;
+            }
+            if (++mFrames >= intervalFrames) {
+                report(position + i + 1, events);
+                reset();
+            }
+        }
+    }
+
+private:
+    enum { NumHum = 6, HumBlockMs = 100 };
+
+    // 50hz and harmonics first, then 60hz and harmonics
+    static double humFrequency(int f)
+    {
+        return (f < NumHum / 2 ? 50. : 60.) * (f % (NumHum / 2) + 1);
+    }
+
+    struct Channel
+    {
+        double sum, sumSq, peak;
+        uint64_t clipped, stuck, run;
+        int32_t last;
+        double q1[NumHum], q2[NumHum], hum[NumHum];
+        uint64_t humBlocks;
+    };
+
+    void reset()
+    {
+        for (Channel& channel : mChannels) {
+            channel.sum = channel.sumSq = channel.peak = 0.;
+            channel.clipped = channel.stuck = 0;
+            channel.run = 1;
+            for (int f = 0; f < NumHum; ++f)
+                channel.q1[f] = channel.q2[f] = channel.hum[f] = 0.;
+            channel.humBlocks = 0;
+        }
+        mFrames = 0;
+        mBlockFrames = 0;
+        mSumXY = 0.;
+    }
+
+    void report(uint64_t position, std::vector<Event>& events)
+    {
+        std::vector<double> rms, peak, clipRate, stuckRate, hum50, hum60;
+        std::vector<bool> silent, stuck, clipping, hum;
+        const double n = static_cast<double>(mFrames);
+        for (const Channel& channel : mChannels) {
+            const double power = channel.sumSq / n;
+            double p50 = 0., p60 = 0.;
+            if (channel.humBlocks) {
+                for (int f = 0; f < NumHum; ++f)
+                    (f < NumHum / 2 ? p50 : p60) += channel.hum[f] / channel.humBlocks;
+            }
+            rms.push_back(powerToDb(power));
+            peak.push_back(powerToDb(channel.peak * channel.peak));
+            clipRate.push_back(channel.clipped / n);
+            stuckRate.push_back(channel.stuck / n);
+            hum50.push_back(powerToDb(p50));
+            hum60.push_back(powerToDb(p60));
+            silent.push_back(powerToDb(power) < mOptions.silence);
+            stuck.push_back(channel.stuck / n > 0.5);
+            clipping.push_back(channel.clipped / n > 0.001);
+            hum.push_back(power > 0. && std::max(p50, p60) / power >= mOptions.humRatio
+                          && powerToDb(std::max(p50, p60)) >= mOptions.silence);
+        }
+
+        // pearson correlation between the two channels
+        const Channel& a = mChannels[0];
+        const Channel& b = mChannels[1];
+        const double cov = mSumXY / n - (a.sum / n) * (b.sum / n);
+        const double varA = a.sumSq / n - (a.sum / n) * (a.sum / n);
+        const double varB = b.sumSq / n - (b.sum / n) * (b.sum / n);
+        double correlation = 0.;
+        if (varA > 0. && varB > 0.)
+            correlation = cov / sqrt(varA * varB);
+        std::string anomaly = "none";
+        if (!silent[0] && !silent[1] && !stuck[0] && !stuck[1]) {
+            if (correlation > 0.9999) {
+                anomaly = "identical";
+            } else if (correlation < -0.5) {
+                anomaly = "inverted";
+            } else if (correlation < mOptions.lowCorrelation) {
+                anomaly = "uncorrelated";
+            }
+        }
+
+        events.emplace_back("health");
+        Event& event = events.back();
+        event.add("position", static_cast<double>(position));
+        event.add("duration", n * 1000. / Format::SampleRate);
+        event.add("rms", rms);
+        event.add("peak", peak);
+        event.add("clipRate", clipRate);
+        event.add("stuckRate", stuckRate);
+        event.add("hum50", hum50);
+        event.add("hum60", hum60);
+        event.add("silent", silent);
+        event.add("stuck", stuck);
+        event.add("clipping", clipping);
+        event.add("hum", hum);
+        event.add("correlation", correlation);
+        event.add("correlationAnomaly", anomaly);
+    }
+
+    Options mOptions;
+    int64_t mClip;
+    double mCoeffs[NumHum];
+    Channel mChannels[Format::Channels];
+    size_t mFrames, mBlockFrames;
+    double mSumXY;
+};
+
+#endif
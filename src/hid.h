@@ -0,0 +1,116 @@
+#ifndef HID_H
+#define HID_H
+
+#include <libusb.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// feature and output reports on the hid interface, which is where the
+// on-board dsp takes its configuration. the report layout is firmware
+// specific so reports are passed through as raw bytes. uses synchronous
+// control transfers, which libusb allows while the usb thread is handling
+// events on the same handle
+class HidReports
+{
+public:
+    enum Type { Output = 2, Feature = 3 };
+
+    struct Report
+    {
+        Type type;
+        // 0 if the device doesn't number its reports
+        uint8_t id;
+        // without the report id
+        std::vector<uint8_t> data;
+    };
+
+    struct Result
+    {
+        uint8_t id;
+        // bytes written, or a libusb error
+        int written;
+        // feature reports that were read back and matched what was written
+        bool verified;
+        std::vector<uint8_t> readback;
+        std::string error;
+    };
+
+    HidReports(libusb_device_handle* handle, int iface, unsigned int timeout = 1000)
+        : mHandle(handle), mIface(iface), mTimeout(timeout)
+    {
+    }
+
+    // reads a report of up to length bytes (not counting the id) into out,
+    // returns a libusb error or the number of bytes
+    int get(Type type, uint8_t id, size_t length, std::vector<uint8_t>* out)
+    {
+        std::vector<uint8_t> buf(length + (id ? 1 : 0));
+        const int ret = libusb_control_transfer(mHandle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                                                GetReport, (type << 8) | id, mIface, buf.data(), buf.size(), mTimeout);
+        if (ret < 0)
+            return ret;
+        // numbered reports come back with the id in front
+        const size_t skip = id && ret > 0 && buf[0] == id ? 1 : 0;
+        out->assign(buf.begin() + skip, buf.begin() + ret);
+        return static_cast<int>(out->size());
+    }
+
+    int set(Type type, uint8_t id, const uint8_t* data, size_t size)
+    {
+        std::vector<uint8_t> buf;
+        buf.reserve(size + 1);
+        if (id)
+            buf.push_back(id);
+        buf.insert(buf.end(), data, data + size);
+        const int ret = libusb_control_transfer(mHandle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                                                SetReport, (type << 8) | id, mIface, buf.data(), buf.size(), mTimeout);
+        if (ret < 0)
+            return ret;
+        return id ? std::max(ret - 1, 0) : ret;
+    }
+
+    // writes all reports back to back and, if asked, reads each feature
+    // report back afterwards. a failing report doesn't stop the rest
+    std::vector<Result> apply(const std::vector<Report>& reports, bool verify)
+    {
+        std::vector<Result> results;
+        results.reserve(reports.size());
+        for (const Report& report : reports) {
+            Result result{ report.id, 0, false, std::vector<uint8_t>(), std::string() };
+            result.written = set(report.type, report.id, report.data.data(), report.data.size());
+            if (result.written < 0)
+                result.error = libusb_error_name(result.written);
+            results.push_back(result);
+        }
+        if (!verify)
+            return results;
+        // read back once everything's applied, the dsp may adjust one
+        // parameter in response to another
+        for (size_t i = 0; i < reports.size(); ++i) {
+            const Report& report = reports[i];
+            Result& result = results[i];
+            if (report.type != Feature || result.written < 0)
+                continue;
+            const int ret = get(Feature, report.id, report.data.size(), &result.readback);
+            if (ret < 0) {
+                result.error = libusb_error_name(ret);
+                continue;
+            }
+            result.verified = result.readback == report.data;
+            if (!result.verified)
+                result.error = "Readback mismatch";
+        }
+        return results;
+    }
+
+private:
+    enum { GetReport = 0x01, SetReport = 0x09 };
+
+    libusb_device_handle* mHandle;
+    int mIface;
+    unsigned int mTimeout;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "utils.h"
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+// the recent vad/doa timeline of a device, a ring of timestamped metadata
+// updates. each update holds until the next one, so summaries weigh the
+// states by how long they lasted. the usb thread adds, js queries, both
+// under a spin lock that's only held for copies
+class MetadataHistory
+{
+public:
+    struct Entry
+    {
+        // uv_hrtime()
+        uint64_t time;
+        uint16_t angle;
+        uint8_t vad, direction;
+    };
+
+    struct Summary
+    {
+        // ns, start of the window
+        uint64_t start;
+        // share of the known time in the window vad was on
+        double duty;
+        uint32_t updates;
+        // ms with vad on per angle bin
+        std::vector<double> histogram;
+    };
+
+    static bool validate(size_t capacity)
+    {
+        return capacity <= (1 << 24);
+    }
+
+    MetadataHistory()
+        : mStart(0), mSize(0)
+    {
+    }
+
+    // 0 turns it off, changing it drops what's there
+    void setCapacity(size_t capacity)
+    {
+        std::vector<Entry> ring(capacity);
+        SpinLocker locker(&mLock);
+        mRing.swap(ring);
+        mStart = mSize = 0;
+    }
+
+    size_t capacity()
+    {
+        SpinLocker locker(&mLock);
+        return mRing.size();
+    }
+
+    size_t size()
+    {
+        SpinLocker locker(&mLock);
+        return mSize;
+    }
+
+    // from the usb thread
+    void add(const Entry& entry)
+    {
+        SpinLocker locker(&mLock);
+        if (mRing.empty())
+            return;
+        if (mSize == mRing.size()) {
+            mRing[mStart] = entry;
+            mStart = (mStart + 1) % mRing.size();
+        } else {
+            mRing[(mStart + mSize) % mRing.size()] = entry;
+            ++mSize;
+        }
+    }
+
+    // the entries with from <= time < to, oldest first. with before the one
+    // in effect at from is included too
+    void range(uint64_t from, uint64_t to, std::vector<Entry>* out, bool before = false)
+    {
+        SpinLocker locker(&mLock);
+        size_t first = lowerBound(from);
+        if (before && first > 0)
+            --first;
+        const size_t last = lowerBound(to);
+        out->reserve(last > first ? last - first : 0);
+        for (size_t i = first; i < last; ++i)
+            out->push_back(at(i));
+    }
+
+    // windows of window ns between from and to, now is where the last
+    // update stops counting
+    std::vector<Summary> summarize(uint64_t from, uint64_t to, uint64_t window, size_t bins, uint64_t now)
+    {
+        std::vector<Entry> entries;
+        range(from, to, &entries, true);
+        std::vector<Summary> ret;
+        if (!window || to <= from)
+            return ret;
+        const size_t count = (to - from + window - 1) / window;
+        ret.resize(count);
+        std::vector<double> known(count, 0.), on(count, 0.);
+        for (size_t w = 0; w < count; ++w) {
+            ret[w].start = from + w * window;
+            ret[w].updates = 0;
+            ret[w].histogram.assign(bins, 0.);
+        }
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const Entry& entry = entries[i];
+            if (entry.time >= from)
+                ++ret[(entry.time - from) / window].updates;
+            // this state lasts until the next update
+            uint64_t start = std::max(entry.time, from);
+            const uint64_t end = std::min(i + 1 < entries.size() ? entries[i + 1].time : std::min(now, to), to);
+            const size_t bin = std::min<size_t>(entry.angle * bins / 360, bins - 1);
+            while (start < end) {
+                const size_t w = (start - from) / window;
+                const uint64_t stop = std::min(end, from + (w + 1) * window);
+                const double ns = static_cast<double>(stop - start);
+                known[w] += ns;
+                if (entry.vad == 1) {
+                    on[w] += ns;
+                    ret[w].histogram[bin] += ns / 1e6;
+                }
+                start = stop;
+            }
+        }
+        for (size_t w = 0; w < count; ++w)
+            ret[w].duty = known[w] > 0 ? on[w] / known[w] : 0.;
+        return ret;
+    }
+
+private:
+    const Entry& at(size_t i) const { return mRing[(mStart + i) % mRing.size()]; }
+
+    // the first entry at or after time, the ring is in time order
+    size_t lowerBound(uint64_t time) const
+    {
+        size_t lo = 0, hi = mSize;
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (at(mid).time < time) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    SpinLock mLock;
+    std::vector<Entry> mRing;
+    size_t mStart, mSize;
+};
+
+#endif
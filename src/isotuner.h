@@ -0,0 +1,191 @@
+#ifndef ISOTUNER_H
+#define ISOTUNER_H
+
+#include "utils.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+
+// picks the number of iso transfers in flight and the packets per transfer.
+// fixed by default, in auto mode it starts with transfers as long as the
+// latency target allows and all of them in flight, then every interval
+// looks at the packet errors and the gaps between completions. errors or
+// gaps that eat into the headroom add depth and, once that's maxed out,
+// length. clean intervals give depth back first and then length, down to
+// the target. changes apply as transfers come back so the stream never
+// stops. observe() is called from the completions, which never run
+// concurrently, options and stats from js
+class IsoTuner
+{
+public:
+    enum Mode { Fixed, Auto };
+    // a packet is 3 frames at 24 kHz
+    enum { PacketNs = 125000, MinPackets = 8, MinDepth = 2, CleanIntervals = 3 };
+
+    struct Options
+    {
+        Mode mode = Fixed;
+        // fixed geometry, or the limits in auto mode
+        int depth = 0;
+        int packets = 0;
+        // auto, ms of audio per transfer to aim for
+        double targetLatency = 10.;
+        // auto, ms between decisions
+        double interval = 2000.;
+        // auto, share of bad packets that counts as errors
+        double errorRate = 0.001;
+    };
+
+    struct Geometry
+    {
+        int depth, packets;
+    };
+
+    struct Adjustment
+    {
+        Geometry from, to;
+        std::string reason;
+        double errorRate;
+        // ms, the longest time between two completions in the interval
+        double maxGap;
+    };
+
+    struct Stats
+    {
+        Mode mode;
+        Geometry geometry;
+        uint64_t adjustments;
+        double errorRate, maxGap;
+    };
+
+    static bool validate(const Options& options, int maxDepth, int maxPackets)
+    {
+        return options.depth >= MinDepth && options.depth <= maxDepth && options.packets >= MinPackets && options.packets <= maxPackets
+            && options.targetLatency > 0. && options.interval >= 100. && options.errorRate >= 0.;
+    }
+
+    static const char* modeName(Mode mode)
+    {
+        return mode == Auto ? "auto" : "fixed";
+    }
+
+    IsoTuner(int depth, int packets)
+        : mMaxDepth(depth), mMaxPackets(packets), mIntervalStart(0), mLast(0), mPackets(0), mBad(0), mMaxGap(0), mClean(0),
+          mAdjustments(0), mLastRate(0), mLastGap(0)
+    {
+        mOptions.depth = depth;
+        mOptions.packets = packets;
+        mGeometry = Geometry{ depth, packets };
+    }
+
+    int maxDepth() const { return mMaxDepth; }
+    int maxPackets() const { return mMaxPackets; }
+
+    void setOptions(const Options& options)
+    {
+        SpinLocker locker(&mLock);
+        mOptions = options;
+        if (options.mode == Fixed) {
+            mGeometry = Geometry{ options.depth, options.packets };
+        } else {
+            mGeometry = Geometry{ options.depth, targetPackets() };
+        }
+        mIntervalStart = 0;
+        mClean = 0;
+    }
+
+    Geometry geometry()
+    {
+        SpinLocker locker(&mLock);
+        return mGeometry;
+    }
+
+    // a completed transfer, now is uv_hrtime(). returns true and fills
+    // adjustment when the geometry changed
+    bool observe(uint64_t now, int packets, int bad, Adjustment* adjustment)
+    {
+        SpinLocker locker(&mLock);
+        if (mLast)
+            mMaxGap = std::max(mMaxGap, now - mLast);
+        mLast = now;
+        if (mOptions.mode != Auto)
+            return false;
+        mPackets += packets;
+        mBad += bad;
+        if (!mIntervalStart) {
+            mIntervalStart = now;
+            return false;
+        }
+        if (now - mIntervalStart < static_cast<uint64_t>(mOptions.interval * 1e6))
+            return false;
+
+        const double rate = mPackets ? static_cast<double>(mBad) / mPackets : 0.;
+        const double gap = static_cast<double>(mMaxGap);
+        mLastRate = rate;
+        mLastGap = gap / 1e6;
+        mIntervalStart = now;
+        mPackets = mBad = 0;
+        mMaxGap = 0;
+
+        const Geometry from = mGeometry;
+        Geometry to = from;
+        std::string reason;
+        // what's in flight behind the transfer being handled has to cover
+        // the longest stall, with some to spare
+        const double period = static_cast<double>(from.packets) * PacketNs;
+        const double headroom = (from.depth - 1) * period;
+        if (rate > mOptions.errorRate || gap * 2 > headroom) {
+            mClean = 0;
+            reason = rate > mOptions.errorRate ? "errors" : "jitter";
+            if (from.depth < mOptions.depth) {
+                const int needed = static_cast<int>(ceil(gap * 2 / period)) + 1;
+                to.depth = std::min(mOptions.depth, std::max(from.depth + 1, needed));
+            } else if (from.packets < mOptions.packets) {
+                to.packets = std::min(mOptions.packets, from.packets + std::max(from.packets / 2, 1));
+            }
+        } else if (++mClean >= CleanIntervals) {
+            mClean = 0;
+            reason = "clean";
+            const int target = targetPackets();
+            if (from.depth > MinDepth && gap * 2 <= (from.depth - 2) * period) {
+                --to.depth;
+            } else if (from.packets > target) {
+                to.packets = std::max(target, from.packets * 3 / 4);
+            }
+        }
+        if (to.depth == from.depth && to.packets == from.packets)
+            return false;
+        mGeometry = to;
+        ++mAdjustments;
+        *adjustment = Adjustment{ from, to, reason, rate, gap / 1e6 };
+        return true;
+    }
+
+    Stats stats()
+    {
+        SpinLocker locker(&mLock);
+        return Stats{ mOptions.mode, mGeometry, mAdjustments, mLastRate, mLastGap };
+    }
+
+private:
+    int targetPackets() const
+    {
+        const int packets = static_cast<int>(mOptions.targetLatency * 1e6 / PacketNs);
+        return std::max<int>(MinPackets, std::min(mOptions.packets, packets));
+    }
+
+    SpinLock mLock;
+    Options mOptions;
+    const int mMaxDepth, mMaxPackets;
+    Geometry mGeometry;
+    // the interval being looked at
+    uint64_t mIntervalStart, mLast, mPackets, mBad, mMaxGap;
+    int mClean;
+    uint64_t mAdjustments;
+    // of the last finished interval
+    double mLastRate, mLastGap;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "audio.h"
+#include "event.h"
+#include <vector>
+#include <math.h>
+
+// EBU R128 / ITU-R BS.1770 loudness. momentary (400ms) and short term (3s)
+// are sliding windows over 100ms blocks, integrated loudness and loudness
+// range are gated over histograms of 0.1 LU so they can run forever in
+// constant memory
+class Loudness
+{
+public:
+    struct Options
+    {
+        // ms between loudness events, 0 to only query
+        double interval = 1000.;
+    };
+
+    struct Values
+    {
+        double momentary, shortTerm, integrated, range;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return options.interval == 0. || options.interval >= 100.;
+    }
+
+    Loudness(const Options& options)
+        : mOptions(options)
+    {
+        // k weighting, a high shelf followed by a high pass, derived for
+        // our sample rate from the analog prototypes
+        const double fs = Format::SampleRate;
+        double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+        double k = tan(M_PI * f0 / fs);
+        const double vh = pow(10., gain / 20.);
+        const double vb = pow(vh, 0.4996667741545416);
+        double a0 = 1. + k / q + k * k;
+        const Biquad shelf((vh + vb * k / q + k * k) / a0, 2. * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                           2. * (k * k - 1.) / a0, (1. - k / q + k * k) / a0);
+        f0 = 38.13547087602444;
+        q = 0.5003270373238773;
+        k = tan(M_PI * f0 / fs);
+        a0 = 1. + k / q + k * k;
+        const Biquad highpass(1., -2., 1., 2. * (k * k - 1.) / a0, (1. - k / q + k * k) / a0);
+        for (int c = 0; c < Format::Channels; ++c) {
+            mShelf[c] = shelf;
+            mHighpass[c] = highpass;
+        }
+        reset();
+    }
+
+    void reset()
+    {
+        for (int c = 0; c < Format::Channels; ++c) {
+            mShelf[c].z1 = mShelf[c].z2 = 0.;
+            mHighpass[c].z1 = mHighpass[c].z2 = 0.;
+        }
+        mBlockEnergy = 0.;
+        mBlockFrames = mIntervalFrames = 0;
+        mBlocks = 0;
+        mGating.assign(HistogramBins, 0);
+        mShortTerms.assign(HistogramBins, 0);
+    }
+
+    void process(const int32_t* frames, size_t count, uint64_t position, std::vector<Event>& events)
+    {
+        const size_t blockFrames = msToFrames(BlockMs);
+        const size_t intervalFrames = msToFrames(mOptions.interval);
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t* frame = frames + i * Format::Channels;
+            // all channel weights are 1 for stereo
+            for (int c = 0; c < Format::Channels; ++c) {
+                const double y = mHighpass[c].process(mShelf[c].process(sampleToFloat(frame[c])));
+                mBlockEnergy += y * y;
+            }
+            if (++mBlockFrames == blockFrames) {
+                mEnergies[mBlocks % ShortTermBlocks] = mBlockEnergy / blockFrames;
+                ++mBlocks;
+                mBlockEnergy = 0.;
+                mBlockFrames = 0;
+                if (mBlocks >= MomentaryBlocks)
+                    add(mGating, window(MomentaryBlocks));
+                if (mBlocks >= ShortTermBlocks)
+                    add(mShortTerms, window(ShortTermBlocks));
+            }
+            if (intervalFrames && ++mIntervalFrames == intervalFrames) {
+                mIntervalFrames = 0;
+                const Values v = values();
+                events.emplace_back("loudness");
+                Event& event = events.back();
+                event.add("position", static_cast<double>(position + i + 1));
+                event.add("momentary", v.momentary);
+                event.add("shortTerm", v.shortTerm);
+                event.add("integrated", v.integrated);
+                event.add("range", v.range);
+            }
+        }
+    }
+
+    Values values() const
+    {
+        Values v;
+        v.momentary = mBlocks >= MomentaryBlocks ? loudness(window(MomentaryBlocks)) : -HUGE_VAL;
+        v.shortTerm = mBlocks >= ShortTermBlocks ? loudness(window(ShortTermBlocks)) : -HUGE_VAL;
+
+        // integrated, relative gate 10 LU below the absolute gated loudness
+        v.integrated = -HUGE_VAL;
+        size_t gate = relativeGate(mGating, 10.);
+        double sum = 0.;
+        uint64_t total = 0;
+        for (size_t b = gate; b < HistogramBins; ++b) {
+            sum += mGating[b] * binEnergy(b);
+            total += mGating[b];
+        }
+        if (total)
+            v.integrated = loudness(sum / total);
+
+        // range between the 10th and 95th percentile of the short term
+        // loudness, relative gate 20 LU below
+        v.range = 0.;
+        gate = relativeGate(mShortTerms, 20.);
+        total = 0;
+        for (size_t b = gate; b < HistogramBins; ++b)
+            total += mShortTerms[b];
+        if (total) {
+            const double low = percentile(mShortTerms, gate, total, 0.10);
+            const double high = percentile(mShortTerms, gate, total, 0.95);
+            v.range = high - low;
+        }
+        return v;
+    }
+
+private:
+    enum { BlockMs = 100, MomentaryBlocks = 4, ShortTermBlocks = 30, HistogramBins = 750 };
+    static constexpr double AbsoluteGate = -70.;
+
+    static double loudness(double energy)
+    {
+        return energy > 0. ? -0.691 + 10. * log10(energy) : -HUGE_VAL;
+    }
+
+    static double binLoudness(size_t bin)
+    {
+        return AbsoluteGate + (bin + 0.5) / 10.;
+    }
+
+    static double binEnergy(size_t bin)
+    {
+        return pow(10., (binLoudness(bin) + 0.691) / 10.);
+    }
+
+    // mean energy of the last n blocks
+    double window(size_t n) const
+    {
+        double sum = 0.;
+        for (size_t b = 0; b < n; ++b)
+            sum += mEnergies[(mBlocks - 1 - b) % ShortTermBlocks];
+        return sum / n;
+    }
+
+    // blocks below the absolute gate are not counted at all
+    static void add(std::vector<uint64_t>& histogram, double energy)
+    {
+        const double l = loudness(energy);
+        if (l < AbsoluteGate)
+            return;
+        const size_t bin = std::min<size_t>(static_cast<size_t>((l - AbsoluteGate) * 10.), HistogramBins - 1);
+        ++histogram[bin];
+    }
+
+    static size_t relativeGate(const std::vector<uint64_t>& histogram, double lu)
+    {
+        double sum = 0.;
+        uint64_t total = 0;
+        for (size_t b = 0; b < HistogramBins; ++b) {
+            sum += histogram[b] * binEnergy(b);
+            total += histogram[b];
+        }
+        if (!total)
+            return HistogramBins;
+        const double gate = loudness(sum / total) - lu;
+        if (gate <= AbsoluteGate)
+            return 0;
+        return std::min<size_t>(static_cast<size_t>(ceil((gate - AbsoluteGate) * 10. - 0.5)), HistogramBins);
+    }
+
+    static double percentile(const std::vector<uint64_t>& histogram, size_t from, uint64_t total, double p)
+    {
+        const double target = p * (total - 1);
+        uint64_t seen = 0;
+        for (size_t b = from; b < HistogramBins; ++b) {
+            seen += histogram[b];
+            if (seen > target)
+                return binLoudness(b);
+        }
+        return binLoudness(HistogramBins - 1);
+    }
+
+    Options mOptions;
+    Biquad mShelf[Format::Channels], mHighpass[Format::Channels];
+    double mBlockEnergy;
+    size_t mBlockFrames, mIntervalFrames;
+    uint64_t mBlocks;
+    double mEnergies[ShortTermBlocks];
+    std::vector<uint64_t> mGating, mShortTerms;
+};
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "utils.h"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// cumulative histogram with fixed bounds in seconds, observations can come
+// from any thread
+class Histogram
+{
+public:
+    struct Snapshot
+    {
+        const std::vector<double>* bounds;
+        // cumulative, the last one is +Inf
+        std::vector<uint64_t> buckets;
+        double sum;
+    };
+
+    Histogram(const std::vector<double>& bounds)
+        : mBounds(bounds), mCounts(bounds.size() + 1)
+    {
+        for (std::atomic<uint64_t>& count : mCounts)
+            count.store(0, std::memory_order_relaxed);
+        mSum.store(0, std::memory_order_relaxed);
+    }
+
+    void observe(uint64_t ns)
+    {
+        const double seconds = ns / 1e9;
+        size_t i = 0;
+        while (i < mBounds.size() && seconds > mBounds[i])
+            ++i;
+        mCounts[i].fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot ret{ &mBounds, std::vector<uint64_t>(mCounts.size()), mSum.load(std::memory_order_relaxed) / 1e9 };
+        uint64_t total = 0;
+        for (size_t i = 0; i < mCounts.size(); ++i) {
+            total += mCounts[i].load(std::memory_order_relaxed);
+            ret.buckets[i] = total;
+        }
+        return ret;
+    }
+
+private:
+    const std::vector<double> mBounds;
+    std::vector<std::atomic<uint64_t> > mCounts;
+    std::atomic<uint64_t> mSum;
+};
+
+// builds prometheus text exposition or openmetrics text. all samples of a
+// family have to be written right after its family() call
+class MetricsText
+{
+public:
+    MetricsText(bool openMetrics)
+        : mOpenMetrics(openMetrics), mCounter(false)
+    {
+    }
+
+    void family(const std::string& name, const char* type, const char* help)
+    {
+        mCounter = !strcmp(type, "counter");
+        // openmetrics names counter families without the _total suffix
+        const std::string typeName = mCounter && !mOpenMetrics ? name + "_total" : name;
+        mText += "# HELP " + typeName + " " + help + "\n";
+        mText += "# TYPE " + typeName + " " + type + "\n";
+    }
+
+    void sample(const std::string& name, const std::string& labels, double value)
+    {
+        mText += name + (mCounter ? "_total" : "") + "{" + labels + "} " + number(value) + "\n";
+    }
+
+    void histogram(const std::string& name, const std::string& labels, const Histogram::Snapshot& snapshot)
+    {
+        const std::vector<double>& bounds = *snapshot.bounds;
+        const std::string prefix = labels.empty() ? labels : labels + ",";
+        for (size_t i = 0; i < snapshot.buckets.size(); ++i) {
+            const std::string le = i < bounds.size() ? number(bounds[i]) : "+Inf";
+            mText += name + "_bucket{" + prefix + "le=\"" + le + "\"} " + number(snapshot.buckets[i]) + "\n";
+        }
+        mText += name + "_count{" + labels + "} " + number(snapshot.buckets.back()) + "\n";
+        mText += name + "_sum{" + labels + "} " + number(snapshot.sum) + "\n";
+    }
+
+    const std::string& finish()
+    {
+        if (mOpenMetrics)
+            mText += "# EOF\n";
+        return mText;
+    }
+
+    static std::string label(const char* key, const std::string& value)
+    {
+        std::string ret = std::string(key) + "=\"";
+        for (char c : value) {
+            if (c == '\\' || c == '"') {
+                ret += '\\';
+            } else if (c == '\n') {
+                ret += "\\n";
+                continue;
+            }
+            ret += c;
+        }
+        return ret + "\"";
+    }
+
+private:
+    static std::string number(double value)
+    {
+        if (isnan(value))
+            return "NaN";
+        if (isinf(value))
+            return value > 0 ? "+Inf" : "-Inf";
+        // enough for counters and keeps bucket bounds like 0.005 readable
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.15g", value);
+        return buf;
+    }
+
+    bool mOpenMetrics, mCounter;
+    std::string mText;
+};
+
+// writes the metrics from collect to path every interval ms from its own
+// thread. the file is written next to path and renamed over it so a
+// textfile collector never sees a partial file
+class TextfileExporter
+{
+public:
+    struct Options
+    {
+        std::string path;
+        double interval = 15000.;
+        bool openMetrics = false;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return !options.path.empty() && options.interval >= 100.;
+    }
+
+    TextfileExporter(const Options& options, const std::function<void(MetricsText&)>& collect)
+        : mOptions(options), mCollect(collect), mStarted(false), mStopped(false), mWrites(0)
+    {
+    }
+
+    ~TextfileExporter()
+    {
+        stop();
+    }
+
+    const Options& options() const { return mOptions; }
+
+    void start()
+    {
+        mStarted = true;
+        uv_thread_create(&mThread, TextfileExporter::run, this);
+    }
+
+    void stop()
+    {
+        if (!mStarted || mStopped.exchange(true))
+            return;
+        mNotifier.notify();
+        uv_thread_join(&mThread);
+    }
+
+    uint64_t writes() const { return mWrites; }
+
+    std::string error()
+    {
+        MutexLocker locker(&mMutex);
+        return mError;
+    }
+
+private:
+    static void run(void* arg)
+    {
+        TextfileExporter* exporter = static_cast<TextfileExporter*>(arg);
+        while (!exporter->mStopped) {
+            exporter->write();
+            exporter->mNotifier.wait(static_cast<int>(exporter->mOptions.interval));
+        }
+    }
+
+    void write()
+    {
+        MetricsText text(mOptions.openMetrics);
+        mCollect(text);
+        const std::string& data = text.finish();
+
+        const std::string tmp = mOptions.path + ".tmp";
+        std::string error;
+        FILE* f = fopen(tmp.c_str(), "w");
+        if (!f) {
+            error = "Can't write " + tmp + ": " + strerror(errno);
+        } else {
+            const bool written = fwrite(data.data(), 1, data.size(), f) == data.size();
+            if (fclose(f) != 0 || !written) {
+                error = "Can't write " + tmp + ": " + strerror(errno);
+            } else if (rename(tmp.c_str(), mOptions.path.c_str()) != 0) {
+                error = "Can't rename " + tmp + ": " + strerror(errno);
+            }
+        }
+        if (error.empty())
+            ++mWrites;
+        MutexLocker locker(&mMutex);
+        mError = error;
+    }
+
+    Options mOptions;
+    std::function<void(MetricsText&)> mCollect;
+    bool mStarted;
+    std::atomic<bool> mStopped;
+    std::atomic<uint64_t> mWrites;
+    uv_thread_t mThread;
+    Notifier mNotifier;
+    Mutex mMutex;
+    std::string mError;
+};
+
+#endif
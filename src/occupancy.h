@@ -0,0 +1,157 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include "audio.h"
+#include "event.h"
+#include <algorithm>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+
+// room usage per interval from the vad/doa reports and the audio levels,
+// reported as one small occupancy event. each report holds until the next
+// one, so speech time is weighed by how long vad stayed on. a direction
+// counts once a doa sector has had minDirection ms of speech, which keeps
+// the odd stray angle out. both sides run on the usb thread under the
+// pipeline mutex
+class Occupancy
+{
+public:
+    struct Options
+    {
+        // ms between summaries
+        double interval = 60000.;
+        // doa sectors directions are told apart by
+        int sectors = 8;
+        // ms of speech from a sector before it counts as a direction
+        double minDirection = 1000.;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return options.interval >= 1000. && options.sectors >= 1 && options.sectors <= 360 && options.minDirection >= 0.;
+    }
+
+    Occupancy(const Options& options)
+        : mOptions(options), mVad(0), mAngle(0), mSince(0), mStart(0), mPosition(0)
+    {
+        mSectors.resize(options.sectors);
+        reset();
+    }
+
+    const Options& options() const { return mOptions; }
+
+    // a metadata report, now is uv_hrtime()
+    void metadata(uint64_t now, uint8_t vad, uint16_t angle)
+    {
+        account(now);
+        ++mUpdates;
+        if (vad == 1 && mVad != 1)
+            ++mOnsets;
+        mVad = vad;
+        mAngle = angle;
+    }
+
+    // a chunk of audio starting at position, arrived at now. closes the
+    // interval once it's up
+    void process(const int32_t* frames, size_t count, uint64_t position, uint64_t now, std::vector<Event>& events)
+    {
+        if (!mStart) {
+            mStart = mSince = now;
+            mPosition = position;
+        }
+        double sum = 0.;
+        int32_t peak = 0;
+        const size_t samples = count * Format::Channels;
+        for (size_t i = 0; i < samples; ++i) {
+            const double s = sampleToFloat(frames[i]);
+            sum += s * s;
+            // INT32_MIN has no positive counterpart
+            peak = std::max(peak, frames[i] == INT32_MIN ? INT32_MAX : std::abs(frames[i]));
+        }
+        mPeak = std::max(mPeak, peak);
+        mSumSq += sum;
+        mSamples += samples;
+        if (mVad == 1) {
+            mSpeechSumSq += sum;
+            mSpeechSamples += samples;
+        }
+        mFrames += count;
+
+        if (now - mStart < static_cast<uint64_t>(mOptions.interval * 1e6))
+            return;
+        account(now);
+        const double duration = static_cast<double>(now - mStart);
+        int directions = 0;
+        int dominant = -1;
+        std::vector<double> sectors(mSectors.size());
+        for (size_t s = 0; s < mSectors.size(); ++s) {
+            sectors[s] = mSectors[s] / 1e6;
+            if (sectors[s] > 0. && sectors[s] >= mOptions.minDirection)
+                ++directions;
+            if (mSectors[s] > 0 && (dominant < 0 || mSectors[s] > mSectors[dominant]))
+                dominant = static_cast<int>(s);
+        }
+        const double width = 360. / mSectors.size();
+
+        events.emplace_back("occupancy");
+        Event& event = events.back();
+        event.add("position", static_cast<double>(mPosition));
+        event.add("frames", static_cast<double>(mFrames));
+        event.add("duration", duration / 1e6);
+        event.add("speech", mSpeech / 1e6);
+        event.add("duty", duration > 0. ? mSpeech / duration : 0.);
+        event.add("onsets", static_cast<double>(mOnsets));
+        event.add("updates", static_cast<double>(mUpdates));
+        event.add("directions", static_cast<double>(directions));
+        event.add("dominant", dominant < 0 ? -1. : (dominant + 0.5) * width);
+        event.add("sectors", sectors);
+        event.add("peak", mPeak ? 20. * log10(mPeak / 2147483648.) : powerToDb(0.));
+        event.add("rms", powerToDb(mSamples ? mSumSq / mSamples : 0.));
+        event.add("speechRms", powerToDb(mSpeechSamples ? mSpeechSumSq / mSpeechSamples : 0.));
+
+        reset();
+        mStart = now;
+        mPosition = position + count;
+    }
+
+private:
+    // the current state lasted until now
+    void account(uint64_t now)
+    {
+        if (!mStart || now <= mSince)
+            return;
+        if (mVad == 1) {
+            const uint64_t ns = now - mSince;
+            mSpeech += ns;
+            mSectors[std::min<size_t>(mAngle * mSectors.size() / 360, mSectors.size() - 1)] += ns;
+        }
+        mSince = now;
+    }
+
+    void reset()
+    {
+        std::fill(mSectors.begin(), mSectors.end(), 0);
+        mSpeech = 0;
+        mOnsets = mUpdates = 0;
+        mFrames = mSamples = mSpeechSamples = 0;
+        mSumSq = mSpeechSumSq = 0.;
+        mPeak = 0;
+    }
+
+    Options mOptions;
+    // the last report, holds until the next one
+    uint8_t mVad;
+    uint16_t mAngle;
+    uint64_t mSince;
+    // the interval, uv_hrtime() and frame position of its start
+    uint64_t mStart, mPosition;
+    // ns of speech, overall and per sector
+    uint64_t mSpeech;
+    std::vector<uint64_t> mSectors;
+    uint64_t mOnsets, mUpdates, mFrames, mSamples, mSpeechSamples;
+    double mSumSq, mSpeechSumSq;
+    int32_t mPeak;
+};
+
+#endif
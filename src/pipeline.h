@@ -0,0 +1,186 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "audio.h"
+#include "event.h"
+#include "graph.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// everything a pipeline can be configured with, for setting up pipelines
+// that don't belong to a device. a non-empty graph replaces the rest
+struct PipelineSettings
+{
+    bool preview = false, health = false, loudness = false;
+    Preview::Options previewOptions;
+    std::vector<Triggers::Rule> triggers;
+    Health::Options healthOptions;
+    Loudness::Options loudnessOptions;
+    std::vector<NodeSpec> graph;
+};
+
+// the processing that runs on the captured stream of one device, a graph
+// of nodes. the setters for the individual stages maintain nodes of the
+// same name reading straight from the capture, next to whatever setGraph
+// put there
+class Pipeline
+{
+public:
+    Pipeline()
+        : mPosition(0), mVersion(0), mCaptureTap(nullptr), mGraph(new Graph)
+    {
+    }
+
+    void configure(const PipelineSettings& settings)
+    {
+        if (!settings.graph.empty()) {
+            std::string error;
+            setGraph(settings.graph, &error);
+            return;
+        }
+        setPreview(settings.preview ? &settings.previewOptions : nullptr);
+        setTriggers(&settings.triggers);
+        setHealth(settings.health ? &settings.healthOptions : nullptr);
+        setLoudness(settings.loudness ? &settings.loudnessOptions : nullptr);
+    }
+
+    // validates and builds the whole graph, nothing changes on failure
+    bool setGraph(const std::vector<NodeSpec>& specs, std::string* error)
+    {
+        std::vector<NodeSpec> nodes = specs;
+        for (NodeSpec& node : nodes)
+            node.version = ++mVersion;
+        return rebuild(nodes, error);
+    }
+
+    const std::vector<NodeSpec>& graph() const { return mSpecs; }
+
+    void setPreview(const Preview::Options* options)
+    {
+        NodeSpec spec = stage("preview", NodeSpec::Preview);
+        if (options)
+            spec.preview = *options;
+        update(spec, options != nullptr);
+    }
+
+    void setTriggers(const std::vector<Triggers::Rule>* rules)
+    {
+        NodeSpec spec = stage("triggers", NodeSpec::Triggers);
+        if (rules)
+            spec.triggers = *rules;
+        update(spec, rules && !rules->empty());
+    }
+
+    void setHealth(const Health::Options* options)
+    {
+        NodeSpec spec = stage("health", NodeSpec::Health);
+        if (options)
+            spec.health = *options;
+        update(spec, options != nullptr);
+    }
+
+    void setLoudness(const Loudness::Options* options)
+    {
+        NodeSpec spec = stage("loudness", NodeSpec::Loudness);
+        if (options)
+            spec.loudness = *options;
+        update(spec, options != nullptr);
+    }
+
+    // the format a tap at name would get, empty if there's no such tap
+    // point. capture is the stream as it comes in, graph nodes can be
+    // tapped by id
+    std::string tapFormat(const std::string& name) const
+    {
+        if (name == "capture")
+            return "s32le 2ch " + std::to_string(Format::SampleRate);
+        for (const NodeSpec& node : mSpecs) {
+            if (node.id == name)
+                return Graph::tapFormat(node);
+        }
+        return std::string();
+    }
+
+    // a null tap removes it
+    void setTap(const std::string& name, const std::shared_ptr<Tap>& tap)
+    {
+        if (tap) {
+            mTaps[name] = tap;
+        } else {
+            mTaps.erase(name);
+        }
+        auto capture = mTaps.find("capture");
+        mCaptureTap = capture == mTaps.end() ? nullptr : capture->second.get();
+        // taps change what can be fused
+        std::string error;
+        rebuild(mSpecs, &error);
+    }
+
+    const Graph::Taps& taps() const { return mTaps; }
+
+    Loudness* loudness() const { return mGraph->loudness(); }
+    Preview* preview(const std::string& event = std::string()) const { return mGraph->preview(event); }
+    std::vector<Graph::NodeStats> stats() const { return mGraph->stats(); }
+
+    // absolute frame position of the next frame
+    uint64_t position() const { return mPosition; }
+
+    void process(const int32_t* frames, size_t count, std::vector<Event>& events)
+    {
+        if (mCaptureTap)
+            mCaptureTap->write(frames, count * Format::FrameSize);
+        mGraph->process(frames, count, mPosition, events);
+        mPosition += count;
+    }
+
+private:
+    NodeSpec stage(const char* id, NodeSpec::Type type)
+    {
+        NodeSpec spec;
+        spec.id = id;
+        spec.type = type;
+        spec.version = ++mVersion;
+        return spec;
+    }
+
+    // adds, replaces or (if not enabled) removes the node with spec's id
+    void update(const NodeSpec& spec, bool enabled)
+    {
+        std::vector<NodeSpec> nodes;
+        bool found = false;
+        for (const NodeSpec& node : mSpecs) {
+            if (node.id != spec.id) {
+                nodes.push_back(node);
+            } else if (enabled) {
+                nodes.push_back(spec);
+                found = true;
+            }
+        }
+        if (enabled && !found)
+            nodes.push_back(spec);
+        // the options were validated by the caller, this only fails if a
+        // graph node reads from a condition node of the same id, which
+        // then stays as it is
+        std::string error;
+        rebuild(nodes, &error);
+    }
+
+    bool rebuild(const std::vector<NodeSpec>& nodes, std::string* error)
+    {
+        std::unique_ptr<Graph> graph(new Graph);
+        if (!graph->build(nodes, mGraph.get(), error, &mTaps))
+            return false;
+        mSpecs = nodes;
+        mGraph = std::move(graph);
+        return true;
+    }
+
+    uint64_t mPosition, mVersion;
+    std::vector<NodeSpec> mSpecs;
+    Graph::Taps mTaps;
+    Tap* mCaptureTap;
+    std::unique_ptr<Graph> mGraph;
+};
+
+#endif
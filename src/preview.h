@@ -0,0 +1,103 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "audio.h"
+#include "convert.h"
+#include <vector>
+#include <math.h>
+
+// mono downmix or channel select, decimated to a low rate through a
+// windowed sinc anti alias filter. only the kept output samples are
+// filtered so the cost is a few multiply-adds per input frame
+class Preview
+{
+public:
+    enum { Mix = -1 };
+
+    struct Options
+    {
+        int rate = 8000;
+        // Mix or a channel index
+        int channel = Mix;
+        SampleFormat format = s16();
+    };
+
+    static bool validate(const Options& options)
+    {
+        return (options.rate > 0 && options.rate <= Format::SampleRate
+                && Format::SampleRate % options.rate == 0
+                && options.channel >= Mix && options.channel < Format::Channels
+                && SampleFormat::validate(options.format));
+    }
+
+    static SampleFormat s16()
+    {
+        SampleFormat format;
+        format.type = SampleFormat::S16;
+        return format;
+    }
+
+    Preview(const Options& options)
+        : mOptions(options), mFactor(Format::SampleRate / options.rate), mPhase(0), mPos(0)
+    {
+        // cut off at 90% of the new nyquist
+        const int taps = TapsPerFactor * mFactor + 1;
+        const double cutoff = 0.9 * 0.5 / mFactor;
+        const int mid = taps / 2;
+        mTaps.resize(taps);
+        double sum = 0.;
+        for (int i = 0; i < taps; ++i) {
+            const double x = i - mid;
+            const double sinc = x == 0 ? 2. * cutoff : sin(2. * M_PI * cutoff * x) / (M_PI * x);
+            const double window = 0.42 - 0.5 * cos(2. * M_PI * i / (taps - 1)) + 0.08 * cos(4. * M_PI * i / (taps - 1));
+            mTaps[i] = static_cast<float>(sinc * window);
+            sum += mTaps[i];
+        }
+        for (float& tap : mTaps)
+            tap = static_cast<float>(tap / sum);
+        // the delay line is stored twice so the filter never wraps
+        mDelay.assign(taps * 2, 0.f);
+    }
+
+    const Options& options() const { return mOptions; }
+
+    // appends mono samples to out, converted to the format by the caller
+    void process(const int32_t* frames, size_t count, std::vector<float>& out)
+    {
+        const size_t taps = mTaps.size();
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t* frame = frames + i * Format::Channels;
+            float sample;
+            if (mOptions.channel == Mix) {
+                sample = 0.f;
+                for (int c = 0; c < Format::Channels; ++c)
+                    sample += sampleToFloat(frame[c]);
+                sample *= 1.f / Format::Channels;
+            } else {
+                sample = sampleToFloat(frame[mOptions.channel]);
+            }
+            mDelay[mPos] = mDelay[mPos + taps] = sample;
+            if (++mPos == taps)
+                mPos = 0;
+            if (++mPhase < mFactor)
+                continue;
+            mPhase = 0;
+            // mPos is now the oldest sample
+            const float* d = &mDelay[mPos];
+            float acc = 0.f;
+            for (size_t t = 0; t < taps; ++t)
+                acc += d[t] * mTaps[t];
+            out.push_back(acc);
+        }
+    }
+
+private:
+    enum { TapsPerFactor = 16 };
+
+    Options mOptions;
+    int mFactor, mPhase;
+    size_t mPos;
+    std::vector<float> mTaps, mDelay;
+};
+
+#endif
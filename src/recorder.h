@@ -0,0 +1,384 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "utils.h"
+#include "audio.h"
+#include "cpustats.h"
+#include "wav.h"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// keeps the last seconds of the stream in a preallocated ring and writes
+// them plus what follows to a wav file when triggered, from a thread of its
+// own so it works while js is stuck. with signals on, a fatal signal makes
+// every recorder dump what it has before the process goes down. that path
+// takes no locks and doesn't allocate, the crashing thread may hold either
+class FlightRecorder
+{
+public:
+    struct Options
+    {
+        std::string directory;
+        // file names are <prefix>-<n>.wav, and <prefix>-crash.wav
+        std::string prefix = "uma8";
+        // seconds kept before a trigger and recorded after it
+        double before = 30.;
+        double after = 10.;
+        // what triggers it, checked by the owner: pipeline events by name,
+        // vad coming on
+        std::vector<std::string> events = { "trigger" };
+        bool vad = true;
+        // dump on fatal signals
+        bool signals = false;
+    };
+
+    struct Dump
+    {
+        std::string path, reason, error;
+        // absolute frame position of the first frame and the frame count
+        uint64_t position, frames;
+    };
+
+    struct Stats
+    {
+        uint64_t dumps, coalesced, failed;
+        bool pending;
+        // the writer thread
+        ThreadCpu::Usage cpu;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return !options.directory.empty() && options.before >= 0. && options.after >= 0. && options.before + options.after > 0.
+            && options.before + options.after <= 600.;
+    }
+
+    FlightRecorder(const Options& options, const std::function<void(const Dump&)>& done)
+        : mOptions(options), mDone(done), mBefore(msToFrames(options.before * 1000.)), mAfter(msToFrames(options.after * 1000.)),
+          mPosition(0), mPending(false), mStart(0), mEnd(0), mCount(0), mStopped(false), mStarted(false), mCrash(false),
+          mCrashDone(false), mDumps(0), mCoalesced(0), mFailed(0)
+    {
+        // two seconds on top so the oldest frames of a dump aren't
+        // overwritten while it's written
+        mFrames = mBefore + mAfter + msToFrames(2000.);
+        mRing.assign(mFrames * Format::Channels, 0);
+        const std::string crash = mOptions.directory + "/" + mOptions.prefix + "-crash.wav";
+        snprintf(mCrashPath, sizeof(mCrashPath), "%s", crash.c_str());
+    }
+
+    ~FlightRecorder()
+    {
+        watch(this, false);
+        stop();
+    }
+
+    const Options& options() const { return mOptions; }
+
+    bool start(std::string* error)
+    {
+        if (!mNotifier.isValid()) {
+            *error = std::string("Can't create notifier: ") + strerror(errno);
+            return false;
+        }
+        mStarted = true;
+        uv_thread_create(&mThread, FlightRecorder::run, this);
+        if (mOptions.signals)
+            watch(this, true);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!mStarted)
+            return;
+        mStopped = true;
+        mNotifier.notify();
+        uv_thread_join(&mThread);
+        mStarted = false;
+    }
+
+    // called from the usb thread
+    void write(const int32_t* frames, size_t count)
+    {
+        SpinLocker locker(&mLock);
+        while (count) {
+            const size_t offset = mPosition % mFrames;
+            const size_t n = std::min(count, mFrames - offset);
+            memcpy(&mRing[offset * Format::Channels], frames, n * Format::FrameSize);
+            frames += n * Format::Channels;
+            count -= n;
+            mPosition += n;
+        }
+        if (mPending && mPosition >= mEnd)
+            mNotifier.notify();
+    }
+
+    // from any thread, a trigger while a dump is pending is folded into it
+    void trigger(const std::string& reason)
+    {
+        SpinLocker locker(&mLock);
+        if (mPending) {
+            ++mCoalesced;
+            return;
+        }
+        mPending = true;
+        mReason = reason;
+        mStart = mPosition > mBefore ? mPosition - mBefore : 0;
+        mEnd = mPosition + mAfter;
+        if (!mAfter)
+            mNotifier.notify();
+    }
+
+    Stats stats()
+    {
+        SpinLocker locker(&mLock);
+        return Stats{ mDumps, mCoalesced, mFailed, mPending, mCpu.usage() };
+    }
+
+private:
+    enum { MaxWatched = 64, CrashWaitMs = 5000, NumSignals = 5 };
+
+    static const int* signals()
+    {
+        static const int sigs[NumSignals] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+        return sigs;
+    }
+
+    // what was installed before us, handlers are chained to it
+    static struct sigaction* previous()
+    {
+        static struct sigaction actions[NumSignals];
+        return actions;
+    }
+
+    // catches fatal signals for all recorders with signals on. the handlers
+    // stay installed once a recorder asked for them
+    static void watch(FlightRecorder* recorder, bool enable)
+    {
+        std::atomic<FlightRecorder*>* slots = watched();
+        for (int i = 0; i < MaxWatched; ++i) {
+            FlightRecorder* expected = enable ? nullptr : recorder;
+            if (slots[i].compare_exchange_strong(expected, enable ? recorder : nullptr))
+                break;
+        }
+        if (!enable)
+            return;
+        static std::atomic<bool> installed(false);
+        if (installed.exchange(true))
+            return;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = FlightRecorder::fatal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO;
+        for (int i = 0; i < NumSignals; ++i)
+            sigaction(signals()[i], &action, &previous()[i]);
+    }
+
+    static std::atomic<FlightRecorder*>* watched()
+    {
+        static std::atomic<FlightRecorder*> slots[MaxWatched];
+        return slots;
+    }
+
+    // async signal safe from here on
+    static void fatal(int sig, siginfo_t* info, void* context)
+    {
+        int index = 0;
+        while (index < NumSignals - 1 && signals()[index] != sig)
+            ++index;
+        const struct sigaction& prev = previous()[index];
+        const bool handler = prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN;
+        if (handler && (sig == SIGSEGV || sig == SIGBUS)) {
+            // node's wasm trap handler lives here and most faults it sees
+            // are recoverable. it goes first, if it gave up it put back what
+            // it replaced or raised the signal again
+            callPrevious(prev, sig, info, context);
+            struct sigaction now;
+            sigset_t pending;
+            sigaction(sig, nullptr, &now);
+            sigpending(&pending);
+            if (now.sa_sigaction == FlightRecorder::fatal && !sigismember(&pending, sig))
+                return;
+            dumpAll();
+            // ends things on the way out, one way or the other
+            return;
+        }
+        dumpAll();
+        if (handler) {
+            callPrevious(prev, sig, info, context);
+            return;
+        }
+        // the signal is blocked in here, it's delivered with the old action
+        // once we return
+        sigaction(sig, &prev, nullptr);
+        raise(sig);
+    }
+
+    static void callPrevious(const struct sigaction& prev, int sig, siginfo_t* info, void* context)
+    {
+        if (prev.sa_flags & SA_SIGINFO) {
+            prev.sa_sigaction(sig, info, context);
+        } else {
+            prev.sa_handler(sig);
+        }
+    }
+
+    // every recorder writes its crash dump, once
+    static void dumpAll()
+    {
+        static std::atomic<bool> dumped(false);
+        if (dumped.exchange(true))
+            return;
+        std::atomic<FlightRecorder*>* slots = watched();
+        for (int i = 0; i < MaxWatched; ++i) {
+            FlightRecorder* recorder = slots[i].load();
+            if (recorder) {
+                recorder->mCrash = true;
+                recorder->mNotifier.notify();
+            }
+        }
+        const timespec tick = { 0, 10000000 };
+        for (int waited = 0; waited < CrashWaitMs; waited += 10) {
+            bool done = true;
+            for (int i = 0; i < MaxWatched; ++i) {
+                FlightRecorder* recorder = slots[i].load();
+                if (recorder && !recorder->mCrashDone)
+                    done = false;
+            }
+            if (done)
+                break;
+            nanosleep(&tick, nullptr);
+        }
+    }
+
+    static void run(void* arg)
+    {
+        FlightRecorder* recorder = static_cast<FlightRecorder*>(arg);
+        for (;;) {
+            recorder->mCpu.sample();
+            recorder->mNotifier.wait(1000);
+            if (recorder->mCrash) {
+                recorder->crashDump();
+                return;
+            }
+            if (recorder->mStopped)
+                break;
+            uint64_t start, end;
+            std::string reason;
+            {
+                SpinLocker locker(&recorder->mLock);
+                if (!recorder->mPending || recorder->mPosition < recorder->mEnd)
+                    continue;
+                start = recorder->mStart;
+                end = recorder->mEnd;
+                reason = recorder->mReason;
+            }
+            Dump dump{ recorder->mOptions.directory + "/" + recorder->mOptions.prefix + "-" + std::to_string(recorder->mCount++) + ".wav",
+                       reason, std::string(), start, end - start };
+            if (!recorder->writeWav(dump.path.c_str(), start, end))
+                dump.error = std::string("Can't write ") + dump.path + ": " + strerror(errno);
+            {
+                SpinLocker locker(&recorder->mLock);
+                recorder->mPending = false;
+                if (dump.error.empty()) {
+                    ++recorder->mDumps;
+                } else {
+                    ++recorder->mFailed;
+                }
+            }
+            if (recorder->mDone)
+                recorder->mDone(dump);
+        }
+        recorder->mCpu.sample();
+    }
+
+    void crashDump()
+    {
+        // no lock, the usb thread may have died holding it. a chunk being
+        // written right now can end up torn
+        const uint64_t end = mPosition;
+        const uint64_t start = end > mBefore ? end - mBefore : 0;
+        writeWav(mCrashPath, start, end);
+        mCrashDone = true;
+    }
+
+    // frames [start, end) from the ring, only syscalls
+    bool writeWav(const char* path, uint64_t start, uint64_t end)
+    {
+        // whatever has been overwritten already is gone
+        if (end - start > mFrames)
+            start = end - mFrames;
+        int fd;
+        EINTRWRAP(fd, ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (fd == -1)
+            return false;
+        uint8_t header[44];
+        const uint64_t frames = end - start;
+        WavWriter::header(header, Format::SampleRate, Format::Channels, 32, static_cast<uint32_t>(frames * Format::FrameSize));
+        const size_t offset = start % mFrames;
+        const size_t first = std::min<size_t>(frames, mFrames - offset);
+        iovec iov[3] = {
+            { header, sizeof(header) },
+            { &mRing[offset * Format::Channels], first * Format::FrameSize },
+            { &mRing[0], (frames - first) * Format::FrameSize }
+        };
+        bool ok = true;
+        int index = 0;
+        while (index < 3 && ok) {
+            ssize_t written;
+            EINTRWRAP(written, writev(fd, iov + index, 3 - index));
+            if (written < 0) {
+                ok = false;
+                break;
+            }
+            // skip past what made it out
+            while (index < 3 && static_cast<size_t>(written) >= iov[index].iov_len) {
+                written -= iov[index].iov_len;
+                ++index;
+            }
+            if (index < 3) {
+                iov[index].iov_base = static_cast<uint8_t*>(iov[index].iov_base) + written;
+                iov[index].iov_len -= written;
+            }
+        }
+        const int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return ok;
+    }
+
+    Options mOptions;
+    std::function<void(const Dump&)> mDone;
+    const size_t mBefore, mAfter;
+    size_t mFrames;
+    std::vector<int32_t> mRing;
+    SpinLock mLock;
+    // under mLock, frames written so far and the pending dump
+    uint64_t mPosition;
+    bool mPending;
+    uint64_t mStart, mEnd;
+    std::string mReason;
+    // writer thread only
+    uint64_t mCount;
+    std::atomic<bool> mStopped;
+    bool mStarted;
+    uv_thread_t mThread;
+    Notifier mNotifier;
+    std::atomic<bool> mCrash, mCrashDone;
+    char mCrashPath[4096];
+    uint64_t mDumps, mCoalesced, mFailed;
+    ThreadCpu mCpu;
+};
+
+#endif
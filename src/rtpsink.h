@@ -0,0 +1,411 @@
+#ifndef RTPSINK_H
+#define RTPSINK_H
+
+#include "utils.h"
+#include "audio.h"
+#include "cpustats.h"
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// sends the stream as rtp (rfc 3550) over udp, uncompressed L16 or L24
+// (rfc 3551, network byte order). the usb thread packetizes into a bounded
+// ring of fixed size packets and a thread of its own sends them in batches
+// with sendmmsg. when the ring is full packets are dropped, their sequence
+// numbers and timestamps are still used up so receivers see the loss
+class RtpSink
+{
+public:
+    enum Payload { L16, L24 };
+
+    struct Options
+    {
+        std::string host;
+        int port = 0;
+        Payload payload = L24;
+        // dynamic by default, there's no static type for 24 kHz
+        int payloadType = 96;
+        // ms of audio per packet
+        double ptime = 5.;
+        // random if not set
+        uint32_t ssrc = 0;
+        bool randomSsrc = true;
+        // multicast only, the outgoing interface is an address for ipv4
+        // and an interface name for ipv6
+        int ttl = 1;
+        std::string interface;
+        bool loop = true;
+        // ring size in bytes
+        size_t bufferSize = 1 << 20;
+        // ms of audio to collect before waking the sender
+        double batch = 20.;
+    };
+
+    struct Stats
+    {
+        uint64_t packets, bytes, sends, sendErrors, overruns;
+        // over the last second
+        double packetsPerSecond;
+        size_t fill, maxFill;
+        uint32_t ssrc;
+        std::string error;
+        // the sender thread
+        ThreadCpu::Usage cpu;
+    };
+
+    enum { HeaderSize = 12, MaxPayload = 1440, MaxBatch = 64 };
+
+    static bool validate(const Options& options)
+    {
+        const size_t frames = framesPerPacket(options);
+        return !options.host.empty() && options.port > 0 && options.port < 65536 && options.payloadType >= 0
+            && options.payloadType < 128 && frames > 0 && frames * Format::Channels * sampleSize(options.payload) <= MaxPayload
+            && options.ttl >= 0 && options.ttl < 256 && options.batch >= 0.
+            && options.bufferSize >= 4 * (HeaderSize + MaxPayload);
+    }
+
+    static const char* payloadName(Payload payload)
+    {
+        return payload == L16 ? "L16" : "L24";
+    }
+
+    RtpSink(const Options& options)
+        : mOptions(options), mFd(-1), mFrames(framesPerPacket(options)), mFill(0), mHead(0), mTail(0), mStopped(false),
+          mStarted(false), mRateStart(0), mRatePackets(0)
+    {
+        mPacketSize = HeaderSize + mFrames * Format::Channels * sampleSize(options.payload);
+        mSlots = std::max<size_t>(options.bufferSize / mPacketSize, 4);
+        mRing.resize(mSlots * mPacketSize);
+        mStaging.resize(mPacketSize);
+        mBatchPackets = std::max<size_t>(std::min<size_t>(msToFrames(options.batch) / mFrames, mSlots / 2), 1);
+
+        std::random_device random;
+        mSsrc = options.randomSsrc ? random() : options.ssrc;
+        mSequence = static_cast<uint16_t>(random());
+        mTimestamp = random();
+        mFirst = true;
+        mStats = Stats{ 0, 0, 0, 0, 0, 0., 0, 0, mSsrc, std::string(), ThreadCpu::Usage{ 0., 0, 0 } };
+    }
+
+    ~RtpSink()
+    {
+        stop();
+        if (mFd != -1)
+            ::close(mFd);
+    }
+
+    const Options& options() const { return mOptions; }
+
+    bool start(std::string* error)
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_NUMERICSERV;
+        addrinfo* res;
+        const std::string port = std::to_string(mOptions.port);
+        const int ret = getaddrinfo(mOptions.host.c_str(), port.c_str(), &hints, &res);
+        if (ret != 0) {
+            *error = "Can't resolve " + mOptions.host + ": " + gai_strerror(ret);
+            return false;
+        }
+        bool ok = open(res, error);
+        freeaddrinfo(res);
+        if (!ok)
+            return false;
+        if (!mNotifier.isValid()) {
+            *error = std::string("Can't create notifier: ") + strerror(errno);
+            return false;
+        }
+        mStarted = true;
+        uv_thread_create(&mThread, RtpSink::run, this);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!mStarted)
+            return;
+        mStopped = true;
+        mNotifier.notify();
+        uv_thread_join(&mThread);
+        mStarted = false;
+    }
+
+    // called from the usb thread
+    void push(const int32_t* frames, size_t count)
+    {
+        const size_t sample = sampleSize(mOptions.payload);
+        while (count) {
+            const size_t take = std::min(count, mFrames - mFill);
+            uint8_t* out = &mStaging[HeaderSize + mFill * Format::Channels * sample];
+            const size_t samples = take * Format::Channels;
+            if (mOptions.payload == L16) {
+                for (size_t i = 0; i < samples; ++i) {
+                    const uint32_t x = static_cast<uint32_t>(frames[i]);
+                    *out++ = x >> 24;
+                    *out++ = x >> 16;
+                }
+            } else {
+                for (size_t i = 0; i < samples; ++i) {
+                    const uint32_t x = static_cast<uint32_t>(frames[i]);
+                    *out++ = x >> 24;
+                    *out++ = x >> 16;
+                    *out++ = x >> 8;
+                }
+            }
+            frames += samples;
+            count -= take;
+            mFill += take;
+            if (mFill == mFrames) {
+                finish();
+                mFill = 0;
+            }
+        }
+    }
+
+    Stats stats()
+    {
+        SpinLocker locker(&mLock);
+        Stats ret = mStats;
+        ret.fill = (mHead - mTail) * mPacketSize;
+        ret.cpu = mCpu.usage();
+        return ret;
+    }
+
+private:
+    static size_t sampleSize(Payload payload) { return payload == L16 ? 2 : 3; }
+
+    static size_t framesPerPacket(const Options& options)
+    {
+        return options.ptime > 0. ? msToFrames(options.ptime) : 0;
+    }
+
+    bool open(const addrinfo* res, std::string* error)
+    {
+        // no SOCK_NONBLOCK and SOCK_CLOEXEC on os x
+        mFd = ::socket(res->ai_family, SOCK_DGRAM, 0);
+        if (mFd == -1 || fcntl(mFd, F_SETFD, FD_CLOEXEC) == -1 || fcntl(mFd, F_SETFL, fcntl(mFd, F_GETFL) | O_NONBLOCK) == -1) {
+            *error = std::string("Can't create socket: ") + strerror(errno);
+            return false;
+        }
+        int ret = 0;
+        if (res->ai_family == AF_INET) {
+            const sockaddr_in* addr = reinterpret_cast<const sockaddr_in*>(res->ai_addr);
+            if (IN_MULTICAST(ntohl(addr->sin_addr.s_addr))) {
+                const unsigned char ttl = static_cast<unsigned char>(mOptions.ttl);
+                const unsigned char loop = mOptions.loop ? 1 : 0;
+                ret = setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+                if (!ret)
+                    ret = setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+                if (!ret && !mOptions.interface.empty()) {
+                    in_addr iface;
+                    if (inet_pton(AF_INET, mOptions.interface.c_str(), &iface) != 1) {
+                        *error = "Multicast interface needs to be an ipv4 address";
+                        return false;
+                    }
+                    ret = setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+                }
+            }
+        } else if (res->ai_family == AF_INET6) {
+            const sockaddr_in6* addr = reinterpret_cast<const sockaddr_in6*>(res->ai_addr);
+            if (IN6_IS_ADDR_MULTICAST(&addr->sin6_addr)) {
+                const int hops = mOptions.ttl;
+                const unsigned int loop = mOptions.loop ? 1 : 0;
+                ret = setsockopt(mFd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+                if (!ret)
+                    ret = setsockopt(mFd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop));
+                if (!ret && !mOptions.interface.empty()) {
+                    const unsigned int index = if_nametoindex(mOptions.interface.c_str());
+                    if (!index) {
+                        *error = "No interface " + mOptions.interface;
+                        return false;
+                    }
+                    ret = setsockopt(mFd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index));
+                }
+            }
+        }
+        if (ret != 0) {
+            *error = std::string("Can't set up multicast: ") + strerror(errno);
+            return false;
+        }
+        // connected, so the sender doesn't pass an address for every packet
+        EINTRWRAP(ret, ::connect(mFd, res->ai_addr, res->ai_addrlen));
+        if (ret != 0) {
+            *error = "Can't connect to " + mOptions.host + ": " + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // stamps the staged packet and queues it
+    void finish()
+    {
+        uint8_t* header = &mStaging[0];
+        header[0] = 0x80;
+        // marker on the first packet of the stream
+        header[1] = static_cast<uint8_t>(mOptions.payloadType) | (mFirst ? 0x80 : 0);
+        header[2] = mSequence >> 8;
+        header[3] = mSequence & 0xff;
+        header[4] = mTimestamp >> 24;
+        header[5] = (mTimestamp >> 16) & 0xff;
+        header[6] = (mTimestamp >> 8) & 0xff;
+        header[7] = mTimestamp & 0xff;
+        header[8] = mSsrc >> 24;
+        header[9] = (mSsrc >> 16) & 0xff;
+        header[10] = (mSsrc >> 8) & 0xff;
+        header[11] = mSsrc & 0xff;
+        ++mSequence;
+        mTimestamp += static_cast<uint32_t>(mFrames);
+
+        SpinLocker locker(&mLock);
+        const size_t fill = mHead - mTail;
+        if (fill == mSlots) {
+            ++mStats.overruns;
+            return;
+        }
+        mFirst = false;
+        memcpy(&mRing[(mHead % mSlots) * mPacketSize], header, mPacketSize);
+        ++mHead;
+        mStats.maxFill = std::max(mStats.maxFill, (fill + 1) * mPacketSize);
+        // the sender only waits while there's less than a batch
+        if (fill + 1 == mBatchPackets)
+            mNotifier.notify();
+    }
+
+    static void run(void* arg)
+    {
+        RtpSink* sink = static_cast<RtpSink*>(arg);
+#ifdef __linux__
+        mmsghdr msgs[MaxBatch];
+        memset(msgs, 0, sizeof(msgs));
+#endif
+        iovec iovs[MaxBatch];
+        sink->mRateStart = uv_hrtime();
+        for (;;) {
+            sink->mCpu.sample();
+            bool wait;
+            {
+                SpinLocker locker(&sink->mLock);
+                wait = sink->mHead - sink->mTail < sink->mBatchPackets;
+            }
+            if (wait && !sink->mStopped) {
+                // wait for a batch, but don't sit on a partial one forever
+                sink->mNotifier.wait(static_cast<int>(std::max(sink->mOptions.batch, 1.)));
+            }
+            if (sink->mStopped)
+                break;
+            sink->updateRate();
+            size_t pending;
+            size_t first;
+            {
+                SpinLocker locker(&sink->mLock);
+                pending = sink->mHead - sink->mTail;
+                first = sink->mTail % sink->mSlots;
+            }
+            if (!pending)
+                continue;
+            // the producer never touches [tail, head), up to the end of the ring
+            const size_t count = std::min<size_t>(std::min<size_t>(pending, sink->mSlots - first), MaxBatch);
+            for (size_t i = 0; i < count; ++i) {
+                iovs[i].iov_base = &sink->mRing[(first + i) * sink->mPacketSize];
+                iovs[i].iov_len = sink->mPacketSize;
+            }
+            int sent;
+#ifdef __linux__
+            for (size_t i = 0; i < count; ++i) {
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            EINTRWRAP(sent, sendmmsg(sink->mFd, msgs, count, 0));
+#else
+            sent = 0;
+            while (static_cast<size_t>(sent) < count) {
+                ssize_t ret;
+                EINTRWRAP(ret, ::send(sink->mFd, iovs[sent].iov_base, iovs[sent].iov_len, 0));
+                if (ret < 0) {
+                    if (!sent)
+                        sent = -1;
+                    break;
+                }
+                ++sent;
+            }
+#endif
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                    // stop() pokes the notifier so this doesn't hold it up
+                    pollfd pfds[2] = { { sink->mFd, POLLOUT, 0 }, { sink->mNotifier.fd(), POLLIN, 0 } };
+                    int ret;
+                    EINTRWRAP(ret, poll(pfds, 2, 100));
+                    if (ret > 0 && (pfds[1].revents & POLLIN))
+                        sink->mNotifier.drain();
+                    continue;
+                }
+                // nobody listening on a unicast port shows up here as
+                // ECONNREFUSED, skip the packet and carry on
+                SpinLocker locker(&sink->mLock);
+                ++sink->mStats.sendErrors;
+                sink->mStats.error = strerror(errno);
+                ++sink->mTail;
+                continue;
+            }
+            SpinLocker locker(&sink->mLock);
+            sink->mTail += sent;
+            sink->mStats.packets += sent;
+            sink->mStats.bytes += sent * sink->mPacketSize;
+            ++sink->mStats.sends;
+            // the last error is only kept while it keeps happening
+            sink->mStats.error.clear();
+        }
+        sink->mCpu.sample();
+    }
+
+    void updateRate()
+    {
+        const uint64_t now = uv_hrtime();
+        if (now - mRateStart < 1000000000ull)
+            return;
+        SpinLocker locker(&mLock);
+        mStats.packetsPerSecond = (mStats.packets - mRatePackets) * 1e9 / (now - mRateStart);
+        mRatePackets = mStats.packets;
+        mRateStart = now;
+    }
+
+    Options mOptions;
+    int mFd;
+    // frames per packet and bytes per packet including the header
+    size_t mFrames, mPacketSize;
+    // usb thread only, the packet being filled and how many frames it has
+    std::vector<uint8_t> mStaging;
+    size_t mFill;
+    uint32_t mSsrc, mTimestamp;
+    uint16_t mSequence;
+    bool mFirst;
+    // mSlots packets, head and tail count packets
+    std::vector<uint8_t> mRing;
+    size_t mSlots, mBatchPackets;
+    uint64_t mHead, mTail;
+    std::atomic<bool> mStopped;
+    bool mStarted;
+    uv_thread_t mThread;
+    SpinLock mLock;
+    Notifier mNotifier;
+    Stats mStats;
+    ThreadCpu mCpu;
+    // sender thread only
+    uint64_t mRateStart, mRatePackets;
+};
+
+#endif
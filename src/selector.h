@@ -0,0 +1,258 @@
+#ifndef SELECTOR_H
+#define SELECTOR_H
+
+#include "audio.h"
+#include <vector>
+#include <math.h>
+
+// scores a number of arrays and switches between them. not thread safe,
+// the owner serializes calls from the different usb threads
+class ArraySelector
+{
+public:
+    struct Options
+    {
+        // score = snr (dB) * snrWeight + vad duty (0-1) * vadWeight + doa stability (0-1) * doaWeight
+        double snrWeight = 1.;
+        double vadWeight = 10.;
+        double doaWeight = 5.;
+        // a candidate needs to beat the current source by margin for holdTime ms
+        double margin = 3.;
+        double holdTime = 500.;
+        double crossfade = 10.;
+        // smoothing of the scores, in ms
+        double timeConstant = 300.;
+    };
+
+    struct Switch
+    {
+        int from, to;
+        double fromScore, toScore;
+    };
+
+    struct Score
+    {
+        int source;
+        double score, snr, vad, stability;
+    };
+
+    ArraySelector()
+        : mSelected(-1), mPending(-1)
+    {
+    }
+
+    void setOptions(const Options& options) { mOptions = options; }
+    const Options& options() const { return mOptions; }
+
+    int add()
+    {
+        int id = 0;
+        while (id < static_cast<int>(mSources.size()) && mSources[id].active)
+            ++id;
+        if (id == static_cast<int>(mSources.size()))
+            mSources.emplace_back();
+        mSources[id] = Source();
+        mSources[id].active = true;
+        return id;
+    }
+
+    void remove(int id)
+    {
+        if (!valid(id))
+            return;
+        mSources[id].active = false;
+        if (mPending != -1 && (mPending == id || mSelected == id)) {
+            mPending = -1;
+            mIncoming.clear();
+            mOutgoing.clear();
+        }
+        if (mSelected == id) {
+            mSelected = -1;
+            int best = -1;
+            for (int i = 0; i < static_cast<int>(mSources.size()); ++i) {
+                if (mSources[i].active && mSources[i].seen && (best == -1 || mSources[i].score > mSources[best].score))
+                    best = i;
+            }
+            mSelected = best;
+        }
+    }
+
+    int selected() const { return mSelected; }
+
+    std::vector<Score> scores() const
+    {
+        std::vector<Score> ret;
+        for (int i = 0; i < static_cast<int>(mSources.size()); ++i) {
+            const Source& src = mSources[i];
+            if (src.active)
+                ret.push_back(Score{ i, src.score, src.snr, src.vad, hypot(src.doaX, src.doaY) });
+        }
+        return ret;
+    }
+
+    void metadata(int id, bool vad, uint16_t angle)
+    {
+        if (!valid(id))
+            return;
+        Source& src = mSources[id];
+        src.vadState = vad;
+        const double rad = angle * M_PI / 180.;
+        src.doaX += DoaAlpha * (cos(rad) - src.doaX);
+        src.doaY += DoaAlpha * (sin(rad) - src.doaY);
+    }
+
+    // feeds count frames from source id that arrived at now (ns). returns
+    // true and fills out when there's audio to deliver. a switch away from a
+    // source that's still delivering pairs up the chunks of both covering
+    // the same time, going by when they arrived, and crossfades those. sw is
+    // filled when the switch goes out
+    bool process(int id, const int32_t* frames, size_t count, uint64_t now, std::vector<int32_t>& out, Switch* sw)
+    {
+        if (!valid(id) || !count)
+            return false;
+        Source& src = mSources[id];
+        const double dt = count * 1000. / Format::SampleRate;
+        update(src, frames, count, dt);
+        src.starved = 0.;
+        src.arrived = now;
+
+        if (mSelected == -1) {
+            mSelected = id;
+        } else if (mPending == id) {
+            if (mIncoming.empty()) {
+                mIncoming.assign(frames, frames + count * Format::Channels);
+            } else {
+                // the outgoing source is late, keep what comes in
+                mIncoming.insert(mIncoming.end(), frames, frames + count * Format::Channels);
+            }
+            if (!mOutgoing.empty()) {
+                crossfade(out, sw);
+                return true;
+            }
+            Source& cur = mSources[mSelected];
+            cur.starved += dt;
+            if (cur.starved < StarvedMs)
+                return false;
+            // it stopped delivering, no fade then
+            out.swap(mIncoming);
+            finishSwitch(sw);
+            return true;
+        } else if (mSelected != id) {
+            Source& cur = mSources[mSelected];
+            cur.starved += dt;
+            if (src.score > cur.score + mOptions.margin) {
+                src.ahead += dt;
+            } else {
+                src.ahead = 0.;
+            }
+            if (mPending != -1 || (src.ahead < mOptions.holdTime && cur.starved < std::max(mOptions.holdTime, StarvedMs)))
+                return false;
+            for (Source& s : mSources)
+                s.ahead = 0.;
+            mPending = id;
+            mSwitch = Switch{ mSelected, id, cur.score, src.score };
+            if (cur.starved >= StarvedMs) {
+                out.assign(frames, frames + count * Format::Channels);
+                finishSwitch(sw);
+                return true;
+            }
+            // when the outgoing chunk for this time already went out this
+            // one is dropped and the next pair is faded
+            const uint64_t half = static_cast<uint64_t>(dt * 5e5);
+            if (now - cur.arrived >= half)
+                mIncoming.assign(frames, frames + count * Format::Channels);
+            return false;
+        } else if (mPending != -1) {
+            if (!mOutgoing.empty()) {
+                // the incoming source is late, the held chunk goes out as is
+                out.swap(mOutgoing);
+                mOutgoing.assign(frames, frames + count * Format::Channels);
+                return true;
+            }
+            mOutgoing.assign(frames, frames + count * Format::Channels);
+            if (mIncoming.empty())
+                return false;
+            crossfade(out, sw);
+            return true;
+        }
+
+        out.assign(frames, frames + count * Format::Channels);
+        return true;
+    }
+
+private:
+    static constexpr double DoaAlpha = 0.2;
+    static constexpr double StarvedMs = 200.;
+    // how fast the noise floor is allowed to rise, in dB per second
+    static constexpr double FloorRise = 1.;
+
+    struct Source
+    {
+        bool active = false, seen = false, vadState = false;
+        double level = 0., floor = 0., snr = 0., vad = 0., doaX = 0., doaY = 0., score = 0.;
+        double ahead = 0., starved = 0.;
+        // when its last chunk came in
+        uint64_t arrived = 0;
+    };
+
+    // the incoming chunk with its start faded in over the outgoing one
+    void crossfade(std::vector<int32_t>& out, Switch* sw)
+    {
+        const size_t overlap = std::min(mIncoming.size(), mOutgoing.size()) / Format::Channels;
+        const size_t fade = std::min(overlap, std::max<size_t>(msToFrames(mOptions.crossfade), 1));
+        out.swap(mIncoming);
+        for (size_t i = 0; i < fade; ++i) {
+            const double gain = static_cast<double>(i + 1) / (fade + 1);
+            for (int c = 0; c < Format::Channels; ++c) {
+                const size_t s = i * Format::Channels + c;
+                out[s] = static_cast<int32_t>(out[s] * gain + mOutgoing[s] * (1. - gain));
+            }
+        }
+        finishSwitch(sw);
+    }
+
+    void finishSwitch(Switch* sw)
+    {
+        if (sw)
+            *sw = mSwitch;
+        mSelected = mPending;
+        mPending = -1;
+        mIncoming.clear();
+        mOutgoing.clear();
+    }
+
+    bool valid(int id) const { return id >= 0 && id < static_cast<int>(mSources.size()) && mSources[id].active; }
+
+    void update(Source& src, const int32_t* frames, size_t count, double dt)
+    {
+        const double db = powerToDb(meanSquare(frames, count));
+        if (!src.seen) {
+            src.seen = true;
+            src.level = src.floor = db;
+        }
+        const double alpha = 1. - exp(-dt / mOptions.timeConstant);
+        src.level += alpha * (db - src.level);
+        // minimum tracking, drops immediately and rises slowly
+        if (db < src.floor) {
+            src.floor = db;
+        } else {
+            src.floor = std::min(src.floor + FloorRise * dt / 1000., src.level);
+        }
+        src.snr = std::min(std::max(src.level - src.floor, 0.), 60.);
+        src.vad += alpha * ((src.vadState ? 1. : 0.) - src.vad);
+        src.score = (mOptions.snrWeight * src.snr
+                     + mOptions.vadWeight * src.vad
+                     + mOptions.doaWeight * hypot(src.doaX, src.doaY));
+    }
+
+    Options mOptions;
+    std::vector<Source> mSources;
+    int mSelected;
+    // a switch waiting for a chunk of each source covering the same time,
+    // and those chunks as they come in
+    int mPending;
+    Switch mSwitch;
+    std::vector<int32_t> mIncoming, mOutgoing;
+};
+
+#endif
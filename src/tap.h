@@ -0,0 +1,147 @@
+#ifndef TAP_H
+#define TAP_H
+
+#include "utils.h"
+#include "fdsink.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// mirrors the output of a pipeline stage for debugging, either into a
+// bounded ring that keeps the most recent bytes for js to take, or into a
+// file written from its own thread. stages hold a plain pointer to their
+// tap so an unused tap point costs one branch
+class Tap
+{
+public:
+    struct Options
+    {
+        // a file to write to, or empty for the ring
+        std::string path;
+        // ring size, or the write buffer for files
+        size_t size = 1 << 20;
+    };
+
+    struct Stats
+    {
+        uint64_t bytes, dropped;
+        size_t buffered;
+        // the writer thread of a file tap, zero for rings
+        ThreadCpu::Usage cpu;
+    };
+
+    static bool validate(const Options& options)
+    {
+        return options.size >= 4096 && options.size <= (256 << 20);
+    }
+
+    Tap(const Options& options, const std::string& format)
+        : mOptions(options), mFormat(format), mFd(-1), mHead(0), mFill(0), mBytes(0), mDropped(0)
+    {
+    }
+
+    ~Tap()
+    {
+        mSink.reset();
+        if (mFd != -1)
+            ::close(mFd);
+    }
+
+    const Options& options() const { return mOptions; }
+
+    // what the bytes are, s32le 2ch 24000 and so on
+    const std::string& format() const { return mFormat; }
+
+    bool start(std::string* error)
+    {
+        if (mOptions.path.empty()) {
+            mRing.resize(mOptions.size);
+            return true;
+        }
+        EINTRWRAP(mFd, ::open(mOptions.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (mFd == -1) {
+            *error = "Can't open " + mOptions.path + ": " + strerror(errno);
+            return false;
+        }
+        FdSink::Options options;
+        options.fd = mFd;
+        options.bufferSize = mOptions.size;
+        mSink.reset(new FdSink(options));
+        return mSink->start(error);
+    }
+
+    // called from the thread running the stage
+    void write(const void* data, size_t bytes)
+    {
+        if (mSink) {
+            mSink->write(static_cast<const uint8_t*>(data), bytes);
+            return;
+        }
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        SpinLocker locker(&mLock);
+        const size_t size = mRing.size();
+        mBytes += bytes;
+        if (bytes > size) {
+            // only the tail fits
+            mDropped += mFill + bytes - size;
+            src += bytes - size;
+            bytes = size;
+            mFill = 0;
+        }
+        if (mFill + bytes > size) {
+            // overwrite the oldest
+            const size_t lost = mFill + bytes - size;
+            mDropped += lost;
+            mHead = (mHead + lost) % size;
+            mFill -= lost;
+        }
+        const size_t offset = (mHead + mFill) % size;
+        const size_t first = std::min(bytes, size - offset);
+        memcpy(&mRing[offset], src, first);
+        memcpy(&mRing[0], src + first, bytes - first);
+        mFill += bytes;
+    }
+
+    // the buffered bytes of a ring tap, oldest first
+    std::vector<uint8_t> take()
+    {
+        SpinLocker locker(&mLock);
+        std::vector<uint8_t> ret(mFill);
+        const size_t size = mRing.size();
+        for (size_t i = 0; i < mFill;) {
+            const size_t offset = (mHead + i) % size;
+            const size_t chunk = std::min(mFill - i, size - offset);
+            memcpy(&ret[i], &mRing[offset], chunk);
+            i += chunk;
+        }
+        mHead = mFill = 0;
+        return ret;
+    }
+
+    Stats stats()
+    {
+        if (mSink) {
+            const FdSink::Stats st = mSink->stats();
+            return Stats{ st.bytesWritten, st.droppedBytes, st.fill, st.cpu };
+        }
+        SpinLocker locker(&mLock);
+        return Stats{ mBytes, mDropped, mFill, ThreadCpu::Usage{ 0., 0, 0 } };
+    }
+
+private:
+    Options mOptions;
+    std::string mFormat;
+    int mFd;
+    std::unique_ptr<FdSink> mSink;
+    SpinLock mLock;
+    std::vector<uint8_t> mRing;
+    // oldest byte and number of bytes in the ring
+    size_t mHead, mFill;
+    uint64_t mBytes, mDropped;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef TRIGGERS_H
+#define TRIGGERS_H
+
+#include "audio.h"
+#include "event.h"
+#include <string>
+#include <vector>
+#include <math.h>
+
+// level based trigger rules, evaluated on 1ms blocks of the stream
+class Triggers
+{
+public:
+    struct Rule
+    {
+        enum Type { Threshold, Transient, Sustained } type;
+        std::string name;
+        // dBFS, the level to go above and (threshold and sustained) the level
+        // to drop below again before the rule is released
+        double level, release;
+        // transient only, how far above the background the onset needs to be, in dB
+        double ratio;
+        // ms, averaging window of the level. for transients also the window of the background
+        double window, background;
+        // sustained only, ms the level needs to stay above level
+        double duration;
+        // ms to stay quiet after firing
+        double holdoff;
+        // ms of audio from before the trigger to attach, 0 for none
+        double preRoll;
+    };
+
+    static Rule rule(Rule::Type type)
+    {
+        switch (type) {
+        case Rule::Threshold:
+            return Rule{ type, "threshold", -20., -26., 0., 10., 0., 0., 0., 0. };
+        case Rule::Transient:
+            return Rule{ type, "transient", -40., -40., 15., 5., 500., 0., 250., 0. };
+        case Rule::Sustained:
+            break;
+        }
+        return Rule{ type, "sustained", -30., -33., 0., 1000., 0., 5000., 0., 0. };
+    }
+
+    static const char* typeName(Rule::Type type)
+    {
+        switch (type) {
+        case Rule::Threshold:
+            return "threshold";
+        case Rule::Transient:
+            return "transient";
+        case Rule::Sustained:
+            break;
+        }
+        return "sustained";
+    }
+
+    static bool validate(const Rule& rule)
+    {
+        return (rule.release <= rule.level && rule.window >= 1. && rule.duration >= 0.
+                && rule.holdoff >= 0. && rule.preRoll >= 0. && rule.preRoll <= MaxPreRoll
+                && (rule.type != Rule::Transient || rule.background > rule.window)
+                && (rule.type != Rule::Sustained || rule.window <= MaxWindow));
+    }
+
+    Triggers(const std::vector<Rule>& rules)
+        : mBlockPower(0.), mBlockFrames(0)
+    {
+        double preRoll = 0.;
+        for (const Rule& rule : rules) {
+            State state;
+            state.rule = rule;
+            state.active = false;
+            state.level = state.background = -200.;
+            state.above = state.quiet = 0.;
+            if (rule.type == Rule::Sustained) {
+                state.blocks.assign(static_cast<size_t>(rule.window), 0.);
+                state.sum = 0.;
+                state.pos = 0;
+            }
+            mStates.push_back(state);
+            preRoll = std::max(preRoll, rule.preRoll);
+        }
+        if (preRoll > 0.)
+            mHistory.resize(msToFrames(preRoll + 1000.));
+    }
+
+    // position is the absolute frame position of the first frame
+    void process(const int32_t* frames, size_t count, uint64_t position, std::vector<Event>& events)
+    {
+        mHistory.write(frames, count);
+        const size_t blockFrames = msToFrames(1.);
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t* frame = frames + i * Format::Channels;
+            for (int c = 0; c < Format::Channels; ++c) {
+                const double s = sampleToFloat(frame[c]);
+                mBlockPower += s * s;
+            }
+            if (++mBlockFrames < blockFrames)
+                continue;
+            const double power = mBlockPower / (blockFrames * Format::Channels);
+            mBlockPower = 0.;
+            mBlockFrames = 0;
+            for (State& state : mStates)
+                evaluate(state, power, position + i + 1, events);
+        }
+    }
+
+private:
+    enum { MaxPreRoll = 30000, MaxWindow = 60000 };
+
+    struct State
+    {
+        Rule rule;
+        bool active;
+        double level, background, above, quiet;
+        // sustained, ring of block powers
+        std::vector<double> blocks;
+        double sum;
+        size_t pos;
+    };
+
+    static double smooth(double current, double db, double window)
+    {
+        // first block seeds the average
+        if (current <= -200.)
+            return db;
+        return current + (1. - exp(-1. / window)) * (db - current);
+    }
+
+    void evaluate(State& state, double power, uint64_t position, std::vector<Event>& events)
+    {
+        const Rule& rule = state.rule;
+        const double db = powerToDb(power);
+        if (state.quiet > 0.)
+            state.quiet -= 1.;
+
+        switch (rule.type) {
+        case Rule::Threshold:
+            state.level = smooth(state.level, db, rule.window);
+            if (!state.active && state.level >= rule.level && state.quiet <= 0.) {
+                state.active = true;
+                fire(state, position, events);
+            } else if (state.active && state.level < rule.release) {
+                state.active = false;
+                state.quiet = rule.holdoff;
+                fire(state, position, events);
+            }
+            break;
+        case Rule::Transient:
+            state.level = smooth(state.level, db, rule.window);
+            if (state.background > -200. && state.level >= rule.level
+                && state.level - state.background >= rule.ratio && state.quiet <= 0.) {
+                state.active = true;
+                fire(state, position, events);
+                state.active = false;
+                state.quiet = rule.holdoff;
+            }
+            // the background follows after the check so the onset doesn't mask itself
+            state.background = smooth(state.background, db, rule.background);
+            break;
+        case Rule::Sustained:
+            state.sum += power - state.blocks[state.pos];
+            state.blocks[state.pos] = power;
+            if (++state.pos == state.blocks.size())
+                state.pos = 0;
+            state.level = powerToDb(std::max(state.sum, 0.) / state.blocks.size());
+            if (state.level >= rule.level) {
+                state.above += 1.;
+            } else {
+                state.above = 0.;
+            }
+            if (!state.active && state.above >= rule.duration && state.quiet <= 0.) {
+                state.active = true;
+                fire(state, position, events);
+            } else if (state.active && state.level < rule.release) {
+                state.active = false;
+                state.quiet = rule.holdoff;
+                fire(state, position, events);
+            }
+            break;
+        }
+    }
+
+    void fire(const State& state, uint64_t position, std::vector<Event>& events)
+    {
+        events.emplace_back("trigger");
+        Event& event = events.back();
+        event.add("rule", state.rule.name);
+        event.add("type", std::string(typeName(state.rule.type)));
+        event.add("active", state.active);
+        event.add("position", static_cast<double>(position));
+        event.add("level", state.level);
+        if (state.active && state.rule.preRoll > 0.) {
+            const size_t frames = msToFrames(state.rule.preRoll);
+            const uint64_t start = position > frames ? position - frames : 0;
+            mSnippet.resize(static_cast<size_t>(position - start) * Format::Channels);
+            if (!mSnippet.empty()) {
+                mHistory.read(start, position - start, &mSnippet[0]);
+                event.add("snippetPosition", static_cast<double>(start));
+                event.setData(&mSnippet[0], mSnippet.size() * sizeof(int32_t), "snippet");
+            }
+        }
+    }
+
+    std::vector<State> mStates;
+    History mHistory;
+    std::vector<int32_t> mSnippet;
+    double mBlockPower;
+    size_t mBlockFrames;
+};
+
+#endif
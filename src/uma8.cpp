@@ -4,8 +4,34 @@
 #include <string>
 #include <libusb.h>
 #include "utils.h"
+#include "audio.h"
+#include "selector.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "fdsink.h"
+#include "delivery.h"
+#include "hid.h"
+#include "cpustats.h"
+#include "metrics.h"
+#include "clock.h"
+#include "rtpsink.h"
+#include "history.h"
+#include "isotuner.h"
+#include "recorder.h"
+#include "occupancy.h"
+#include "convert.h"
 
-struct Input : public Nan::ObjectWrap
+struct Emitter : public Nan::ObjectWrap
+{
+    v8::Local<v8::Object> makeObject();
+    void emit(const std::string& name, v8::Local<v8::Value> value);
+
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Nan::Callback> > > ons;
+};
+
+struct Selector;
+
+struct Input : public Emitter
 {
     Input();
     ~Input();
@@ -13,79 +39,186 @@ struct Input : public Nan::ObjectWrap
     bool isValid() const { return usb != nullptr; }
 
     bool open(uint8_t bus, uint8_t port);
-    v8::Local<v8::Object> makeObject();
+    // the blocking part of opening including setting up the transfers,
+    // safe to run off the js thread
+    bool claim(libusb_device* dev, std::string* error);
+    // sets up delivery, submits the transfers and starts the usb thread,
+    // on the js thread
+    void start();
 
+    // the usb thread, js and the kernel each get their own cache lines.
+    // set up by open() and read only after that
     libusb_context* usb;
     libusb_device_handle* handle;
     uv_thread_t thread;
-    uv_async_t async;
-    Mutex mutex;
-    bool stopped, opened;
-    int pendingCancels;
+    bool opened;
+    uint8_t bus, port;
+    // start with a couple of short transfers so the first audio comes sooner
+    bool prime;
+    // uv_hrtime() when opening started, the device was claimed, the
+    // transfers were set up and when they were submitted
+    uint64_t openStarted, claimed, prepared, submitted;
+
+    // poked by uv_async_send from the usb thread
+    alignas(CacheLineSize) uv_async_t async;
+    // js thread
+    CallTime drainTime;
+    // uv_hrtime() when the first audio went out to js
+    uint64_t firstDelivery;
+    // arrival to delivery of each audio chunk
+    Histogram latencyHistogram;
+
+    // shared between the usb thread and js, protected by mutex
+    alignas(CacheLineSize) Mutex mutex;
+    bool stopped;
     std::string error;
     struct Data {
         uint8_t* data;
         size_t size;
+        // uv_hrtime() when it arrived
+        uint64_t time;
     };
     std::vector<Data> datas;
+    Delivery delivery;
+    // what the audio events carry, converted on the usb thread
+    SampleFormat audioFormat;
+    // when the usb thread last woke js up for audio, 0 once delivered
+    uint64_t signalled;
+    std::vector<Event> events;
+    // when attached to a selector our audio goes there instead of to js
+    Selector* selector;
+
     struct Metadata {
         uint8_t vad, direction;
         uint16_t angle;
     };
-    std::vector<Metadata> metas;
-    std::unordered_map<std::string, std::vector<std::shared_ptr<Nan::Callback> > > ons;
+    // usb thread to js without taking the mutex, drained before the audio.
+    // keeps its head and tail on separate lines
+    SpscQueue<Metadata> metas;
+
+    // the newest metadata for polling, written by the usb thread and read
+    // from js without locking either side
+    struct Latest {
+        Metadata meta;
+        // uv_hrtime() when it came in
+        uint64_t time;
+    };
+    SeqLock<Latest> latest;
+    // off until given a capacity
+    MetadataHistory history;
 
+    // configured from js, run on the usb thread
+    alignas(CacheLineSize) Mutex pipelineMutex;
+    Pipeline pipeline;
+    std::vector<Event> pipelineEvents;
+    std::vector<std::unique_ptr<FdSink> > sinks;
+    std::vector<std::unique_ptr<RtpSink> > rtpSinks;
+    // wall clock time of each chunk, off unless set
+    std::unique_ptr<ClockMapper> clock;
+    // keeps the last seconds for dumping on triggers, off unless set
+    std::unique_ptr<FlightRecorder> recorder;
+    // room usage summaries, off unless set
+    std::unique_ptr<Occupancy> occupancy;
+
+    // usb thread only, the accounting is read by stats()
+    alignas(CacheLineSize) std::atomic<int> activeTransfers;
+    // set once stopped, completions stop resubmitting
+    std::atomic<bool> stopping;
+    // uv_hrtime() of the first completion and of the first audio, 0 until then
+    std::atomic<uint64_t> firstCallback, firstAudio;
+    ThreadCpu usbCpu;
+    CallTime transferTime, irqTime;
+    // vad in the previous metadata update, for the recorder
+    uint8_t lastVad;
+    // usb health, read by the exporter
+    std::atomic<uint64_t> transfers, bytesReceived, transferErrors, incompletePackets, submitErrors, metadataDrops;
+    Histogram transferHistogram;
     struct Iso {
         enum { NumTransfer = 10, NumPackets = 100, PacketSize = 24, EpIsoIn = 0x81 };
+        enum { TransferSize = PacketSize * NumPackets };
+        // when priming, the first transfers are 1ms
+        enum { PrimeTransfers = 2, PrimePackets = 8 };
 
+        // one page aligned block for all transfers, from the kernel when
+        // libusb can map device memory so the data isn't copied
+        uint8_t* buffer;
+        size_t bufferSize;
+        bool deviceMemory;
         struct Transfer {
-            uint8_t buf[PacketSize * NumPackets];
+            uint8_t* buf;
             libusb_transfer* xfr;
+            // held back while the tuner wants fewer in flight
+            bool parked;
         } transfers[NumTransfer];
+        // submitted and not parked, submit() can race the first completions
+        std::atomic<int> inFlight;
     } iso;
+    // the transfer depth and length
+    IsoTuner tuner;
     struct Irq {
         enum { EpIn = 0x82 };
 
-        uint8_t buf[64];
+        alignas(CacheLineSize) uint8_t buf[64];
         libusb_transfer* xfr;
     } irq;
 
-    enum { Vid = 0x2752, Pid = 0x1c, AudioIfaceNum = 2, HidIfaceNum = 4 };
+    enum { Vid = 0x2752, Pid = 0x1c, AudioIfaceNum = 2, HidIfaceNum = 4, MetadataQueueSize = 1024 };
+
+    bool allocateBuffers();
+    bool prepare(std::string* error);
+    void submit();
+    // counted is for transfers coming back from a completion, which are
+    // still counted as in flight. if those fail activeTransfers is left to
+    // the caller, the input may be gone once it drops
+    bool submitIso(Iso::Transfer* transfer, int packets, bool counted = false);
+    void cancel();
+    // the buffers and the transfers
+    void freeBuffers();
 
     static void run(void* arg);
     static void transferCallback(libusb_transfer* xfr);
     static void irqCallback(libusb_transfer* xfr);
 };
 
-Input::Input()
-    : stopped(false), opened(false), pendingCancels(-1)
+// picks the best of a number of arrays and delivers its audio
+struct Selector : public Emitter
 {
-    if (libusb_init(&usb) != 0) {
-        usb = nullptr;
-        return;
-    }
-    async.data = this;
-}
+    Selector();
+    ~Selector();
 
-Input::~Input()
+    void attach(Input* input);
+    void detach(Input* input);
+
+    // called from the usb threads with the input mutex held
+    void process(Input* input, const int32_t* frames, size_t count);
+    void metadata(Input* input, const Input::Metadata& meta);
+
+    uv_async_t async;
+    Mutex mutex;
+    ArraySelector selector;
+    std::unordered_map<Input*, int> sources;
+    std::vector<Input::Data> datas;
+    std::vector<ArraySelector::Switch> switches;
+    std::vector<int32_t> output;
+};
+
+// runs recorded files through the pipeline and reports back to js
+struct BatchJob : public Emitter
 {
-    if (usb) {
-        if (opened) {
-            {
-                MutexLocker locker(&mutex);
-                stopped = true;
-            }
+    BatchJob(const Batch::Options& options);
+    ~BatchJob();
 
-            uv_thread_join(&thread);
-            uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
+    // keeps us alive until the end has been emitted
+    void start();
 
-            libusb_close(handle);
-        }
-        libusb_exit(usb);
-    }
-}
+    uv_async_t async;
+    Batch batch;
+    bool ended;
+    uint64_t frames;
+    size_t failed;
+};
 
-v8::Local<v8::Object> Input::makeObject()
+v8::Local<v8::Object> Emitter::makeObject()
 {
     Nan::EscapableHandleScope scope;
     v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>();
@@ -96,469 +229,2835 @@ v8::Local<v8::Object> Input::makeObject()
     return scope.Escape(obj);
 }
 
-bool Input::open(uint8_t bus, uint8_t port)
+void Emitter::emit(const std::string& name, v8::Local<v8::Value> value)
 {
-    handle = nullptr;
+    const auto& o = ons[name];
+    for (const auto& cb : o) {
+        if (!cb->IsEmpty()) {
+            cb->Call(1, &value);
+        }
+    }
+}
 
-    libusb_device** list;
-    ssize_t devices = libusb_get_device_list(usb, &list);
-    if (devices < 0) {
-        // error
-        Nan::ThrowError("No devices");
+static v8::Local<v8::Value> eventValue(const Event& event)
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Value> buffer;
+    if (event.data) {
+        // the buffer takes ownership of the data
+        buffer = Nan::NewBuffer(reinterpret_cast<char*>(event.data), event.size).ToLocalChecked();
+        if (event.properties.empty())
+            return scope.Escape(buffer);
+    }
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    for (const Event::Property& prop : event.properties) {
+        v8::Local<v8::Value> value;
+        switch (prop.type) {
+        case Event::Property::Number:
+            value = Nan::New<v8::Number>(prop.number);
+            break;
+        case Event::Property::Boolean:
+            value = Nan::New<v8::Boolean>(prop.number != 0.);
+            break;
+        case Event::Property::String:
+            value = Nan::New<v8::String>(prop.string).ToLocalChecked();
+            break;
+        case Event::Property::Numbers: {
+            v8::Local<v8::Array> array = Nan::New<v8::Array>();
+            for (size_t i = 0; i < prop.numbers.size(); ++i)
+                array->Set(i, Nan::New<v8::Number>(prop.numbers[i]));
+            value = array;
+            break; }
+        case Event::Property::Booleans: {
+            v8::Local<v8::Array> array = Nan::New<v8::Array>();
+            for (size_t i = 0; i < prop.numbers.size(); ++i)
+                array->Set(i, Nan::New<v8::Boolean>(prop.numbers[i] != 0.));
+            value = array;
+            break; }
+        }
+        obj->Set(Nan::New<v8::String>(prop.name).ToLocalChecked(), value);
+    }
+    if (event.data)
+        obj->Set(Nan::New<v8::String>(event.dataName).ToLocalChecked(), buffer);
+    return scope.Escape(obj);
+}
+
+static double numberOption(v8::Local<v8::Object> options, const char* key, double def)
+{
+    auto keyValue = Nan::New<v8::String>(key).ToLocalChecked();
+    if (!options->Has(keyValue))
+        return def;
+    auto value = options->Get(keyValue);
+    if (!value->IsNumber())
+        return def;
+    return v8::Local<v8::Number>::Cast(value)->Value();
+}
+
+static bool booleanOption(v8::Local<v8::Object> options, const char* key, bool def)
+{
+    auto keyValue = Nan::New<v8::String>(key).ToLocalChecked();
+    if (!options->Has(keyValue))
+        return def;
+    auto value = options->Get(keyValue);
+    if (!value->IsBoolean())
+        return def;
+    return v8::Local<v8::Boolean>::Cast(value)->Value();
+}
+
+static std::string stringOption(v8::Local<v8::Object> options, const char* key, const std::string& def)
+{
+    auto keyValue = Nan::New<v8::String>(key).ToLocalChecked();
+    if (!options->Has(keyValue))
+        return def;
+    auto value = options->Get(keyValue);
+    if (!value->IsString())
+        return def;
+    return *Nan::Utf8String(value);
+}
+
+// option parsing shared by the device setters and batch jobs, these throw
+// and return false on bad input
+static bool sampleFormatOptions(v8::Local<v8::Object> options, SampleFormat* format)
+{
+    const std::string type = stringOption(options, "format", SampleFormat::typeName(format->type));
+    if (!SampleFormat::parse(type, &format->type)) {
+        Nan::ThrowError("Sample format needs to be s32le, f32le, f16le, s16le or s8");
         return false;
     }
-    for (ssize_t i = 0; i < devices; ++i) {
-        libusb_device* dev = list[i];
-        libusb_device_descriptor desc;
-        int ret = libusb_get_device_descriptor(dev, &desc);
-        if (ret != 0) {
-            // error
-            continue;
+    format->scale = static_cast<float>(numberOption(options, "scale", format->scale));
+    format->zeroPoint = static_cast<int>(numberOption(options, "zeroPoint", format->zeroPoint));
+    if (!SampleFormat::validate(*format)) {
+        Nan::ThrowError("Invalid sample format options");
+        return false;
+    }
+    return true;
+}
+
+static bool previewOptions(v8::Local<v8::Object> options, Preview::Options* opts)
+{
+    opts->rate = numberOption(options, "rate", opts->rate);
+    // anything but a channel number means mix
+    opts->channel = numberOption(options, "channel", opts->channel);
+    if (!sampleFormatOptions(options, &opts->format))
+        return false;
+    if (!Preview::validate(*opts)) {
+        Nan::ThrowError("Invalid preview options");
+        return false;
+    }
+    return true;
+}
+
+static bool triggerRules(v8::Local<v8::Array> array, std::vector<Triggers::Rule>* rules)
+{
+    for (uint32_t i = 0; i < array->Length(); ++i) {
+        auto value = array->Get(i);
+        if (!value->IsObject()) {
+            Nan::ThrowError("Trigger rule needs to be an object");
+            return false;
         }
-        if (desc.idVendor == Input::Vid && desc.idProduct == Input::Pid) {
-            const uint8_t b = libusb_get_bus_number(dev);
-            const uint8_t p = libusb_get_port_number(dev);
-            if (b == bus && p == port) {
-                // got it
-                ret = libusb_open(dev, &handle);
-                if (ret != 0) {
-                    // error
-                    libusb_free_device_list(list, 1);
-                    Nan::ThrowError("Can't open");
-                    return false;
-                }
-                break;
-            }
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(value);
+        const std::string type = stringOption(options, "type", std::string());
+        Triggers::Rule rule;
+        if (type == "threshold") {
+            rule = Triggers::rule(Triggers::Rule::Threshold);
+        } else if (type == "transient") {
+            rule = Triggers::rule(Triggers::Rule::Transient);
+        } else if (type == "sustained") {
+            rule = Triggers::rule(Triggers::Rule::Sustained);
+        } else {
+            Nan::ThrowError("Trigger type needs to be threshold, transient or sustained");
+            return false;
+        }
+        // the release defaults to the same distance below the level
+        const double hysteresis = rule.level - rule.release;
+        rule.name = stringOption(options, "name", rule.name);
+        rule.level = numberOption(options, "level", rule.level);
+        rule.release = numberOption(options, "release", rule.level - hysteresis);
+        rule.ratio = numberOption(options, "ratio", rule.ratio);
+        rule.window = numberOption(options, "window", rule.window);
+        rule.background = numberOption(options, "background", rule.background);
+        rule.duration = numberOption(options, "duration", rule.duration);
+        rule.holdoff = numberOption(options, "holdoff", rule.holdoff);
+        rule.preRoll = numberOption(options, "preRoll", rule.preRoll);
+        if (!Triggers::validate(rule)) {
+            Nan::ThrowError("Invalid trigger rule");
+            return false;
         }
+        rules->push_back(rule);
     }
-    libusb_free_device_list(list, 1);
-    if (!handle) {
-        Nan::ThrowError("No handle");
+    return true;
+}
+
+static bool healthOptions(v8::Local<v8::Object> options, Health::Options* opts)
+{
+    opts->interval = numberOption(options, "interval", opts->interval);
+    opts->silence = numberOption(options, "silence", opts->silence);
+    opts->stuckRun = numberOption(options, "stuckRun", opts->stuckRun);
+    opts->clipLevel = numberOption(options, "clipLevel", opts->clipLevel);
+    opts->humRatio = numberOption(options, "humRatio", opts->humRatio);
+    opts->lowCorrelation = numberOption(options, "lowCorrelation", opts->lowCorrelation);
+    if (!Health::validate(*opts)) {
+        Nan::ThrowError("Invalid health options");
         return false;
     }
+    return true;
+}
 
-    int ret;
-    int ifaces[] = { AudioIfaceNum, HidIfaceNum, -1 };
-    for (int i = 0;; ++i) {
-        const int iface = ifaces[i];
-        if (iface == -1)
-            break;
+static bool loudnessOptions(v8::Local<v8::Object> options, Loudness::Options* opts)
+{
+    opts->interval = numberOption(options, "interval", opts->interval);
+    if (!Loudness::validate(*opts)) {
+        Nan::ThrowError("Invalid loudness options");
+        return false;
+    }
+    return true;
+}
 
-        ret = libusb_kernel_driver_active(handle, iface);
-        if (ret == 1) {
-            ret = libusb_detach_kernel_driver(handle, iface);
-            if (ret < 0) {
-                // bad
-                libusb_close(handle);
-                Nan::ThrowError("Can't detach kernel driver");
+// { gain, highpass } of a condition graph node, dB and Hz
+static bool conditionOptions(v8::Local<v8::Object> options, Conditioner::Options* opts)
+{
+    opts->gain = numberOption(options, "gain", opts->gain);
+    opts->highpass = numberOption(options, "highpass", opts->highpass);
+    if (!Conditioner::validate(*opts)) {
+        Nan::ThrowError("Invalid condition options");
+        return false;
+    }
+    return true;
+}
+
+static bool graphNodes(v8::Local<v8::Array> array, std::vector<NodeSpec>* nodes)
+{
+    for (uint32_t i = 0; i < array->Length(); ++i) {
+        auto value = array->Get(i);
+        if (!value->IsObject()) {
+            Nan::ThrowError("Graph node needs to be an object");
+            return false;
+        }
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(value);
+        NodeSpec node;
+        node.id = stringOption(options, "id", std::string());
+        node.input = stringOption(options, "input", node.input);
+        node.event = stringOption(options, "event", node.event);
+        const std::string type = stringOption(options, "type", std::string());
+        bool ok = true;
+        if (type == "condition") {
+            node.type = NodeSpec::Condition;
+            ok = conditionOptions(options, &node.condition);
+        } else if (type == "preview") {
+            node.type = NodeSpec::Preview;
+            ok = previewOptions(options, &node.preview);
+        } else if (type == "triggers") {
+            node.type = NodeSpec::Triggers;
+            auto rules = options->Get(Nan::New<v8::String>("rules").ToLocalChecked());
+            if (!rules->IsArray()) {
+                Nan::ThrowError("Triggers node needs an array of rules");
                 return false;
             }
-        }
-        ret = libusb_claim_interface(handle, iface);
-        if (ret < 0) {
-            // also bad
-            libusb_close(handle);
-            Nan::ThrowError("Can't claim interface");
+            ok = triggerRules(v8::Local<v8::Array>::Cast(rules), &node.triggers);
+        } else if (type == "health") {
+            node.type = NodeSpec::Health;
+            ok = healthOptions(options, &node.health);
+        } else if (type == "loudness") {
+            node.type = NodeSpec::Loudness;
+            ok = loudnessOptions(options, &node.loudness);
+        } else {
+            Nan::ThrowError("Graph node type needs to be condition, preview, triggers, health or loudness");
             return false;
         }
+        if (!ok)
+            return false;
+        nodes->push_back(node);
     }
-
-    ret = libusb_set_interface_alt_setting(handle, AudioIfaceNum, 1);
-    if (ret < 0) {
-        // yep, bad
-        Nan::ThrowError("Can't set alt setting");
-        libusb_close(handle);
+    // check the shape now so batch jobs don't find out per file
+    Graph graph;
+    std::string error;
+    if (!graph.build(*nodes, nullptr, &error)) {
+        Nan::ThrowError(error.c_str());
         return false;
     }
+    return true;
+}
 
-    opened = true;
-    uv_async_init(uv_default_loop(), &async, [](uv_async_t* async) {
-            Input* input = static_cast<Input*>(async->data);
-            MutexLocker locker(&input->mutex);
-            if (!input->datas.empty()) {
-                const std::string name = "audio";
-
-                auto it = input->datas.cbegin();
-                const auto end = input->datas.cend();
-                while (it != end) {
-                    const Input::Data& data = *it;
+// { preview, triggers, health, loudness }, the same options as the setters,
+// or { graph } with the nodes instead
+static bool pipelineSettings(v8::Local<v8::Object> options, PipelineSettings* settings)
+{
+    auto previewKey = Nan::New<v8::String>("preview").ToLocalChecked();
+    auto triggersKey = Nan::New<v8::String>("triggers").ToLocalChecked();
+    auto healthKey = Nan::New<v8::String>("health").ToLocalChecked();
+    auto loudnessKey = Nan::New<v8::String>("loudness").ToLocalChecked();
+    auto graphKey = Nan::New<v8::String>("graph").ToLocalChecked();
+    if (options->Has(graphKey) && options->Get(graphKey)->IsArray())
+        return graphNodes(v8::Local<v8::Array>::Cast(options->Get(graphKey)), &settings->graph);
+    if (options->Has(previewKey) && options->Get(previewKey)->IsObject()) {
+        settings->preview = true;
+        if (!previewOptions(v8::Local<v8::Object>::Cast(options->Get(previewKey)), &settings->previewOptions))
+            return false;
+    }
+    if (options->Has(triggersKey) && options->Get(triggersKey)->IsArray()) {
+        if (!triggerRules(v8::Local<v8::Array>::Cast(options->Get(triggersKey)), &settings->triggers))
+            return false;
+    }
+    if (options->Has(healthKey) && options->Get(healthKey)->IsObject()) {
+        settings->health = true;
+        if (!healthOptions(v8::Local<v8::Object>::Cast(options->Get(healthKey)), &settings->healthOptions))
+            return false;
+    }
+    if (options->Has(loudnessKey) && options->Get(loudnessKey)->IsObject()) {
+        settings->loudness = true;
+        if (!loudnessOptions(v8::Local<v8::Object>::Cast(options->Get(loudnessKey)), &settings->loudnessOptions))
+            return false;
+    }
+    return true;
+}
 
-                    // make a buffer and send up to js
-                    Nan::HandleScope scope;
-                    v8::Local<v8::Value> value = Nan::NewBuffer(reinterpret_cast<char*>(data.data), data.size).ToLocalChecked();
+// open devices, for the metrics exporter
+static Mutex inputsMutex;
+static std::unordered_set<Input*> inputs;
+static std::unique_ptr<TextfileExporter> exporter;
 
-                    const auto& o = input->ons[name];
-                    for (const auto& cb : o) {
-                        if (!cb->IsEmpty()) {
-                            cb->Call(1, &value);
-                        }
-                    }
+Input::Input()
+    : opened(false), bus(0), port(0),
+      prime(false), openStarted(0), claimed(0), prepared(0), submitted(0), firstDelivery(0), latencyHistogram({ 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1., 2. }),
+      stopped(false), signalled(0), selector(nullptr), metas(MetadataQueueSize), activeTransfers(0), stopping(false), firstCallback(0), firstAudio(0),
+      lastVad(0), transfers(0), bytesReceived(0), transferErrors(0), incompletePackets(0), submitErrors(0), metadataDrops(0),
+      transferHistogram({ 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025 }),
+      tuner(Iso::NumTransfer, Iso::NumPackets)
+{
+    iso.buffer = nullptr;
+    iso.bufferSize = 0;
+    iso.deviceMemory = false;
+    for (int i = 0; i < Iso::NumTransfer; ++i) {
+        iso.transfers[i].xfr = nullptr;
+        iso.transfers[i].parked = true;
+    }
+    iso.inFlight = 0;
+    irq.xfr = nullptr;
+    async.data = this;
+    // a context of its own, so the completions and everything they feed run
+    // on this device's usb thread
+    if (libusb_init(&usb) != 0)
+        usb = nullptr;
+}
 
-                    ++it;
-                }
-                input->datas.clear();
+Input::~Input()
+{
+    if (opened) {
+        MutexLocker locker(&inputsMutex);
+        inputs.erase(this);
+    }
+    if (selector)
+        selector->detach(this);
+    if (usb) {
+        if (opened) {
+            {
+                MutexLocker locker(&mutex);
+                stopped = true;
             }
-            if (!input->metas.empty()) {
-                const std::string name = "metadata";
 
-                auto it = input->metas.cbegin();
-                const auto end = input->metas.cend();
-                while (it != end) {
-                    // send this up to JS
-                    const Input::Metadata& meta = *it;
-
-                    Nan::HandleScope scope;
-                    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
-                    obj->Set(Nan::New<v8::String>("vad").ToLocalChecked(), Nan::New<v8::Boolean>(meta.vad == 1));
-                    obj->Set(Nan::New<v8::String>("angle").ToLocalChecked(), Nan::New<v8::Uint32>(meta.angle));
-                    obj->Set(Nan::New<v8::String>("direction").ToLocalChecked(), Nan::New<v8::Uint32>(meta.direction));
-                    v8::Local<v8::Value> value = obj;
+            uv_thread_join(&thread);
+            // its writer thread reports through async
+            recorder.reset();
+            uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
 
-                    const auto& o = input->ons[name];
-                    for (const auto& cb : o) {
-                        if (!cb->IsEmpty()) {
-                            cb->Call(1, &value);
-                        }
-                    }
+            freeBuffers();
+            libusb_close(handle);
+        }
+        libusb_exit(usb);
+    }
+    for (const Event& event : events) {
+        free(event.data);
+    }
+}
 
-                    ++it;
-                }
-                input->metas.clear();
+Selector::Selector()
+{
+    async.data = this;
+    uv_async_init(uv_default_loop(), &async, [](uv_async_t* async) {
+            Selector* selector = static_cast<Selector*>(async->data);
+            // like the inputs, nothing is held while js runs
+            std::vector<Input::Data> datas;
+            std::vector<ArraySelector::Switch> switches;
+            {
+                MutexLocker locker(&selector->mutex);
+                datas.swap(selector->datas);
+                switches.swap(selector->switches);
+            }
+            for (const Input::Data& data : datas) {
+                Nan::HandleScope scope;
+                v8::Local<v8::Value> value = Nan::NewBuffer(reinterpret_cast<char*>(data.data), data.size).ToLocalChecked();
+                selector->emit("audio", value);
             }
-            if (!input->error.empty()) {
+            for (const ArraySelector::Switch& sw : switches) {
                 Nan::HandleScope scope;
-                Nan::ThrowError(Nan::New<v8::String>(input->error).ToLocalChecked());
-                input->error.clear();
+                v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+                obj->Set(Nan::New<v8::String>("from").ToLocalChecked(), Nan::New<v8::Int32>(sw.from));
+                obj->Set(Nan::New<v8::String>("to").ToLocalChecked(), Nan::New<v8::Int32>(sw.to));
+                obj->Set(Nan::New<v8::String>("fromScore").ToLocalChecked(), Nan::New<v8::Number>(sw.fromScore));
+                obj->Set(Nan::New<v8::String>("toScore").ToLocalChecked(), Nan::New<v8::Number>(sw.toScore));
+                selector->emit("switch", obj);
             }
         });
-    uv_thread_create(&thread, Input::run, this);
-    return true;
 }
 
-void Input::transferCallback(libusb_transfer* xfr)
+Selector::~Selector()
 {
-    // this appears to return s32l 24khz 2ch audio even though the device spec says 24bit 16khz 2ch
-
-    Input* input = static_cast<Input*>(xfr->user_data);
-    if (xfr->status == LIBUSB_TRANSFER_CANCELLED) {
-        --input->pendingCancels;
-        libusb_free_transfer(xfr);
-        return;
+    // once the inputs have let go of us no usb thread can get in here
+    for (const auto& source : sources) {
+        MutexLocker locker(&source.first->mutex);
+        source.first->selector = nullptr;
     }
-
-    const size_t size = Iso::PacketSize * xfr->num_iso_packets;
-    uint8_t* data = static_cast<uint8_t*>(malloc(size));
-
-    bool error = false;
-    uint8_t* cur = data;
-    uint8_t* end = data + size;
-    size_t bytes = 0;
-    for (int i = 0; i < xfr->num_iso_packets; ++i) {
-        libusb_iso_packet_descriptor* pack = &xfr->iso_packet_desc[i];
-        if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
-            // bad?
-            MutexLocker locker(&input->mutex);
-            input->error = "incomplete iso xfr";
-            uv_async_send(&input->async);
-            continue;
-        }
-        if (cur + Iso::PacketSize > end) {
-            // this would be bad
-            MutexLocker locker(&input->mutex);
-            input->error = "overflow in iso xfr";
-            uv_async_send(&input->async);
-            error = true;
-            break;
-        }
-        const uint8_t* isodata = libusb_get_iso_packet_buffer_simple(xfr, i);
-        memcpy(cur, isodata, Iso::PacketSize);
-        cur += Iso::PacketSize;
-        bytes += Iso::PacketSize;
+    for (const Input::Data& data : datas) {
+        free(data.data);
     }
+    uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
+}
 
-    if (error) {
-        free(data);
-    } else {
-        // tell our async thingy
-        MutexLocker locker(&input->mutex);
-        input->datas.push_back(Input::Data{ data, bytes });
-        uv_async_send(&input->async);
-    }
+void Selector::attach(Input* input)
+{
+    if (input->selector == this)
+        return;
+    if (input->selector)
+        input->selector->detach(input);
 
-    // we're done, submit the transfer back to libusb
-    libusb_submit_transfer(xfr);
+    // same lock order as the usb thread, input first
+    MutexLocker inputLocker(&input->mutex);
+    MutexLocker locker(&mutex);
+    sources[input] = selector.add();
+    input->selector = this;
 }
 
-void Input::irqCallback(libusb_transfer* xfr)
+void Selector::detach(Input* input)
 {
-    if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
-        if (xfr->status == LIBUSB_TRANSFER_CANCELLED) {
-            Input* input = static_cast<Input*>(xfr->user_data);
-            --input->pendingCancels;
-            libusb_free_transfer(xfr);
+    MutexLocker inputLocker(&input->mutex);
+    MutexLocker locker(&mutex);
+    auto it = sources.find(input);
+    if (it != sources.end()) {
+        selector.remove(it->second);
+        sources.erase(it);
+    }
+    input->selector = nullptr;
+}
+
+void Selector::process(Input* input, const int32_t* frames, size_t count)
+{
+    MutexLocker locker(&mutex);
+    auto it = sources.find(input);
+    if (it == sources.end())
+        return;
+    ArraySelector::Switch sw;
+    sw.from = -1;
+    if (!selector.process(it->second, frames, count, uv_hrtime(), output, &sw))
+        return;
+    if (sw.from != -1)
+        switches.push_back(sw);
+    const size_t size = output.size() * sizeof(int32_t);
+    uint8_t* data = static_cast<uint8_t*>(malloc(size));
+    memcpy(data, &output[0], size);
+    datas.push_back(Input::Data{ data, size, uv_hrtime() });
+    uv_async_send(&async);
+}
+
+void Selector::metadata(Input* input, const Input::Metadata& meta)
+{
+    MutexLocker locker(&mutex);
+    auto it = sources.find(input);
+    if (it != sources.end())
+        selector.metadata(it->second, meta.vad == 1, meta.angle);
+}
+
+// a typed array over a copy of the values. made through a node buffer,
+// which works the same with every v8 version
+template<typename Array, typename T>
+static v8::Local<Array> typedArray(const T* values, size_t count)
+{
+    v8::Local<v8::Object> buffer = Nan::CopyBuffer(reinterpret_cast<const char*>(values), count * sizeof(T)).ToLocalChecked();
+    v8::Local<v8::ArrayBufferView> view = buffer.As<v8::ArrayBufferView>();
+    return Array::New(view->Buffer(), view->ByteOffset(), count);
+}
+
+// ms on the process.hrtime() clock to uv_hrtime() ns
+static uint64_t hrtimeOption(v8::Local<v8::Object> options, const char* key, uint64_t def)
+{
+    const double ms = numberOption(options, key, def / 1e6);
+    return ms > 0 ? static_cast<uint64_t>(ms * 1e6) : 0;
+}
+
+static v8::Local<v8::Object> threadUsage(const ThreadCpu::Usage& usage)
+{
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("cpu").ToLocalChecked(), Nan::New<v8::Number>(usage.cpu));
+    obj->Set(Nan::New<v8::String>("voluntarySwitches").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(usage.voluntary)));
+    obj->Set(Nan::New<v8::String>("involuntarySwitches").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(usage.involuntary)));
+    return obj;
+}
+
+static v8::Local<v8::Object> callTotals(const CallTime::Totals& totals)
+{
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("calls").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(totals.calls)));
+    obj->Set(Nan::New<v8::String>("total").ToLocalChecked(), Nan::New<v8::Number>(totals.total));
+    obj->Set(Nan::New<v8::String>("max").ToLocalChecked(), Nan::New<v8::Number>(totals.max));
+    obj->Set(Nan::New<v8::String>("average").ToLocalChecked(), Nan::New<v8::Number>(totals.calls ? totals.total / totals.calls : 0.));
+    return obj;
+}
+
+// runs on the exporter thread
+static void collectMetrics(MetricsText& text)
+{
+    struct Device {
+        std::string labels;
+        uint64_t transfers, bytes, transferErrors, incompletePackets, submitErrors, metadataDrops;
+        uint64_t frames, sinkOverruns, sinkDroppedBytes, sinkFill, rtpPackets, rtpSendErrors, rtpOverruns;
+        size_t queuedChunks, queuedMetadata;
+        double cpu;
+        Histogram::Snapshot latency, transfer;
+    };
+    std::vector<Device> devices;
+    {
+        MutexLocker locker(&inputsMutex);
+        for (Input* input : inputs) {
+            Device d;
+            d.labels = MetricsText::label("device", std::to_string(input->bus) + "-" + std::to_string(input->port));
+            d.transfers = input->transfers;
+            d.bytes = input->bytesReceived;
+            d.transferErrors = input->transferErrors;
+            d.incompletePackets = input->incompletePackets;
+            d.submitErrors = input->submitErrors;
+            d.metadataDrops = input->metadataDrops;
+            d.queuedMetadata = input->metas.size();
+            d.cpu = input->usbCpu.usage().cpu / 1000.;
+            d.latency = input->latencyHistogram.snapshot();
+            d.transfer = input->transferHistogram.snapshot();
+            d.sinkOverruns = d.sinkDroppedBytes = d.sinkFill = 0;
+            d.rtpPackets = d.rtpSendErrors = d.rtpOverruns = 0;
+            {
+                MutexLocker pipelineLocker(&input->pipelineMutex);
+                d.frames = input->pipeline.position();
+                for (const auto& sink : input->sinks) {
+                    const FdSink::Stats st = sink->stats();
+                    d.sinkOverruns += st.overruns;
+                    d.sinkDroppedBytes += st.droppedBytes;
+                    d.sinkFill += st.fill;
+                }
+                for (const auto& sink : input->rtpSinks) {
+                    const RtpSink::Stats st = sink->stats();
+                    d.rtpPackets += st.packets;
+                    d.rtpSendErrors += st.sendErrors;
+                    d.rtpOverruns += st.overruns;
+                }
+            }
+            {
+                MutexLocker inputLocker(&input->mutex);
+                d.queuedChunks = input->datas.size();
+            }
+            devices.push_back(d);
+        }
+    }
+
+    struct Counter {
+        const char* name;
+        const char* help;
+        uint64_t Device::*value;
+    };
+    static const Counter counters[] = {
+        { "uma8_transfers", "Iso transfers completed by the device", &Device::transfers },
+        { "uma8_received_bytes", "Audio bytes received from the device", &Device::bytes },
+        { "uma8_frames", "Audio frames run through the pipeline", &Device::frames },
+        { "uma8_transfer_errors", "Iso transfers that completed with an error status", &Device::transferErrors },
+        { "uma8_incomplete_packets", "Iso packets that did not complete", &Device::incompletePackets },
+        { "uma8_submit_errors", "Transfers that could not be resubmitted", &Device::submitErrors },
+        { "uma8_metadata_drops", "Metadata updates dropped because js fell behind", &Device::metadataDrops },
+        { "uma8_sink_overruns", "Chunks dropped by pipes whose reader fell behind", &Device::sinkOverruns },
+        { "uma8_sink_dropped_bytes", "Bytes dropped by pipes whose reader fell behind", &Device::sinkDroppedBytes },
+        { "uma8_rtp_packets", "RTP packets sent", &Device::rtpPackets },
+        { "uma8_rtp_send_errors", "RTP packets that could not be sent", &Device::rtpSendErrors },
+        { "uma8_rtp_overruns", "RTP packets dropped because the sender fell behind", &Device::rtpOverruns }
+    };
+    for (const Counter& counter : counters) {
+        text.family(counter.name, "counter", counter.help);
+        for (const Device& d : devices)
+            text.sample(counter.name, d.labels, static_cast<double>(d.*counter.value));
+    }
+    text.family("uma8_usb_thread_cpu_seconds", "counter", "CPU time used by the usb thread");
+    for (const Device& d : devices)
+        text.sample("uma8_usb_thread_cpu_seconds", d.labels, d.cpu);
+
+    text.family("uma8_queued_chunks", "gauge", "Audio chunks waiting to be delivered to js");
+    for (const Device& d : devices)
+        text.sample("uma8_queued_chunks", d.labels, static_cast<double>(d.queuedChunks));
+    text.family("uma8_queued_metadata", "gauge", "Metadata updates waiting to be delivered to js");
+    for (const Device& d : devices)
+        text.sample("uma8_queued_metadata", d.labels, static_cast<double>(d.queuedMetadata));
+    text.family("uma8_sink_fill_bytes", "gauge", "Bytes buffered for pipes");
+    for (const Device& d : devices)
+        text.sample("uma8_sink_fill_bytes", d.labels, static_cast<double>(d.sinkFill));
+
+    text.family("uma8_delivery_latency_seconds", "histogram", "Time from an audio chunk arriving to it being delivered to js");
+    for (const Device& d : devices)
+        text.histogram("uma8_delivery_latency_seconds", d.labels, d.latency);
+    text.family("uma8_transfer_callback_seconds", "histogram", "Time spent handling an iso transfer on the usb thread");
+    for (const Device& d : devices)
+        text.histogram("uma8_transfer_callback_seconds", d.labels, d.transfer);
+}
+
+static bool reportType(const std::string& name, HidReports::Type* type)
+{
+    if (name == "feature") {
+        *type = HidReports::Feature;
+    } else if (name == "output") {
+        *type = HidReports::Output;
+    } else {
+        Nan::ThrowError("Report type needs to be feature or output");
+        return false;
+    }
+    return true;
+}
+
+static bool reportList(v8::Local<v8::Array> array, std::vector<HidReports::Report>* reports)
+{
+    for (uint32_t i = 0; i < array->Length(); ++i) {
+        auto value = array->Get(i);
+        if (!value->IsObject()) {
+            Nan::ThrowError("Report needs to be an object");
+            return false;
+        }
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(value);
+        HidReports::Report report;
+        if (!reportType(stringOption(options, "type", "feature"), &report.type))
+            return false;
+        const double id = numberOption(options, "id", 0);
+        if (id < 0 || id > 255) {
+            Nan::ThrowError("Report id needs to be between 0 and 255");
+            return false;
+        }
+        report.id = static_cast<uint8_t>(id);
+        auto data = options->Get(Nan::New<v8::String>("data").ToLocalChecked());
+        if (!node::Buffer::HasInstance(data)) {
+            Nan::ThrowError("Report data needs to be a buffer");
+            return false;
+        }
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(node::Buffer::Data(data));
+        report.data.assign(bytes, bytes + node::Buffer::Length(data));
+        reports->push_back(report);
+    }
+    return true;
+}
+
+static v8::Local<v8::Object> batchProgress(const Batch& batch, const Batch::Progress& progress)
+{
+    Nan::EscapableHandleScope scope;
+    const double seconds = static_cast<double>(progress.frames) / Format::SampleRate;
+    const double elapsed = progress.elapsed / 1e9;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("index").ToLocalChecked(), Nan::New<v8::Uint32>(static_cast<uint32_t>(progress.index)));
+    obj->Set(Nan::New<v8::String>("file").ToLocalChecked(), Nan::New<v8::String>(batch.options().files[progress.index]).ToLocalChecked());
+    obj->Set(Nan::New<v8::String>("frames").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(progress.frames)));
+    obj->Set(Nan::New<v8::String>("seconds").ToLocalChecked(), Nan::New<v8::Number>(seconds));
+    obj->Set(Nan::New<v8::String>("elapsed").ToLocalChecked(), Nan::New<v8::Number>(elapsed));
+    // how many times faster than real time
+    obj->Set(Nan::New<v8::String>("speed").ToLocalChecked(), Nan::New<v8::Number>(elapsed > 0. ? seconds / elapsed : 0.));
+    if (!progress.error.empty())
+        obj->Set(Nan::New<v8::String>("error").ToLocalChecked(), Nan::New<v8::String>(progress.error).ToLocalChecked());
+    return scope.Escape(obj);
+}
+
+BatchJob::BatchJob(const Batch::Options& options)
+    : batch(options, [this]() { uv_async_send(&async); }), ended(false), frames(0), failed(0)
+{
+    async.data = this;
+    uv_async_init(uv_default_loop(), &async, [](uv_async_t* async) {
+            BatchJob* job = static_cast<BatchJob*>(async->data);
+            // check before taking so no progress is left behind once finished
+            const bool finished = job->batch.finished();
+            for (const Batch::Progress& progress : job->batch.take()) {
+                Nan::HandleScope scope;
+                if (progress.done) {
+                    job->frames += progress.frames;
+                    if (!progress.error.empty())
+                        ++job->failed;
+                }
+                job->emit(progress.done ? "file" : "progress", batchProgress(job->batch, progress));
+            }
+            if (finished && !job->ended) {
+                job->ended = true;
+                job->batch.join();
+
+                Nan::HandleScope scope;
+                const double seconds = static_cast<double>(job->frames) / Format::SampleRate;
+                const double elapsed = (uv_hrtime() - job->batch.started()) / 1e9;
+                v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+                obj->Set(Nan::New<v8::String>("files").ToLocalChecked(), Nan::New<v8::Uint32>(static_cast<uint32_t>(job->batch.options().files.size())));
+                obj->Set(Nan::New<v8::String>("failed").ToLocalChecked(), Nan::New<v8::Uint32>(static_cast<uint32_t>(job->failed)));
+                obj->Set(Nan::New<v8::String>("frames").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(job->frames)));
+                obj->Set(Nan::New<v8::String>("seconds").ToLocalChecked(), Nan::New<v8::Number>(seconds));
+                obj->Set(Nan::New<v8::String>("elapsed").ToLocalChecked(), Nan::New<v8::Number>(elapsed));
+                obj->Set(Nan::New<v8::String>("speed").ToLocalChecked(), Nan::New<v8::Number>(elapsed > 0. ? seconds / elapsed : 0.));
+                job->emit("end", obj);
+                // js may let go of us now
+                job->Unref();
+            }
+        });
+}
+
+void BatchJob::start()
+{
+    Ref();
+    batch.start();
+}
+
+BatchJob::~BatchJob()
+{
+    batch.cancel();
+    batch.join();
+    uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
+}
+
+// the uma8s on the bus, referenced until the caller unrefs them
+static bool scanDevices(libusb_context* usb, std::vector<libusb_device*>* devices)
+{
+    libusb_device** list;
+    ssize_t count = libusb_get_device_list(usb, &list);
+    if (count < 0)
+        return false;
+    for (ssize_t i = 0; i < count; ++i) {
+        libusb_device* dev = list[i];
+        libusb_device_descriptor desc;
+        if (libusb_get_device_descriptor(dev, &desc) != 0) {
+            // error
+            continue;
+        }
+        if (desc.idVendor == Input::Vid && desc.idProduct == Input::Pid)
+            devices->push_back(libusb_ref_device(dev));
+    }
+    libusb_free_device_list(list, 1);
+    return true;
+}
+
+// the uma8 at bus and port, or at bus and address unless that's 0. port
+// numbers can repeat on a bus behind hubs, addresses can't. referenced, null
+// if it isn't there
+static libusb_device* findDevice(libusb_context* usb, uint8_t bus, uint8_t port, uint8_t address)
+{
+    std::vector<libusb_device*> devices;
+    if (!scanDevices(usb, &devices))
+        return nullptr;
+    libusb_device* found = nullptr;
+    for (libusb_device* dev : devices) {
+        if (!found && libusb_get_bus_number(dev) == bus
+            && (address ? libusb_get_device_address(dev) == address : libusb_get_port_number(dev) == port)) {
+            // got it
+            found = dev;
+        } else {
+            libusb_unref_device(dev);
+        }
+    }
+    return found;
+}
+
+bool Input::open(uint8_t bus, uint8_t port)
+{
+    openStarted = uv_hrtime();
+    libusb_device* found = findDevice(usb, bus, port, 0);
+    if (!found) {
+        Nan::ThrowError("No handle");
+        return false;
+    }
+    std::string error;
+    const bool ok = claim(found, &error);
+    libusb_unref_device(found);
+    if (!ok) {
+        Nan::ThrowError(error.c_str());
+        return false;
+    }
+    start();
+    return true;
+}
+
+bool Input::claim(libusb_device* dev, std::string* error)
+{
+    handle = nullptr;
+    int ret = libusb_open(dev, &handle);
+    if (ret != 0) {
+        // error
+        handle = nullptr;
+        *error = "Can't open";
+        return false;
+    }
+
+    int ifaces[] = { AudioIfaceNum, HidIfaceNum, -1 };
+    for (int i = 0;; ++i) {
+        const int iface = ifaces[i];
+        if (iface == -1)
+            break;
+
+        ret = libusb_kernel_driver_active(handle, iface);
+        if (ret == 1) {
+            ret = libusb_detach_kernel_driver(handle, iface);
+            if (ret < 0) {
+                // bad
+                libusb_close(handle);
+                handle = nullptr;
+                *error = "Can't detach kernel driver";
+                return false;
+            }
+        }
+        ret = libusb_claim_interface(handle, iface);
+        if (ret < 0) {
+            // also bad
+            libusb_close(handle);
+            handle = nullptr;
+            *error = "Can't claim interface";
+            return false;
+        }
+    }
+
+    ret = libusb_set_interface_alt_setting(handle, AudioIfaceNum, 1);
+    if (ret < 0) {
+        // yep, bad
+        libusb_close(handle);
+        handle = nullptr;
+        *error = "Can't set alt setting";
+        return false;
+    }
+
+    bus = libusb_get_bus_number(dev);
+    port = libusb_get_port_number(dev);
+    claimed = uv_hrtime();
+    if (!prepare(error)) {
+        freeBuffers();
+        libusb_close(handle);
+        handle = nullptr;
+        return false;
+    }
+    prepared = uv_hrtime();
+    return true;
+}
+
+bool Input::prepare(std::string* error)
+{
+    // allocate isochronous data transfers
+    if (!allocateBuffers()) {
+        *error = "Unable to allocate iso buffers";
+        return false;
+    }
+    for (int i = 0; i < Iso::NumTransfer; ++i) {
+        iso.transfers[i].xfr = libusb_alloc_transfer(Iso::NumPackets);
+        if (!iso.transfers[i].xfr) {
+            *error = "Unable to allocate iso xfr";
+            return false;
+        }
+        libusb_fill_iso_transfer(iso.transfers[i].xfr, handle, Iso::EpIsoIn,
+                                 iso.transfers[i].buf, Iso::TransferSize, Iso::NumPackets,
+                                 Input::transferCallback, this, 1000);
+    }
+    // allocate irq transfer
+    irq.xfr = libusb_alloc_transfer(0);
+    if (!irq.xfr) {
+        *error = "Unable to allocate irq xfr";
+        return false;
+    }
+    libusb_fill_interrupt_transfer(irq.xfr, handle, Irq::EpIn,
+                                   irq.buf, sizeof(irq.buf),
+                                   Input::irqCallback, this, 0);
+    return true;
+}
+
+bool Input::submitIso(Iso::Transfer* transfer, int packets, bool counted)
+{
+    libusb_transfer* xfr = transfer->xfr;
+    if (xfr->num_iso_packets != packets) {
+        xfr->num_iso_packets = packets;
+        xfr->length = packets * Iso::PacketSize;
+        libusb_set_iso_packet_lengths(xfr, Iso::PacketSize);
+    }
+    if (libusb_submit_transfer(xfr) < 0) {
+        transfer->parked = true;
+        if (counted)
+            --iso.inFlight;
+        return false;
+    }
+    transfer->parked = false;
+    if (!counted) {
+        ++iso.inFlight;
+        ++activeTransfers;
+    }
+    return true;
+}
+
+void Input::submit()
+{
+    // as deep as the tuner says, the rest start out parked
+    const IsoTuner::Geometry geometry = tuner.geometry();
+    bool failed = false;
+    for (int i = 0; i < geometry.depth; ++i) {
+        const int packets = prime && i < Iso::PrimeTransfers ? static_cast<int>(Iso::PrimePackets) : geometry.packets;
+        if (!submitIso(&iso.transfers[i], packets))
+            failed = true;
+    }
+    if (libusb_submit_transfer(irq.xfr) < 0) {
+        MutexLocker locker(&mutex);
+        error = "Unable to submit irq xfr";
+        uv_async_send(&async);
+    } else {
+        ++activeTransfers;
+    }
+    if (failed) {
+        MutexLocker locker(&mutex);
+        error = "Unable to submit iso xfr";
+        uv_async_send(&async);
+    }
+}
+
+void Input::cancel()
+{
+    // cancelling a transfer that isn't in flight is harmless
+    for (int i = 0; i < Iso::NumTransfer; ++i)
+        libusb_cancel_transfer(iso.transfers[i].xfr);
+    libusb_cancel_transfer(irq.xfr);
+}
+
+void Input::start()
+{
+    opened = true;
+    uv_async_init(uv_default_loop(), &async, [](uv_async_t* async) {
+            Input* input = static_cast<Input*>(async->data);
+            const uint64_t start = uv_hrtime();
+            {
+                const std::string name = "metadata";
+
+                Input::Metadata meta;
+                while (input->metas.pop(&meta)) {
+                    // send this up to JS
+                    Nan::HandleScope scope;
+                    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+                    obj->Set(Nan::New<v8::String>("vad").ToLocalChecked(), Nan::New<v8::Boolean>(meta.vad == 1));
+                    obj->Set(Nan::New<v8::String>("angle").ToLocalChecked(), Nan::New<v8::Uint32>(meta.angle));
+                    obj->Set(Nan::New<v8::String>("direction").ToLocalChecked(), Nan::New<v8::Uint32>(meta.direction));
+                    input->emit(name, obj);
+                }
+            }
+            // take what's there and let go of the lock before calling into
+            // js, listeners are free to call back into us
+            std::vector<Input::Data> datas;
+            std::vector<Event> events;
+            std::string error;
+            size_t batch = 1;
+            uint64_t signalled = 0;
+            {
+                MutexLocker locker(&input->mutex);
+                if (input->delivery.due(start, input->datas.size(), input->datas.empty() ? 0 : input->datas.front().time)) {
+                    datas.swap(input->datas);
+                    batch = input->delivery.batch();
+                    signalled = input->signalled;
+                    input->signalled = 0;
+                }
+                events.swap(input->events);
+                error.swap(input->error);
+            }
+            const size_t chunks = datas.size();
+            const uint64_t oldest = chunks ? datas.front().time : 0;
+            if (chunks) {
+                const std::string name = "audio";
+                auto it = datas.cbegin();
+                const auto end = datas.cend();
+                while (it != end) {
+                    // make a buffer and send up to js, batches are concatenated
+                    Nan::HandleScope scope;
+                    v8::Local<v8::Value> value;
+                    if (batch == 1) {
+                        value = Nan::NewBuffer(reinterpret_cast<char*>(it->data), it->size).ToLocalChecked();
+                        ++it;
+                    } else {
+                        const auto last = it + std::min<size_t>(batch, end - it);
+                        size_t size = 0;
+                        for (auto cur = it; cur != last; ++cur)
+                            size += cur->size;
+                        uint8_t* data = static_cast<uint8_t*>(malloc(size));
+                        uint8_t* pos = data;
+                        for (; it != last; ++it) {
+                            memcpy(pos, it->data, it->size);
+                            pos += it->size;
+                            free(it->data);
+                        }
+                        value = Nan::NewBuffer(reinterpret_cast<char*>(data), size).ToLocalChecked();
+                    }
+                    input->emit(name, value);
+                }
+                const uint64_t delivered = uv_hrtime();
+                if (!input->firstDelivery)
+                    input->firstDelivery = delivered;
+                for (const Input::Data& data : datas)
+                    input->latencyHistogram.observe(delivered - data.time);
+            }
+            for (const Event& event : events) {
+                Nan::HandleScope scope;
+                input->emit(event.name, eventValue(event));
+            }
+            const uint64_t end = uv_hrtime();
+            if (chunks) {
+                MutexLocker locker(&input->mutex);
+                input->delivery.drained(signalled ? signalled : start, start, end, chunks, oldest);
+            }
+            input->drainTime.add(start, end);
+            if (!error.empty()) {
+                Nan::HandleScope scope;
+                Nan::ThrowError(Nan::New<v8::String>(error).ToLocalChecked());
+            }
+        });
+    // the transfers go out before the thread exists, their completions
+    // wait in our context until it starts handling events
+    submitted = uv_hrtime();
+    submit();
+    uv_thread_create(&thread, Input::run, this);
+
+    MutexLocker locker(&inputsMutex);
+    inputs.insert(this);
+}
+
+bool Input::allocateBuffers()
+{
+    // transfers are 2400 bytes, keep each one on its own cache lines
+    const size_t stride = (Iso::TransferSize + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    iso.bufferSize = (stride * Iso::NumTransfer + page - 1) / page * page;
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+    // linux usbfs can hand out memory the controller writes to directly
+    iso.buffer = libusb_dev_mem_alloc(handle, iso.bufferSize);
+    iso.deviceMemory = iso.buffer != nullptr;
+#endif
+    if (!iso.buffer) {
+        void* mem;
+        if (posix_memalign(&mem, page, iso.bufferSize) != 0)
+            return false;
+        iso.buffer = static_cast<uint8_t*>(mem);
+    }
+    for (int i = 0; i < Iso::NumTransfer; ++i)
+        iso.transfers[i].buf = iso.buffer + i * stride;
+    return true;
+}
+
+void Input::freeBuffers()
+{
+    for (int i = 0; i < Iso::NumTransfer; ++i) {
+        if (iso.transfers[i].xfr) {
+            libusb_free_transfer(iso.transfers[i].xfr);
+            iso.transfers[i].xfr = nullptr;
+        }
+    }
+    if (irq.xfr) {
+        libusb_free_transfer(irq.xfr);
+        irq.xfr = nullptr;
+    }
+    if (!iso.buffer)
+        return;
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+    if (iso.deviceMemory) {
+        libusb_dev_mem_free(handle, iso.buffer, iso.bufferSize);
+        iso.buffer = nullptr;
+        return;
+    }
+#endif
+    free(iso.buffer);
+    iso.buffer = nullptr;
+}
+
+// whether a pipeline event should make the recorder dump, triggers only
+// count when they come on
+static bool recorderTrigger(const FlightRecorder::Options& options, const Event& event, std::string* reason)
+{
+    if (std::find(options.events.begin(), options.events.end(), event.name) == options.events.end())
+        return false;
+    *reason = event.name;
+    for (const Event::Property& property : event.properties) {
+        if (property.name == "active" && !property.number)
+            return false;
+        if (property.name == "rule")
+            *reason = event.name + ":" + property.string;
+    }
+    return true;
+}
+
+void Input::transferCallback(libusb_transfer* xfr)
+{
+    // this appears to return s32l 24khz 2ch audio even though the device spec says 24bit 16khz 2ch
+
+    Input* input = static_cast<Input*>(xfr->user_data);
+    const uint64_t entered = uv_hrtime();
+    if (!input->firstCallback.load(std::memory_order_relaxed))
+        input->firstCallback.store(entered, std::memory_order_relaxed);
+    if (xfr->status == LIBUSB_TRANSFER_CANCELLED || input->stopping) {
+        // the input may be gone as soon as the count drops
+        --input->activeTransfers;
+        return;
+    }
+    ++input->transfers;
+    if (xfr->status != LIBUSB_TRANSFER_COMPLETED)
+        ++input->transferErrors;
+
+    const size_t size = Iso::PacketSize * xfr->num_iso_packets;
+    uint8_t* data = static_cast<uint8_t*>(malloc(size));
+
+    bool error = false;
+    int bad = 0;
+    uint8_t* cur = data;
+    uint8_t* end = data + size;
+    size_t bytes = 0;
+    for (int i = 0; i < xfr->num_iso_packets; ++i) {
+        libusb_iso_packet_descriptor* pack = &xfr->iso_packet_desc[i];
+        if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
+            // bad?
+            ++input->incompletePackets;
+            ++bad;
+            MutexLocker locker(&input->mutex);
+            input->error = "incomplete iso xfr";
+            uv_async_send(&input->async);
+            continue;
+        }
+        if (cur + Iso::PacketSize > end) {
+            // this would be bad
+            MutexLocker locker(&input->mutex);
+            input->error = "overflow in iso xfr";
+            uv_async_send(&input->async);
+            error = true;
+            break;
+        }
+        const uint8_t* isodata = libusb_get_iso_packet_buffer_simple(xfr, i);
+        memcpy(cur, isodata, Iso::PacketSize);
+        cur += Iso::PacketSize;
+        bytes += Iso::PacketSize;
+    }
+
+    if (error) {
+        free(data);
+    } else {
+        const int32_t* frames = reinterpret_cast<const int32_t*>(data);
+        const size_t count = bytes / Format::FrameSize;
+        {
+            MutexLocker locker(&input->pipelineMutex);
+            if (input->clock) {
+                input->clock->update(entered);
+                // the callback runs once the last frame is in, back up to the first
+                const int64_t time = input->clock->map(entered - count * 1000000000ull / Format::SampleRate);
+                Event event("timestamp");
+                event.add("position", static_cast<double>(input->pipeline.position()));
+                event.add("frames", static_cast<double>(count));
+                event.add("time", time / 1e6);
+                input->pipelineEvents.push_back(event);
+            }
+            if (input->occupancy)
+                input->occupancy->process(frames, count, input->pipeline.position(), entered, input->pipelineEvents);
+            input->pipeline.process(frames, count, input->pipelineEvents);
+            for (const auto& sink : input->sinks)
+                sink->push(frames, count);
+            for (const auto& sink : input->rtpSinks)
+                sink->push(frames, count);
+            if (input->recorder) {
+                input->recorder->write(frames, count);
+                std::string reason;
+                for (const Event& event : input->pipelineEvents) {
+                    if (recorderTrigger(input->recorder->options(), event, &reason))
+                        input->recorder->trigger(reason);
+                }
+            }
+        }
+
+        MutexLocker locker(&input->mutex);
+        if (bytes && !input->firstAudio.load(std::memory_order_relaxed)) {
+            const uint64_t now = uv_hrtime();
+            input->firstAudio.store(now, std::memory_order_relaxed);
+            Event event("start");
+            event.add("claim", (input->claimed - input->openStarted) / 1e6);
+            event.add("submitted", (input->submitted - input->openStarted) / 1e6);
+            event.add("firstCallback", (input->firstCallback.load(std::memory_order_relaxed) - input->openStarted) / 1e6);
+            event.add("firstAudio", (now - input->openStarted) / 1e6);
+            input->events.push_back(event);
+            uv_async_send(&input->async);
+        }
+        if (!input->pipelineEvents.empty()) {
+            input->events.insert(input->events.end(), input->pipelineEvents.begin(), input->pipelineEvents.end());
+            input->pipelineEvents.clear();
+            uv_async_send(&input->async);
+        }
+        if (input->selector) {
+            // the selector decides whether this goes anywhere
+            input->selector->process(input, frames, count);
+            free(data);
+        } else {
+            size_t size = bytes;
+            if (input->audioFormat.type != SampleFormat::S32) {
+                const size_t samples = count * Format::Channels;
+                size = samples * input->audioFormat.sampleSize();
+                uint8_t* converted = static_cast<uint8_t*>(malloc(std::max<size_t>(size, 1)));
+                convertSamples(input->audioFormat, frames, samples, converted);
+                free(data);
+                data = converted;
+            }
+            // tell our async thingy, when the delivery settings say so
+            const uint64_t now = uv_hrtime();
+            input->datas.push_back(Input::Data{ data, size, now });
+            if (input->delivery.arrived(now, input->datas.size(), input->datas.front().time)) {
+                if (!input->signalled)
+                    input->signalled = now;
+                uv_async_send(&input->async);
+            }
+        }
+    }
+
+    const uint64_t left = uv_hrtime();
+    input->transferTime.add(entered, left);
+    input->transferHistogram.observe(left - entered);
+    input->bytesReceived += bytes;
+
+    IsoTuner::Adjustment adjustment;
+    if (input->tuner.observe(entered, xfr->num_iso_packets, bad, &adjustment)) {
+        Event event("tune");
+        event.add("depth", static_cast<double>(adjustment.to.depth));
+        event.add("packets", static_cast<double>(adjustment.to.packets));
+        event.add("previousDepth", static_cast<double>(adjustment.from.depth));
+        event.add("previousPackets", static_cast<double>(adjustment.from.packets));
+        event.add("latency", adjustment.to.packets * IsoTuner::PacketNs / 1e6);
+        event.add("reason", adjustment.reason);
+        event.add("errorRate", adjustment.errorRate);
+        event.add("maxGap", adjustment.maxGap);
+        MutexLocker locker(&input->mutex);
+        input->events.push_back(event);
+        uv_async_send(&input->async);
+    }
+
+    // geometry changes take effect as transfers come back, priming ends
+    // the same way
+    const IsoTuner::Geometry geometry = input->tuner.geometry();
+    Iso::Transfer* transfer = nullptr;
+    for (Iso::Transfer& t : input->iso.transfers) {
+        if (t.xfr == xfr)
+            transfer = &t;
+    }
+    bool resubmitted = false;
+    {
+        // run() sets stopping under the mutex before cancelling, so
+        // nothing submitted here can slip past the cancel
+        MutexLocker locker(&input->mutex);
+        if (input->stopping) {
+            // not resubmitted
+        } else if (input->iso.inFlight > geometry.depth) {
+            // shallower, this one sits out
+            transfer->parked = true;
+            --input->iso.inFlight;
+        } else {
+            // we're done, submit the transfer back to libusb
+            resubmitted = input->submitIso(transfer, geometry.packets, true);
+            if (!resubmitted)
+                ++input->submitErrors;
+            // deeper, bring parked ones back
+            for (Iso::Transfer& t : input->iso.transfers) {
+                if (input->iso.inFlight >= geometry.depth)
+                    break;
+                if (t.parked && !input->submitIso(&t, geometry.packets))
+                    ++input->submitErrors;
+            }
+        }
+    }
+    // the input may be gone as soon as the count drops
+    if (!resubmitted)
+        --input->activeTransfers;
+}
+
+void Input::irqCallback(libusb_transfer* xfr)
+{
+    Input* input = static_cast<Input*>(xfr->user_data);
+    if (xfr->status != LIBUSB_TRANSFER_COMPLETED || input->stopping) {
+        // not resubmitted, the input may be gone as soon as the count drops
+        --input->activeTransfers;
+        return;
+    }
+    const uint64_t entered = uv_hrtime();
+    if (xfr->actual_length >= 6) {
+        unsigned char irq1 = xfr->buffer[0];
+        unsigned char irq2 = xfr->buffer[1];
+        if (irq1 == 0x06 && irq2 == 0x36) {
+            // VAD / DOA change
+            // byte 3 is VAD status,
+            // byte 4 is high byte of angle
+            // byte 5 is low byte of angle
+            // byte 6 is direction
+            const uint8_t vad = xfr->buffer[2];
+            const uint16_t angle = (static_cast<uint16_t>(xfr->buffer[3]) << 8) | xfr->buffer[4];
+            const uint8_t direction = xfr->buffer[5];
+
+            const Metadata meta{ vad, direction, angle };
+            input->latest.store(Latest{ meta, entered });
+            {
+                MutexLocker locker(&input->pipelineMutex);
+                if (vad == 1 && input->lastVad != 1 && input->recorder && input->recorder->options().vad)
+                    input->recorder->trigger("vad");
+                if (input->occupancy)
+                    input->occupancy->metadata(entered, vad, angle);
+            }
+            input->lastVad = vad;
+            input->history.add(MetadataHistory::Entry{ entered, angle, vad, direction });
+            // if js is that far behind updates are dropped rather than blocking the usb thread
+            if (!input->metas.push(meta))
+                ++input->metadataDrops;
+            {
+                MutexLocker locker(&input->mutex);
+                if (input->selector)
+                    input->selector->metadata(input, meta);
+            }
+            uv_async_send(&input->async);
+        }
+    }
+    input->irqTime.add(entered, uv_hrtime());
+
+    // we're done, submit the transfer back to libusb
+    bool resubmitted;
+    {
+        MutexLocker locker(&input->mutex);
+        resubmitted = !input->stopping && libusb_submit_transfer(xfr) >= 0;
+    }
+    // the input may be gone as soon as the count drops
+    if (!resubmitted)
+        --input->activeTransfers;
+}
+
+void Input::run(void* arg)
+{
+    Input* input = static_cast<Input*>(arg);
+
+    // 1 second
+    struct timeval tv = { 1, 0 };
+    for (;;) {
+        libusb_handle_events_timeout_completed(input->usb, &tv, nullptr);
+        input->usbCpu.sample();
+
+        MutexLocker locker(&input->mutex);
+        if (input->stopped) {
+            // nothing is resubmitted once stopping is set, one cancel brings
+            // them all back
+            if (!input->stopping) {
+                input->stopping = true;
+                input->cancel();
+            }
+            if (!input->activeTransfers)
+                break;
+        }
+    }
+}
+
+
+NAN_METHOD(create) {
+    Input* input = new Input;
+    if (!input->isValid()) {
+        Nan::ThrowError("Unable to initialize libusb");
+        delete input;
+        return;
+    }
+    info.GetReturnValue().Set(input->makeObject());
+}
+
+NAN_METHOD(open) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external to open");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an object to open");
+        return;
+    }
+
+    v8::Local<v8::Object> data = v8::Local<v8::Object>::Cast(info[1]);
+    auto busKey = Nan::New<v8::String>("bus").ToLocalChecked();
+    auto portKey = Nan::New<v8::String>("port").ToLocalChecked();
+    if (!data->Has(busKey)) {
+        Nan::ThrowError("Need a bus value");
+        return;
+    }
+    if (!data->Has(portKey)) {
+        Nan::ThrowError("Need a port value");
+        return;
+    }
+    auto busValue = data->Get(busKey);
+    auto portValue = data->Get(portKey);
+    if (!busValue->IsUint32()) {
+        Nan::ThrowError("Bus needs to be an int");
+        return;
+    }
+    if (!portValue->IsUint32()) {
+        Nan::ThrowError("Port needs to be an int");
+        return;
+    }
+
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    input->prime = booleanOption(data, "prime", false);
+    if (!input->open(v8::Local<v8::Uint32>::Cast(busValue)->Value(), v8::Local<v8::Uint32>::Cast(portValue)->Value())) {
+        return;
+    }
+}
+
+NAN_METHOD(enumerate) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external to enumerate");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    std::vector<libusb_device*> devices;
+    if (!scanDevices(input->usb, &devices)) {
+        // error
+        Nan::ThrowError("Error getting devices");
+        return;
+    }
+    v8::Local<v8::Array> array = Nan::New<v8::Array>();
+    for (size_t i = 0; i < devices.size(); ++i) {
+        v8::Local<v8::Object> device = Nan::New<v8::Object>();
+        device->Set(Nan::New<v8::String>("bus").ToLocalChecked(), Nan::New<v8::Uint32>(libusb_get_bus_number(devices[i])));
+        device->Set(Nan::New<v8::String>("port").ToLocalChecked(), Nan::New<v8::Uint32>(libusb_get_port_number(devices[i])));
+        array->Set(i, device);
+        libusb_unref_device(devices[i]);
+    }
+    info.GetReturnValue().Set(array);
+}
+
+// a number or an array of numbers, empty if the key isn't there
+static bool filterValues(v8::Local<v8::Object> options, const char* key, std::vector<uint32_t>* values)
+{
+    auto k = Nan::New<v8::String>(key).ToLocalChecked();
+    if (!options->Has(k))
+        return true;
+    v8::Local<v8::Value> value = options->Get(k);
+    if (value->IsUint32()) {
+        values->push_back(v8::Local<v8::Uint32>::Cast(value)->Value());
+        return true;
+    }
+    if (!value->IsArray())
+        return false;
+    v8::Local<v8::Array> array = v8::Local<v8::Array>::Cast(value);
+    for (uint32_t i = 0; i < array->Length(); ++i) {
+        v8::Local<v8::Value> v = array->Get(i);
+        if (!v->IsUint32())
+            return false;
+        values->push_back(v8::Local<v8::Uint32>::Cast(v)->Value());
+    }
+    return true;
+}
+
+static bool filterMatches(const std::vector<uint32_t>& values, uint32_t value)
+{
+    return values.empty() || std::find(values.begin(), values.end(), value) != values.end();
+}
+
+NAN_METHOD(openAll) {
+    std::vector<uint32_t> buses, ports;
+    size_t limit = 0;
+    bool prime = false;
+    if (info.Length() >= 1 && info[0]->IsObject()) {
+        v8::Local<v8::Object> filter = v8::Local<v8::Object>::Cast(info[0]);
+        if (!filterValues(filter, "bus", &buses) || !filterValues(filter, "port", &ports)) {
+            Nan::ThrowError("Bus and port need to be ints or arrays of ints");
+            return;
+        }
+        limit = static_cast<size_t>(std::max(0., numberOption(filter, "limit", 0)));
+        prime = booleanOption(filter, "prime", false);
+    }
+
+    // a scan in a temporary context picks the devices. each input then has
+    // its own context, which libusb enumerates again when it's set up, and
+    // the device is looked up in it by bus and address. that's N + 1
+    // contexts and scans for N arrays, the price of every array's
+    // completions running on its own thread. the lookups run on the
+    // claiming threads
+    const uint64_t started = uv_hrtime();
+    libusb_context* usb;
+    if (libusb_init(&usb) != 0) {
+        Nan::ThrowError("Unable to initialize libusb");
+        return;
+    }
+    std::vector<libusb_device*> devices;
+    if (!scanDevices(usb, &devices)) {
+        libusb_exit(usb);
+        Nan::ThrowError("Error getting devices");
+        return;
+    }
+
+    struct Open {
+        uint8_t bus, port, address;
+        Input* input;
+        std::string error;
+        bool ok;
+    };
+    struct Job {
+        std::vector<Open> opens;
+        std::atomic<size_t> next;
+    } job;
+    for (libusb_device* dev : devices) {
+        const uint8_t bus = libusb_get_bus_number(dev);
+        const uint8_t port = libusb_get_port_number(dev);
+        if ((!limit || job.opens.size() < limit) && filterMatches(buses, bus) && filterMatches(ports, port)) {
+            Input* input = new Input;
+            input->openStarted = started;
+            input->prime = prime;
+            job.opens.push_back(Open{ bus, port, libusb_get_device_address(dev), input, std::string(), false });
+        }
+        libusb_unref_device(dev);
+    }
+    libusb_exit(usb);
+
+    // claiming is a handful of synchronous control transfers per device,
+    // run them side by side
+    enum { MaxOpenThreads = 8 };
+    job.next = 0;
+    auto worker = [](void* arg) {
+        Job* job = static_cast<Job*>(arg);
+        for (;;) {
+            const size_t i = job->next.fetch_add(1);
+            if (i >= job->opens.size())
+                break;
+            Open& open = job->opens[i];
+            if (!open.input->isValid()) {
+                open.error = "Unable to initialize libusb";
+                continue;
+            }
+            libusb_device* dev = findDevice(open.input->usb, open.bus, open.port, open.address);
+            if (!dev) {
+                open.error = "No handle";
+                continue;
+            }
+            open.ok = open.input->claim(dev, &open.error);
+            libusb_unref_device(dev);
+        }
+    };
+    std::vector<uv_thread_t> threads(std::min<size_t>(job.opens.size(), MaxOpenThreads));
+    for (uv_thread_t& thread : threads)
+        uv_thread_create(&thread, worker, &job);
+    for (uv_thread_t& thread : threads)
+        uv_thread_join(&thread);
+
+    // then start the streams together
+    for (Open& open : job.opens) {
+        if (open.ok)
+            open.input->start();
+    }
+
+    v8::Local<v8::Array> array = Nan::New<v8::Array>();
+    for (size_t i = 0; i < job.opens.size(); ++i) {
+        Open& open = job.opens[i];
+        v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+        obj->Set(Nan::New<v8::String>("bus").ToLocalChecked(), Nan::New<v8::Uint32>(open.bus));
+        obj->Set(Nan::New<v8::String>("port").ToLocalChecked(), Nan::New<v8::Uint32>(open.port));
+        if (open.ok) {
+            obj->Set(Nan::New<v8::String>("uma8").ToLocalChecked(), open.input->makeObject());
+            obj->Set(Nan::New<v8::String>("claim").ToLocalChecked(), Nan::New<v8::Number>((open.input->claimed - started) / 1e6));
+        } else {
+            obj->Set(Nan::New<v8::String>("error").ToLocalChecked(), Nan::New<v8::String>(open.error).ToLocalChecked());
+            delete open.input;
+        }
+        array->Set(i, obj);
+    }
+    info.GetReturnValue().Set(array);
+}
+
+NAN_METHOD(on) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for on");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowError("Need a string for on");
+        return;
+    }
+    if (info.Length() < 3 || !info[2]->IsFunction()) {
+        Nan::ThrowError("Need a function for on");
+        return;
+    }
+    Emitter* emitter = Emitter::Unwrap<Emitter>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string name = *Nan::Utf8String(info[1]);
+    emitter->ons[name].push_back(std::make_shared<Nan::Callback>(v8::Local<v8::Function>::Cast(info[2])));
+}
+
+NAN_METHOD(removeListener) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for removeListener");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowError("Need a string for removeListener");
+        return;
+    }
+    if (info.Length() < 3 || !info[2]->IsFunction()) {
+        Nan::ThrowError("Need a function for removeListener");
+        return;
+    }
+    Emitter* emitter = Emitter::Unwrap<Emitter>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string name = *Nan::Utf8String(info[1]);
+    auto listeners = emitter->ons.find(name);
+    if (listeners == emitter->ons.end()) {
+        info.GetReturnValue().Set(Nan::New<v8::Boolean>(false));
+        return;
+    }
+
+    Nan::Callback cur(v8::Local<v8::Function>::Cast(info[2]));
+    auto& listenerList = listeners->second;
+    auto listener = listenerList.rbegin();
+    const auto end = listenerList.rend();
+    while (listener != end) {
+        if (*listener && **listener == cur) {
+            // got it
+            listenerList.erase(std::next(listener).base());
+            if (listenerList.empty()) {
+                emitter->ons.erase(name);
+            }
+            info.GetReturnValue().Set(Nan::New<v8::Boolean>(true));
+            return;
         }
+        ++listener;
+    }
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(false));
+}
+
+NAN_METHOD(removeAllListeners) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for removeAllListeners");
         return;
     }
-    if (xfr->actual_length >= 6) {
-        unsigned char irq1 = xfr->buffer[0];
-        unsigned char irq2 = xfr->buffer[1];
-        if (irq1 == 0x06 && irq2 == 0x36) {
-            Input* input = static_cast<Input*>(xfr->user_data);
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowError("Need a string for removeAllListeners");
+        return;
+    }
+    Emitter* emitter = Emitter::Unwrap<Emitter>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string name = *Nan::Utf8String(info[1]);
+    auto listeners = emitter->ons.find(name);
+    if (listeners != emitter->ons.end()) {
+        emitter->ons.erase(listeners);
+        info.GetReturnValue().Set(Nan::New<v8::Boolean>(true));
+    } else {
+        info.GetReturnValue().Set(Nan::New<v8::Boolean>(false));
+    }
+}
 
-            // VAD / DOA change
-            // byte 3 is VAD status,
-            // byte 4 is high byte of angle
-            // byte 5 is low byte of angle
-            // byte 6 is direction
-            const uint8_t vad = xfr->buffer[2];
-            const uint16_t angle = (static_cast<uint16_t>(xfr->buffer[3]) << 8) | xfr->buffer[4];
-            const uint8_t direction = xfr->buffer[5];
+NAN_METHOD(setPreview) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setPreview");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (info.Length() < 2 || info[1]->IsNull() || info[1]->IsUndefined()) {
+        MutexLocker locker(&input->pipelineMutex);
+        input->pipeline.setPreview(nullptr);
+        return;
+    }
+    if (!info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for setPreview");
+        return;
+    }
+    Preview::Options opts;
+    if (!previewOptions(v8::Local<v8::Object>::Cast(info[1]), &opts))
+        return;
+    MutexLocker locker(&input->pipelineMutex);
+    input->pipeline.setPreview(&opts);
+}
 
-            MutexLocker locker(&input->mutex);
-            input->metas.push_back(Metadata{ vad, direction, angle });
-            uv_async_send(&input->async);
+NAN_METHOD(setTriggers) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setTriggers");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (info.Length() < 2 || info[1]->IsNull() || info[1]->IsUndefined()) {
+        MutexLocker locker(&input->pipelineMutex);
+        input->pipeline.setTriggers(nullptr);
+        return;
+    }
+    if (!info[1]->IsArray()) {
+        Nan::ThrowError("Need an array of rules for setTriggers");
+        return;
+    }
+    std::vector<Triggers::Rule> rules;
+    if (!triggerRules(v8::Local<v8::Array>::Cast(info[1]), &rules))
+        return;
+    MutexLocker locker(&input->pipelineMutex);
+    input->pipeline.setTriggers(&rules);
+}
+
+NAN_METHOD(setHealth) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setHealth");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (info.Length() < 2 || info[1]->IsNull() || info[1]->IsUndefined()) {
+        MutexLocker locker(&input->pipelineMutex);
+        input->pipeline.setHealth(nullptr);
+        return;
+    }
+    if (!info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for setHealth");
+        return;
+    }
+    Health::Options opts;
+    if (!healthOptions(v8::Local<v8::Object>::Cast(info[1]), &opts))
+        return;
+    MutexLocker locker(&input->pipelineMutex);
+    input->pipeline.setHealth(&opts);
+}
+
+NAN_METHOD(setLoudness) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setLoudness");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (info.Length() < 2 || info[1]->IsNull() || info[1]->IsUndefined()) {
+        MutexLocker locker(&input->pipelineMutex);
+        input->pipeline.setLoudness(nullptr);
+        return;
+    }
+    if (!info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for setLoudness");
+        return;
+    }
+    Loudness::Options opts;
+    if (!loudnessOptions(v8::Local<v8::Object>::Cast(info[1]), &opts))
+        return;
+    MutexLocker locker(&input->pipelineMutex);
+    input->pipeline.setLoudness(&opts);
+}
+
+NAN_METHOD(setGraph) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setGraph");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsArray()) {
+        Nan::ThrowError("Need an array of nodes for setGraph");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    std::vector<NodeSpec> nodes;
+    if (!graphNodes(v8::Local<v8::Array>::Cast(info[1]), &nodes))
+        return;
+    MutexLocker locker(&input->pipelineMutex);
+    std::string error;
+    if (!input->pipeline.setGraph(nodes, &error))
+        Nan::ThrowError(error.c_str());
+}
+
+NAN_METHOD(tap) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for tap");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowError("Need a tap point for tap");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string name = *Nan::Utf8String(info[1]);
+    Tap::Options opts;
+    if (info.Length() >= 3 && info[2]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[2]);
+        opts.path = stringOption(options, "path", opts.path);
+        opts.size = numberOption(options, "size", opts.size);
+    }
+    if (!Tap::validate(opts)) {
+        Nan::ThrowError("Invalid tap options");
+        return;
+    }
+    MutexLocker locker(&input->pipelineMutex);
+    const std::string format = input->pipeline.tapFormat(name);
+    if (format.empty()) {
+        Nan::ThrowError(("No tap point " + name).c_str());
+        return;
+    }
+    std::shared_ptr<Tap> tap(new Tap(opts, format));
+    std::string error;
+    if (!tap->start(&error)) {
+        Nan::ThrowError(error.c_str());
+        return;
+    }
+    input->pipeline.setTap(name, tap);
+}
+
+NAN_METHOD(untap) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for untap");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowError("Need a tap point for untap");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string name = *Nan::Utf8String(info[1]);
+    std::shared_ptr<Tap> tap;
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        auto it = input->pipeline.taps().find(name);
+        if (it != input->pipeline.taps().end()) {
+            tap = it->second;
+            input->pipeline.setTap(name, std::shared_ptr<Tap>());
+        }
+    }
+    // a file tap finishes writing outside the lock
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(tap != nullptr));
+}
+
+NAN_METHOD(readTap) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for readTap");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowError("Need a tap point for readTap");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string name = *Nan::Utf8String(info[1]);
+    std::shared_ptr<Tap> tap;
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        auto it = input->pipeline.taps().find(name);
+        if (it != input->pipeline.taps().end())
+            tap = it->second;
+    }
+    if (!tap || !tap->options().path.empty()) {
+        Nan::ThrowError(("No ring tap at " + name).c_str());
+        return;
+    }
+    const std::vector<uint8_t> data = tap->take();
+    info.GetReturnValue().Set(Nan::CopyBuffer(reinterpret_cast<const char*>(data.data()), data.size()).ToLocalChecked());
+}
+
+NAN_METHOD(getLatestMetadata) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for getLatestMetadata");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    Input::Latest latest;
+    const uint32_t updates = input->latest.load(&latest);
+    const double age = updates ? (uv_hrtime() - latest.time) / 1e6 : 0.;
+    if (info.Length() >= 2 && info[1]->IsFloat64Array()) {
+        // filled in place so polling doesn't allocate
+        Nan::TypedArrayContents<double> out(info[1]);
+        if (out.length() < 5) {
+            Nan::ThrowError("Need a Float64Array of at least 5 for getLatestMetadata");
+            return;
+        }
+        double* values = *out;
+        values[0] = latest.meta.vad == 1 ? 1 : 0;
+        values[1] = latest.meta.angle;
+        values[2] = latest.meta.direction;
+        values[3] = age;
+        values[4] = updates;
+        info.GetReturnValue().Set(Nan::New<v8::Uint32>(updates));
+        return;
+    }
+    if (!updates) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("vad").ToLocalChecked(), Nan::New<v8::Boolean>(latest.meta.vad == 1));
+    obj->Set(Nan::New<v8::String>("angle").ToLocalChecked(), Nan::New<v8::Uint32>(latest.meta.angle));
+    obj->Set(Nan::New<v8::String>("direction").ToLocalChecked(), Nan::New<v8::Uint32>(latest.meta.direction));
+    obj->Set(Nan::New<v8::String>("age").ToLocalChecked(), Nan::New<v8::Number>(age));
+    obj->Set(Nan::New<v8::String>("updates").ToLocalChecked(), Nan::New<v8::Uint32>(updates));
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(setMetadataHistory) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setMetadataHistory");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    size_t capacity = 0;
+    if (info.Length() >= 2 && info[1]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+        capacity = static_cast<size_t>(std::max(0., numberOption(options, "capacity", 65536)));
+    }
+    if (!MetadataHistory::validate(capacity)) {
+        Nan::ThrowError("Invalid metadata history capacity");
+        return;
+    }
+    input->history.setCapacity(capacity);
+}
+
+NAN_METHOD(metadataHistory) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for metadataHistory");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    uint64_t from = 0, to = UINT64_MAX;
+    if (info.Length() >= 2 && info[1]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+        from = hrtimeOption(options, "from", from);
+        to = hrtimeOption(options, "to", uv_hrtime() + 1);
+    }
+    std::vector<MetadataHistory::Entry> entries;
+    input->history.range(from, to, &entries);
+    std::vector<double> times(entries.size());
+    std::vector<uint8_t> vads(entries.size()), directions(entries.size());
+    std::vector<uint16_t> angles(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        times[i] = entries[i].time / 1e6;
+        vads[i] = entries[i].vad == 1 ? 1 : 0;
+        angles[i] = entries[i].angle;
+        directions[i] = entries[i].direction;
+    }
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("time").ToLocalChecked(), typedArray<v8::Float64Array>(times.data(), times.size()));
+    obj->Set(Nan::New<v8::String>("vad").ToLocalChecked(), typedArray<v8::Uint8Array>(vads.data(), vads.size()));
+    obj->Set(Nan::New<v8::String>("angle").ToLocalChecked(), typedArray<v8::Uint16Array>(angles.data(), angles.size()));
+    obj->Set(Nan::New<v8::String>("direction").ToLocalChecked(), typedArray<v8::Uint8Array>(directions.data(), directions.size()));
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(metadataSummary) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for metadataSummary");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for metadataSummary");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    const uint64_t now = uv_hrtime();
+    const uint64_t to = hrtimeOption(options, "to", now);
+    const uint64_t from = hrtimeOption(options, "from", to > 60000000000ull ? to - 60000000000ull : 0);
+    const uint64_t window = hrtimeOption(options, "window", to - from);
+    const double bins = numberOption(options, "bins", 36);
+    if (to <= from || !window || (to - from) / window > 100000 || bins < 1 || bins > 360) {
+        Nan::ThrowError("Invalid metadata summary options");
+        return;
+    }
+    // the histogram is windows * bins doubles, built twice on the way out.
+    // a million cells is 8 MB each time
+    enum { MaxSummaryCells = 1 << 20 };
+    const uint64_t windows = (to - from + window - 1) / window;
+    if (windows * static_cast<uint64_t>(bins) > MaxSummaryCells) {
+        Nan::ThrowRangeError("Metadata summary too large, reduce windows or bins");
+        return;
+    }
+    const std::vector<MetadataHistory::Summary> summaries = input->history.summarize(from, to, window, static_cast<size_t>(bins), now);
+    const size_t count = summaries.size();
+    const size_t binCount = static_cast<size_t>(bins);
+    std::vector<double> starts(count), duty(count), histogram(count * binCount);
+    std::vector<uint32_t> updates(count);
+    for (size_t i = 0; i < count; ++i) {
+        starts[i] = summaries[i].start / 1e6;
+        duty[i] = summaries[i].duty;
+        updates[i] = summaries[i].updates;
+        std::copy(summaries[i].histogram.begin(), summaries[i].histogram.end(), histogram.begin() + i * binCount);
+    }
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("start").ToLocalChecked(), typedArray<v8::Float64Array>(starts.data(), count));
+    obj->Set(Nan::New<v8::String>("duty").ToLocalChecked(), typedArray<v8::Float64Array>(duty.data(), count));
+    obj->Set(Nan::New<v8::String>("updates").ToLocalChecked(), typedArray<v8::Uint32Array>(updates.data(), count));
+    obj->Set(Nan::New<v8::String>("histogram").ToLocalChecked(), typedArray<v8::Float64Array>(histogram.data(), histogram.size()));
+    obj->Set(Nan::New<v8::String>("bins").ToLocalChecked(), Nan::New<v8::Uint32>(static_cast<uint32_t>(binCount)));
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(loudness) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for loudness");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    Loudness::Values values;
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        if (!input->pipeline.loudness()) {
+            Nan::ThrowError("Loudness metering is not enabled");
+            return;
+        }
+        values = input->pipeline.loudness()->values();
+    }
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("momentary").ToLocalChecked(), Nan::New<v8::Number>(values.momentary));
+    obj->Set(Nan::New<v8::String>("shortTerm").ToLocalChecked(), Nan::New<v8::Number>(values.shortTerm));
+    obj->Set(Nan::New<v8::String>("integrated").ToLocalChecked(), Nan::New<v8::Number>(values.integrated));
+    obj->Set(Nan::New<v8::String>("range").ToLocalChecked(), Nan::New<v8::Number>(values.range));
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(resetLoudness) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for resetLoudness");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    MutexLocker locker(&input->pipelineMutex);
+    if (input->pipeline.loudness())
+        input->pipeline.loudness()->reset();
+}
+
+NAN_METHOD(pipe) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for pipe");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsInt32()) {
+        Nan::ThrowError("Need a file descriptor for pipe");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    FdSink::Options opts;
+    opts.fd = v8::Local<v8::Int32>::Cast(info[1])->Value();
+    if (info.Length() >= 3 && info[2]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[2]);
+        if (!sampleFormatOptions(options, &opts.format))
+            return;
+        opts.bufferSize = numberOption(options, "bufferSize", opts.bufferSize);
+        opts.batch = numberOption(options, "batch", opts.batch);
+    }
+    if (!FdSink::validate(opts)) {
+        Nan::ThrowError("Invalid pipe options");
+        return;
+    }
+    MutexLocker locker(&input->pipelineMutex);
+    for (const auto& sink : input->sinks) {
+        if (sink->options().fd == opts.fd) {
+            Nan::ThrowError("Already piping to this file descriptor");
+            return;
+        }
+    }
+    std::unique_ptr<FdSink> sink(new FdSink(opts));
+    std::string error;
+    if (!sink->start(&error)) {
+        Nan::ThrowError(error.c_str());
+        return;
+    }
+    input->sinks.push_back(std::move(sink));
+}
+
+NAN_METHOD(unpipe) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for unpipe");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsInt32()) {
+        Nan::ThrowError("Need a file descriptor for unpipe");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    const int fd = v8::Local<v8::Int32>::Cast(info[1])->Value();
+    std::unique_ptr<FdSink> sink;
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        for (auto it = input->sinks.begin(); it != input->sinks.end(); ++it) {
+            if ((*it)->options().fd == fd) {
+                sink = std::move(*it);
+                input->sinks.erase(it);
+                break;
+            }
+        }
+    }
+    // stopping joins the writer, don't hold up the usb thread for that
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(sink != nullptr));
+    sink.reset();
+}
+
+NAN_METHOD(streamRtp) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for streamRtp");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for streamRtp");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    RtpSink::Options opts;
+    opts.host = stringOption(options, "host", opts.host);
+    opts.port = static_cast<int>(numberOption(options, "port", opts.port));
+    const std::string payload = stringOption(options, "payload", RtpSink::payloadName(opts.payload));
+    if (payload == "L16") {
+        opts.payload = RtpSink::L16;
+    } else if (payload == "L24") {
+        opts.payload = RtpSink::L24;
+    } else {
+        Nan::ThrowError("RTP payload needs to be L16 or L24");
+        return;
+    }
+    opts.payloadType = static_cast<int>(numberOption(options, "payloadType", opts.payloadType));
+    opts.ptime = numberOption(options, "ptime", opts.ptime);
+    auto ssrcKey = Nan::New<v8::String>("ssrc").ToLocalChecked();
+    if (options->Has(ssrcKey)) {
+        v8::Local<v8::Value> ssrc = options->Get(ssrcKey);
+        if (!ssrc->IsUint32()) {
+            Nan::ThrowError("SSRC needs to be an unsigned 32 bit int");
+            return;
+        }
+        opts.ssrc = v8::Local<v8::Uint32>::Cast(ssrc)->Value();
+        opts.randomSsrc = false;
+    }
+    opts.ttl = static_cast<int>(numberOption(options, "ttl", opts.ttl));
+    opts.interface = stringOption(options, "interface", opts.interface);
+    opts.loop = booleanOption(options, "loop", opts.loop);
+    opts.bufferSize = numberOption(options, "bufferSize", opts.bufferSize);
+    opts.batch = numberOption(options, "batch", opts.batch);
+    if (!RtpSink::validate(opts)) {
+        Nan::ThrowError("Invalid RTP options");
+        return;
+    }
+    MutexLocker locker(&input->pipelineMutex);
+    for (const auto& sink : input->rtpSinks) {
+        if (sink->options().host == opts.host && sink->options().port == opts.port) {
+            Nan::ThrowError("Already streaming to this address");
+            return;
         }
     }
-
-    // we're done, submit the transfer back to libusb
-    libusb_submit_transfer(xfr);
+    std::unique_ptr<RtpSink> sink(new RtpSink(opts));
+    std::string error;
+    if (!sink->start(&error)) {
+        Nan::ThrowError(error.c_str());
+        return;
+    }
+    input->rtpSinks.push_back(std::move(sink));
 }
 
-void Input::run(void* arg)
-{
-    Input* input = static_cast<Input*>(arg);
-
-    // allocate isochronous data transfers
-    int ret;
-    for (int i = 0; i < Iso::NumTransfer; ++i) {
-        input->iso.transfers[i].xfr = libusb_alloc_transfer(Iso::NumPackets);
-        if (!input->iso.transfers[i].xfr) {
-            // bad, handle me
-            MutexLocker locker(&input->mutex);
-            input->error = "Unable to allocate iso xfr";
-            uv_async_send(&input->async);
-            return;
+NAN_METHOD(stopRtp) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for stopRtp");
+        return;
+    }
+    if (info.Length() < 3 || !info[1]->IsString() || !info[2]->IsInt32()) {
+        Nan::ThrowError("Need a host and a port for stopRtp");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string host = *Nan::Utf8String(info[1]);
+    const int port = v8::Local<v8::Int32>::Cast(info[2])->Value();
+    std::unique_ptr<RtpSink> sink;
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        for (auto it = input->rtpSinks.begin(); it != input->rtpSinks.end(); ++it) {
+            if ((*it)->options().host == host && (*it)->options().port == port) {
+                sink = std::move(*it);
+                input->rtpSinks.erase(it);
+                break;
+            }
         }
+    }
+    // stopping joins the sender, don't hold up the usb thread for that
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(sink != nullptr));
+    sink.reset();
+}
 
-        libusb_fill_iso_transfer(input->iso.transfers[i].xfr, input->handle, Iso::EpIsoIn,
-                                 input->iso.transfers[i].buf, sizeof(input->iso.transfers[i].buf), Iso::NumPackets,
-                                 Input::transferCallback, input, 1000);
-        libusb_set_iso_packet_lengths(input->iso.transfers[i].xfr, Iso::PacketSize);
-        ret = libusb_submit_transfer(input->iso.transfers[i].xfr);
-        if (ret < 0) {
-            MutexLocker locker(&input->mutex);
-            input->error = "Unable to submit iso xfr";
-            uv_async_send(&input->async);
-        }
+NAN_METHOD(setDelivery) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setDelivery");
+        return;
     }
-    // allocate irq transfer
-    input->irq.xfr = libusb_alloc_transfer(0);
-    if (!input->irq.xfr) {
-        MutexLocker locker(&input->mutex);
-        input->error = "Unable to allocate irq xfr";
-        uv_async_send(&input->async);
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for setDelivery");
         return;
     }
-    libusb_fill_interrupt_transfer(input->irq.xfr, input->handle, Irq::EpIn,
-                                   input->irq.buf, sizeof(input->irq.buf),
-                                   Input::irqCallback, input, 0);
-    ret = libusb_submit_transfer(input->irq.xfr);
-    if (ret < 0) {
-        MutexLocker locker(&input->mutex);
-        input->error = "Unable to submit irq xfr";
-        uv_async_send(&input->async);
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    Delivery::Options opts;
+    const std::string mode = stringOption(options, "mode", Delivery::modeName(opts.mode));
+    if (mode == "immediate") {
+        opts.mode = Delivery::Immediate;
+    } else if (mode == "fixed") {
+        opts.mode = Delivery::Fixed;
+    } else if (mode == "adaptive") {
+        opts.mode = Delivery::Adaptive;
+    } else {
+        Nan::ThrowError("Delivery mode needs to be immediate, fixed or adaptive");
+        return;
+    }
+    opts.batch = numberOption(options, "batch", opts.batch);
+    opts.deadline = numberOption(options, "deadline", opts.deadline);
+    opts.targetLatency = numberOption(options, "targetLatency", opts.targetLatency);
+    if (!Delivery::validate(opts)) {
+        Nan::ThrowError("Invalid delivery options");
+        return;
     }
+    MutexLocker locker(&input->mutex);
+    input->delivery.setOptions(opts);
+}
 
-    // 1 second
-    struct timeval tv = { 1, 0 };
-    for (;;) {
-        libusb_handle_events_timeout_completed(input->usb, &tv, nullptr);
+NAN_METHOD(setAudioFormat) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setAudioFormat");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    SampleFormat format;
+    if (info.Length() >= 2 && info[1]->IsObject() && !sampleFormatOptions(v8::Local<v8::Object>::Cast(info[1]), &format))
+        return;
+    // the drain lets go of the lock before emitting, so this is fine from
+    // an audio listener. chunks already queued keep the format they have
+    MutexLocker locker(&input->mutex);
+    input->audioFormat = format;
+}
 
-        MutexLocker locker(&input->mutex);
-        if (input->stopped) {
-            if (input->pendingCancels == -1) {
-                input->pendingCancels = 1 + Iso::NumTransfer;
-                libusb_cancel_transfer(input->irq.xfr);
-                for (int i = 0; i < Iso::NumTransfer; ++i) {
-                    libusb_cancel_transfer(input->iso.transfers[i].xfr);
+NAN_METHOD(setIsoTuning) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setIsoTuning");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an object for setIsoTuning");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    IsoTuner::Options opts;
+    const std::string mode = stringOption(options, "mode", IsoTuner::modeName(opts.mode));
+    if (mode == "fixed") {
+        opts.mode = IsoTuner::Fixed;
+    } else if (mode == "auto") {
+        opts.mode = IsoTuner::Auto;
+    } else {
+        Nan::ThrowError("Iso tuning mode needs to be fixed or auto");
+        return;
+    }
+    opts.depth = static_cast<int>(numberOption(options, "depth", input->tuner.maxDepth()));
+    opts.packets = static_cast<int>(numberOption(options, "packets", input->tuner.maxPackets()));
+    opts.targetLatency = numberOption(options, "targetLatency", opts.targetLatency);
+    opts.interval = numberOption(options, "interval", opts.interval);
+    opts.errorRate = numberOption(options, "errorRate", opts.errorRate);
+    if (!IsoTuner::validate(opts, input->tuner.maxDepth(), input->tuner.maxPackets())) {
+        Nan::ThrowError("Invalid iso tuning options");
+        return;
+    }
+    input->tuner.setOptions(opts);
+}
+
+NAN_METHOD(setRecorder) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setRecorder");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    std::unique_ptr<FlightRecorder> recorder;
+    if (info.Length() >= 2 && info[1]->IsObject()) {
+        if (!input->opened) {
+            Nan::ThrowError("Need an open device for setRecorder");
+            return;
+        }
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+        FlightRecorder::Options opts;
+        opts.directory = stringOption(options, "directory", opts.directory);
+        opts.prefix = stringOption(options, "prefix", "uma8-" + std::to_string(input->bus) + "-" + std::to_string(input->port));
+        opts.before = numberOption(options, "before", opts.before);
+        opts.after = numberOption(options, "after", opts.after);
+        auto eventsKey = Nan::New<v8::String>("events").ToLocalChecked();
+        if (options->Has(eventsKey)) {
+            v8::Local<v8::Value> value = options->Get(eventsKey);
+            if (!value->IsArray()) {
+                Nan::ThrowError("Recorder events need to be an array of event names");
+                return;
+            }
+            v8::Local<v8::Array> events = v8::Local<v8::Array>::Cast(value);
+            opts.events.clear();
+            for (uint32_t i = 0; i < events->Length(); ++i) {
+                auto event = events->Get(i);
+                if (!event->IsString()) {
+                    Nan::ThrowError("Recorder events need to be an array of event names");
+                    return;
                 }
+                opts.events.push_back(*Nan::Utf8String(event));
             }
-            if (!input->pendingCancels)
-                break;
+        }
+        opts.vad = booleanOption(options, "vad", opts.vad);
+        opts.signals = booleanOption(options, "signals", opts.signals);
+        if (!FlightRecorder::validate(opts)) {
+            Nan::ThrowError("Invalid recorder options");
+            return;
+        }
+        // reports from the writer thread, js may be stuck by then
+        recorder.reset(new FlightRecorder(opts, [input](const FlightRecorder::Dump& dump) {
+                Event event("recorded");
+                event.add("path", dump.path);
+                event.add("reason", dump.reason);
+                event.add("position", static_cast<double>(dump.position));
+                event.add("frames", static_cast<double>(dump.frames));
+                if (!dump.error.empty())
+                    event.add("error", dump.error);
+                MutexLocker locker(&input->mutex);
+                input->events.push_back(event);
+                uv_async_send(&input->async);
+            }));
+        std::string error;
+        if (!recorder->start(&error)) {
+            Nan::ThrowError(error.c_str());
+            return;
         }
     }
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        input->recorder.swap(recorder);
+    }
+    // the old one joins its writer outside the lock. its reports only take
+    // input->mutex, which the drain doesn't hold while listeners run, so
+    // this is fine from a trigger or recorded listener
+    recorder.reset();
 }
 
-NAN_METHOD(create) {
-    Input* input = new Input;
-    if (!input->isValid()) {
-        Nan::ThrowError("Unable to initialize libusb");
-        delete input;
+NAN_METHOD(triggerRecorder) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for triggerRecorder");
         return;
     }
-    info.GetReturnValue().Set(input->makeObject());
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    const std::string reason = info.Length() >= 2 && info[1]->IsString() ? std::string(*Nan::Utf8String(info[1])) : std::string("js");
+    MutexLocker locker(&input->pipelineMutex);
+    if (input->recorder)
+        input->recorder->trigger(reason);
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(input->recorder != nullptr));
 }
 
-NAN_METHOD(open) {
+NAN_METHOD(setOccupancy) {
     if (info.Length() < 1 || !info[0]->IsObject()) {
-        Nan::ThrowError("Need an external to open");
+        Nan::ThrowError("Need an external for setOccupancy");
         return;
     }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
     if (info.Length() < 2 || !info[1]->IsObject()) {
-        Nan::ThrowError("Need an object to open");
+        MutexLocker locker(&input->pipelineMutex);
+        input->occupancy.reset();
+        return;
+    }
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    Occupancy::Options opts;
+    opts.interval = numberOption(options, "interval", opts.interval);
+    opts.sectors = static_cast<int>(numberOption(options, "sectors", opts.sectors));
+    opts.minDirection = numberOption(options, "minDirection", opts.minDirection);
+    if (!Occupancy::validate(opts)) {
+        Nan::ThrowError("Invalid occupancy options");
         return;
     }
+    MutexLocker locker(&input->pipelineMutex);
+    input->occupancy.reset(new Occupancy(opts));
+}
 
-    v8::Local<v8::Object> data = v8::Local<v8::Object>::Cast(info[1]);
-    auto busKey = Nan::New<v8::String>("bus").ToLocalChecked();
-    auto portKey = Nan::New<v8::String>("port").ToLocalChecked();
-    if (!data->Has(busKey)) {
-        Nan::ThrowError("Need a bus value");
+NAN_METHOD(setTimestamps) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for setTimestamps");
         return;
     }
-    if (!data->Has(portKey)) {
-        Nan::ThrowError("Need a port value");
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        MutexLocker locker(&input->pipelineMutex);
+        input->clock.reset();
         return;
     }
-    auto busValue = data->Get(busKey);
-    auto portValue = data->Get(portKey);
-    if (!busValue->IsUint32()) {
-        Nan::ThrowError("Bus needs to be an int");
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    ClockMapper::Options opts;
+    const std::string clock = stringOption(options, "clock", ClockMapper::clockName(opts.clock));
+    if (clock == "realtime") {
+        opts.clock = ClockMapper::Realtime;
+    } else if (clock == "tai") {
+        opts.clock = ClockMapper::Tai;
+    } else if (clock == "phc") {
+        opts.clock = ClockMapper::Phc;
+    } else {
+        Nan::ThrowError("Clock needs to be realtime, tai or phc");
         return;
     }
-    if (!portValue->IsUint32()) {
-        Nan::ThrowError("Port needs to be an int");
+    opts.device = stringOption(options, "device", opts.device);
+    opts.interval = numberOption(options, "interval", opts.interval);
+    if (!ClockMapper::validate(opts)) {
+        Nan::ThrowError("Invalid timestamp options");
+        return;
+    }
+    std::unique_ptr<ClockMapper> mapper(new ClockMapper(opts));
+    std::string error;
+    if (!mapper->start(&error)) {
+        Nan::ThrowError(error.c_str());
         return;
     }
+    MutexLocker locker(&input->pipelineMutex);
+    input->clock = std::move(mapper);
+}
 
+NAN_METHOD(stats) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for stats");
+        return;
+    }
     Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
-    if (!input->open(v8::Local<v8::Uint32>::Cast(busValue)->Value(), v8::Local<v8::Uint32>::Cast(portValue)->Value())) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    v8::Local<v8::Array> sinks = Nan::New<v8::Array>();
+    {
+        MutexLocker locker(&input->pipelineMutex);
+        obj->Set(Nan::New<v8::String>("frames").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(input->pipeline.position())));
+        for (size_t i = 0; i < input->sinks.size(); ++i) {
+            const FdSink& sink = *input->sinks[i];
+            const FdSink::Stats st = input->sinks[i]->stats();
+            v8::Local<v8::Object> s = Nan::New<v8::Object>();
+            s->Set(Nan::New<v8::String>("fd").ToLocalChecked(), Nan::New<v8::Int32>(sink.options().fd));
+            s->Set(Nan::New<v8::String>("format").ToLocalChecked(), Nan::New<v8::String>(SampleFormat::typeName(sink.options().format.type)).ToLocalChecked());
+            s->Set(Nan::New<v8::String>("bytesWritten").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.bytesWritten)));
+            s->Set(Nan::New<v8::String>("writes").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.writes)));
+            s->Set(Nan::New<v8::String>("overruns").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.overruns)));
+            s->Set(Nan::New<v8::String>("droppedBytes").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.droppedBytes)));
+            s->Set(Nan::New<v8::String>("backpressure").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.backpressure)));
+            s->Set(Nan::New<v8::String>("fill").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.fill)));
+            s->Set(Nan::New<v8::String>("maxFill").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.maxFill)));
+            if (!st.error.empty())
+                s->Set(Nan::New<v8::String>("error").ToLocalChecked(), Nan::New<v8::String>(st.error).ToLocalChecked());
+            s->Set(Nan::New<v8::String>("thread").ToLocalChecked(), threadUsage(st.cpu));
+            sinks->Set(i, s);
+        }
+        v8::Local<v8::Array> graph = Nan::New<v8::Array>();
+        const std::vector<Graph::NodeStats> nodes = input->pipeline.stats();
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            v8::Local<v8::Object> n = callTotals(nodes[i].time);
+            n->Set(Nan::New<v8::String>("id").ToLocalChecked(), Nan::New<v8::String>(nodes[i].id).ToLocalChecked());
+            n->Set(Nan::New<v8::String>("type").ToLocalChecked(), Nan::New<v8::String>(NodeSpec::typeName(nodes[i].type)).ToLocalChecked());
+            if (!nodes[i].fusedInto.empty())
+                n->Set(Nan::New<v8::String>("fusedInto").ToLocalChecked(), Nan::New<v8::String>(nodes[i].fusedInto).ToLocalChecked());
+            graph->Set(i, n);
+        }
+        obj->Set(Nan::New<v8::String>("graph").ToLocalChecked(), graph);
+        v8::Local<v8::Array> rtp = Nan::New<v8::Array>();
+        for (size_t i = 0; i < input->rtpSinks.size(); ++i) {
+            const RtpSink& sink = *input->rtpSinks[i];
+            const RtpSink::Stats st = input->rtpSinks[i]->stats();
+            v8::Local<v8::Object> s = Nan::New<v8::Object>();
+            s->Set(Nan::New<v8::String>("host").ToLocalChecked(), Nan::New<v8::String>(sink.options().host).ToLocalChecked());
+            s->Set(Nan::New<v8::String>("port").ToLocalChecked(), Nan::New<v8::Int32>(sink.options().port));
+            s->Set(Nan::New<v8::String>("payload").ToLocalChecked(), Nan::New<v8::String>(RtpSink::payloadName(sink.options().payload)).ToLocalChecked());
+            s->Set(Nan::New<v8::String>("ssrc").ToLocalChecked(), Nan::New<v8::Uint32>(st.ssrc));
+            s->Set(Nan::New<v8::String>("packets").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.packets)));
+            s->Set(Nan::New<v8::String>("bytes").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.bytes)));
+            s->Set(Nan::New<v8::String>("sends").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.sends)));
+            s->Set(Nan::New<v8::String>("packetsPerSecond").ToLocalChecked(), Nan::New<v8::Number>(st.packetsPerSecond));
+            s->Set(Nan::New<v8::String>("sendErrors").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.sendErrors)));
+            s->Set(Nan::New<v8::String>("overruns").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.overruns)));
+            s->Set(Nan::New<v8::String>("fill").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.fill)));
+            s->Set(Nan::New<v8::String>("maxFill").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.maxFill)));
+            if (!st.error.empty())
+                s->Set(Nan::New<v8::String>("error").ToLocalChecked(), Nan::New<v8::String>(st.error).ToLocalChecked());
+            s->Set(Nan::New<v8::String>("thread").ToLocalChecked(), threadUsage(st.cpu));
+            rtp->Set(i, s);
+        }
+        obj->Set(Nan::New<v8::String>("rtp").ToLocalChecked(), rtp);
+        if (input->recorder) {
+            const FlightRecorder::Options& opts = input->recorder->options();
+            const FlightRecorder::Stats st = input->recorder->stats();
+            v8::Local<v8::Object> r = Nan::New<v8::Object>();
+            r->Set(Nan::New<v8::String>("directory").ToLocalChecked(), Nan::New<v8::String>(opts.directory).ToLocalChecked());
+            r->Set(Nan::New<v8::String>("before").ToLocalChecked(), Nan::New<v8::Number>(opts.before));
+            r->Set(Nan::New<v8::String>("after").ToLocalChecked(), Nan::New<v8::Number>(opts.after));
+            r->Set(Nan::New<v8::String>("signals").ToLocalChecked(), Nan::New<v8::Boolean>(opts.signals));
+            r->Set(Nan::New<v8::String>("dumps").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.dumps)));
+            r->Set(Nan::New<v8::String>("coalesced").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.coalesced)));
+            r->Set(Nan::New<v8::String>("failed").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.failed)));
+            r->Set(Nan::New<v8::String>("pending").ToLocalChecked(), Nan::New<v8::Boolean>(st.pending));
+            r->Set(Nan::New<v8::String>("thread").ToLocalChecked(), threadUsage(st.cpu));
+            obj->Set(Nan::New<v8::String>("recorder").ToLocalChecked(), r);
+        }
+        v8::Local<v8::Array> taps = Nan::New<v8::Array>();
+        uint32_t t = 0;
+        for (const auto& tap : input->pipeline.taps()) {
+            const Tap::Stats st = tap.second->stats();
+            v8::Local<v8::Object> o = Nan::New<v8::Object>();
+            o->Set(Nan::New<v8::String>("name").ToLocalChecked(), Nan::New<v8::String>(tap.first).ToLocalChecked());
+            o->Set(Nan::New<v8::String>("format").ToLocalChecked(), Nan::New<v8::String>(tap.second->format()).ToLocalChecked());
+            if (!tap.second->options().path.empty())
+                o->Set(Nan::New<v8::String>("path").ToLocalChecked(), Nan::New<v8::String>(tap.second->options().path).ToLocalChecked());
+            o->Set(Nan::New<v8::String>("bytes").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.bytes)));
+            o->Set(Nan::New<v8::String>("dropped").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.dropped)));
+            o->Set(Nan::New<v8::String>("buffered").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.buffered)));
+            if (!tap.second->options().path.empty())
+                o->Set(Nan::New<v8::String>("thread").ToLocalChecked(), threadUsage(st.cpu));
+            taps->Set(t++, o);
+        }
+        obj->Set(Nan::New<v8::String>("taps").ToLocalChecked(), taps);
+        if (input->clock) {
+            const ClockMapper::Stats st = input->clock->stats();
+            v8::Local<v8::Object> c = Nan::New<v8::Object>();
+            c->Set(Nan::New<v8::String>("clock").ToLocalChecked(), Nan::New<v8::String>(ClockMapper::clockName(input->clock->options().clock)).ToLocalChecked());
+            c->Set(Nan::New<v8::String>("samples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.samples)));
+            c->Set(Nan::New<v8::String>("steps").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(st.steps)));
+            c->Set(Nan::New<v8::String>("offset").ToLocalChecked(), Nan::New<v8::Number>(st.offset / 1e6));
+            c->Set(Nan::New<v8::String>("drift").ToLocalChecked(), Nan::New<v8::Number>(st.drift));
+            c->Set(Nan::New<v8::String>("jitter").ToLocalChecked(), Nan::New<v8::Number>(st.jitter / 1e3));
+            c->Set(Nan::New<v8::String>("window").ToLocalChecked(), Nan::New<v8::Number>(st.window / 1e3));
+            obj->Set(Nan::New<v8::String>("clock").ToLocalChecked(), c);
+        }
+    }
+    obj->Set(Nan::New<v8::String>("sinks").ToLocalChecked(), sinks);
+
+    Delivery::Stats delivery;
+    SampleFormat audioFormat;
+    {
+        MutexLocker locker(&input->mutex);
+        delivery = input->delivery.stats();
+        audioFormat = input->audioFormat;
+    }
+    v8::Local<v8::Object> d = Nan::New<v8::Object>();
+    d->Set(Nan::New<v8::String>("mode").ToLocalChecked(), Nan::New<v8::String>(Delivery::modeName(delivery.mode)).ToLocalChecked());
+    d->Set(Nan::New<v8::String>("batch").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(delivery.batch)));
+    d->Set(Nan::New<v8::String>("deadline").ToLocalChecked(), Nan::New<v8::Number>(delivery.deadline));
+    d->Set(Nan::New<v8::String>("targetLatency").ToLocalChecked(), Nan::New<v8::Number>(delivery.targetLatency));
+    d->Set(Nan::New<v8::String>("lag").ToLocalChecked(), Nan::New<v8::Number>(delivery.lag));
+    d->Set(Nan::New<v8::String>("drain").ToLocalChecked(), Nan::New<v8::Number>(delivery.drain));
+    d->Set(Nan::New<v8::String>("latency").ToLocalChecked(), Nan::New<v8::Number>(delivery.latency));
+    d->Set(Nan::New<v8::String>("period").ToLocalChecked(), Nan::New<v8::Number>(delivery.period));
+    d->Set(Nan::New<v8::String>("callbacksPerSecond").ToLocalChecked(), Nan::New<v8::Number>(delivery.callbacksPerSecond));
+    d->Set(Nan::New<v8::String>("chunksPerCallback").ToLocalChecked(), Nan::New<v8::Number>(delivery.chunksPerCallback));
+    d->Set(Nan::New<v8::String>("format").ToLocalChecked(), Nan::New<v8::String>(SampleFormat::typeName(audioFormat.type)).ToLocalChecked());
+    obj->Set(Nan::New<v8::String>("delivery").ToLocalChecked(), d);
+
+    const IsoTuner::Stats tuning = input->tuner.stats();
+    v8::Local<v8::Object> iso = Nan::New<v8::Object>();
+    iso->Set(Nan::New<v8::String>("mode").ToLocalChecked(), Nan::New<v8::String>(IsoTuner::modeName(tuning.mode)).ToLocalChecked());
+    iso->Set(Nan::New<v8::String>("depth").ToLocalChecked(), Nan::New<v8::Int32>(tuning.geometry.depth));
+    iso->Set(Nan::New<v8::String>("packets").ToLocalChecked(), Nan::New<v8::Int32>(tuning.geometry.packets));
+    iso->Set(Nan::New<v8::String>("latency").ToLocalChecked(), Nan::New<v8::Number>(tuning.geometry.packets * IsoTuner::PacketNs / 1e6));
+    iso->Set(Nan::New<v8::String>("inFlight").ToLocalChecked(), Nan::New<v8::Int32>(input->iso.inFlight.load()));
+    iso->Set(Nan::New<v8::String>("adjustments").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(tuning.adjustments)));
+    iso->Set(Nan::New<v8::String>("errorRate").ToLocalChecked(), Nan::New<v8::Number>(tuning.errorRate));
+    iso->Set(Nan::New<v8::String>("maxGap").ToLocalChecked(), Nan::New<v8::Number>(tuning.maxGap));
+    obj->Set(Nan::New<v8::String>("iso").ToLocalChecked(), iso);
+
+    v8::Local<v8::Object> threads = Nan::New<v8::Object>();
+    threads->Set(Nan::New<v8::String>("usb").ToLocalChecked(), threadUsage(input->usbCpu.usage()));
+    obj->Set(Nan::New<v8::String>("threads").ToLocalChecked(), threads);
+    v8::Local<v8::Object> callbacks = Nan::New<v8::Object>();
+    callbacks->Set(Nan::New<v8::String>("transfer").ToLocalChecked(), callTotals(input->transferTime.totals()));
+    callbacks->Set(Nan::New<v8::String>("irq").ToLocalChecked(), callTotals(input->irqTime.totals()));
+    callbacks->Set(Nan::New<v8::String>("drain").ToLocalChecked(), callTotals(input->drainTime.totals()));
+    obj->Set(Nan::New<v8::String>("callbacks").ToLocalChecked(), callbacks);
+    if (input->opened) {
+        // ms since opening started
+        v8::Local<v8::Object> startup = Nan::New<v8::Object>();
+        const uint64_t times[] = { input->claimed, input->prepared, input->submitted, input->firstCallback.load(std::memory_order_relaxed),
+                                   input->firstAudio.load(std::memory_order_relaxed), input->firstDelivery };
+        const char* names[] = { "claim", "prepare", "submitted", "firstCallback", "firstAudio", "firstDelivery" };
+        for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); ++i) {
+            // the ones that haven't happened yet are left out
+            if (times[i])
+                startup->Set(Nan::New<v8::String>(names[i]).ToLocalChecked(), Nan::New<v8::Number>((times[i] - input->openStarted) / 1e6));
+        }
+        obj->Set(Nan::New<v8::String>("startup").ToLocalChecked(), startup);
+    }
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(getReport) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for getReport");
+        return;
+    }
+    if (info.Length() < 4 || !info[1]->IsString() || !info[2]->IsUint32() || !info[3]->IsUint32()) {
+        Nan::ThrowError("Need a type, id and length for getReport");
         return;
     }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (!input->opened) {
+        Nan::ThrowError("Device is not open");
+        return;
+    }
+    HidReports::Type type;
+    if (!reportType(*Nan::Utf8String(info[1]), &type))
+        return;
+    const uint32_t id = v8::Local<v8::Uint32>::Cast(info[2])->Value();
+    const uint32_t length = v8::Local<v8::Uint32>::Cast(info[3])->Value();
+    if (id > 255 || !length || length > 4096) {
+        Nan::ThrowError("Invalid report id or length");
+        return;
+    }
+    std::vector<uint8_t> data;
+    HidReports reports(input->handle, Input::HidIfaceNum);
+    const int ret = reports.get(type, id, length, &data);
+    if (ret < 0) {
+        Nan::ThrowError((std::string("Can't get report: ") + libusb_error_name(ret)).c_str());
+        return;
+    }
+    info.GetReturnValue().Set(Nan::CopyBuffer(reinterpret_cast<const char*>(data.data()), data.size()).ToLocalChecked());
 }
 
-NAN_METHOD(enumerate) {
+NAN_METHOD(setReport) {
     if (info.Length() < 1 || !info[0]->IsObject()) {
-        Nan::ThrowError("Need an external to enumerate");
+        Nan::ThrowError("Need an external for setReport");
+        return;
+    }
+    if (info.Length() < 4 || !info[1]->IsString() || !info[2]->IsUint32() || !node::Buffer::HasInstance(info[3])) {
+        Nan::ThrowError("Need a type, id and buffer for setReport");
         return;
     }
     Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
-    libusb_device** list;
-    ssize_t devices = libusb_get_device_list(input->usb, &list);
-    if (devices < 0) {
-        // error
-        Nan::ThrowError("Error getting devices");
+    if (!input->opened) {
+        Nan::ThrowError("Device is not open");
         return;
     }
+    HidReports::Type type;
+    if (!reportType(*Nan::Utf8String(info[1]), &type))
+        return;
+    const uint32_t id = v8::Local<v8::Uint32>::Cast(info[2])->Value();
+    if (id > 255) {
+        Nan::ThrowError("Invalid report id");
+        return;
+    }
+    HidReports reports(input->handle, Input::HidIfaceNum);
+    const int ret = reports.set(type, id, reinterpret_cast<const uint8_t*>(node::Buffer::Data(info[3])), node::Buffer::Length(info[3]));
+    if (ret < 0) {
+        Nan::ThrowError((std::string("Can't set report: ") + libusb_error_name(ret)).c_str());
+        return;
+    }
+    info.GetReturnValue().Set(Nan::New<v8::Int32>(ret));
+}
+
+NAN_METHOD(applyReports) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need an external for applyReports");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsArray()) {
+        Nan::ThrowError("Need an array of reports for applyReports");
+        return;
+    }
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
+    if (!input->opened) {
+        Nan::ThrowError("Device is not open");
+        return;
+    }
+    std::vector<HidReports::Report> list;
+    if (!reportList(v8::Local<v8::Array>::Cast(info[1]), &list))
+        return;
+    bool verify = true;
+    if (info.Length() >= 3 && info[2]->IsObject())
+        verify = booleanOption(v8::Local<v8::Object>::Cast(info[2]), "verify", verify);
+
+    HidReports reports(input->handle, Input::HidIfaceNum);
+    const std::vector<HidReports::Result> results = reports.apply(list, verify);
     v8::Local<v8::Array> array = Nan::New<v8::Array>();
-    int pos = 0;
-    for (ssize_t i = 0; i < devices; ++i) {
-        libusb_device* dev = list[i];
-        libusb_device_descriptor desc;
-        int ret = libusb_get_device_descriptor(dev, &desc);
-        if (ret != 0) {
-            // error
-            continue;
-        }
-        if (desc.idVendor == Input::Vid && desc.idProduct == Input::Pid) {
-            const uint8_t bus = libusb_get_bus_number(dev);
-            const uint8_t port = libusb_get_port_number(dev);
-            v8::Local<v8::Object> device = Nan::New<v8::Object>();
-            device->Set(Nan::New<v8::String>("bus").ToLocalChecked(), Nan::New<v8::Uint32>(bus));
-            device->Set(Nan::New<v8::String>("port").ToLocalChecked(), Nan::New<v8::Uint32>(port));
-            array->Set(pos++, device);
-            //printf("found %u %u\n", bus, port);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const HidReports::Result& result = results[i];
+        v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+        obj->Set(Nan::New<v8::String>("id").ToLocalChecked(), Nan::New<v8::Uint32>(result.id));
+        obj->Set(Nan::New<v8::String>("written").ToLocalChecked(), Nan::New<v8::Int32>(std::max(result.written, 0)));
+        obj->Set(Nan::New<v8::String>("verified").ToLocalChecked(), Nan::New<v8::Boolean>(result.verified));
+        if (!result.readback.empty()) {
+            obj->Set(Nan::New<v8::String>("readback").ToLocalChecked(),
+                     Nan::CopyBuffer(reinterpret_cast<const char*>(result.readback.data()), result.readback.size()).ToLocalChecked());
         }
+        if (!result.error.empty())
+            obj->Set(Nan::New<v8::String>("error").ToLocalChecked(), Nan::New<v8::String>(result.error).ToLocalChecked());
+        array->Set(i, obj);
     }
-    libusb_free_device_list(list, 1);
     info.GetReturnValue().Set(array);
 }
 
-NAN_METHOD(on) {
-    if (info.Length() < 1 || !info[0]->IsObject()) {
-        Nan::ThrowError("Need an external for on");
+NAN_METHOD(exportMetrics) {
+    // replacing or stopping, either way the old one goes first
+    exporter.reset();
+    if (info.Length() < 1 || !info[0]->IsObject())
         return;
-    }
-    if (info.Length() < 2 || !info[1]->IsString()) {
-        Nan::ThrowError("Need a string for on");
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+    TextfileExporter::Options opts;
+    opts.path = stringOption(options, "path", opts.path);
+    opts.interval = numberOption(options, "interval", opts.interval);
+    const std::string format = stringOption(options, "format", "prometheus");
+    if (format == "openmetrics") {
+        opts.openMetrics = true;
+    } else if (format != "prometheus") {
+        Nan::ThrowError("Metrics format needs to be prometheus or openmetrics");
         return;
     }
-    if (info.Length() < 3 || !info[2]->IsFunction()) {
-        Nan::ThrowError("Need a function for on");
+    if (!TextfileExporter::validate(opts)) {
+        Nan::ThrowError("Invalid metrics exporter options");
         return;
     }
-    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
-    const std::string name = *Nan::Utf8String(info[1]);
-    input->ons[name].push_back(std::make_shared<Nan::Callback>(v8::Local<v8::Function>::Cast(info[2])));
+    exporter.reset(new TextfileExporter(opts, collectMetrics));
+    exporter->start();
 }
 
-NAN_METHOD(removeListener) {
+NAN_METHOD(exporterStatus) {
+    if (!exporter)
+        return;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    obj->Set(Nan::New<v8::String>("path").ToLocalChecked(), Nan::New<v8::String>(exporter->options().path).ToLocalChecked());
+    obj->Set(Nan::New<v8::String>("writes").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(exporter->writes())));
+    const std::string error = exporter->error();
+    if (!error.empty())
+        obj->Set(Nan::New<v8::String>("error").ToLocalChecked(), Nan::New<v8::String>(error).ToLocalChecked());
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(batch) {
     if (info.Length() < 1 || !info[0]->IsObject()) {
-        Nan::ThrowError("Need an external for removeListener");
+        Nan::ThrowError("Need an object for batch");
         return;
     }
-    if (info.Length() < 2 || !info[1]->IsString()) {
-        Nan::ThrowError("Need a string for removeListener");
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+    Batch::Options opts;
+    auto filesKey = Nan::New<v8::String>("files").ToLocalChecked();
+    if (!options->Has(filesKey) || !options->Get(filesKey)->IsArray()) {
+        Nan::ThrowError("Need an array of files for batch");
         return;
     }
-    if (info.Length() < 3 || !info[2]->IsFunction()) {
-        Nan::ThrowError("Need a function for removeListener");
+    v8::Local<v8::Array> files = v8::Local<v8::Array>::Cast(options->Get(filesKey));
+    for (uint32_t i = 0; i < files->Length(); ++i) {
+        auto file = files->Get(i);
+        if (!file->IsString()) {
+            Nan::ThrowError("Batch files need to be strings");
+            return;
+        }
+        opts.files.push_back(*Nan::Utf8String(file));
+    }
+    opts.output = stringOption(options, "output", std::string());
+    if (opts.output.empty()) {
+        Nan::ThrowError("Need an output directory for batch");
         return;
     }
-    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
-    const std::string name = *Nan::Utf8String(info[1]);
-    auto listeners = input->ons.find(name);
-    if (listeners == input->ons.end()) {
-        info.GetReturnValue().Set(Nan::New<v8::Boolean>(false));
+    opts.threads = numberOption(options, "threads", opts.threads);
+    opts.raw = booleanOption(options, "raw", opts.raw);
+    if (!pipelineSettings(options, &opts.settings))
+        return;
+
+    BatchJob* job = new BatchJob(opts);
+    v8::Local<v8::Object> obj = job->makeObject();
+    job->start();
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(batchCancel) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need a batch to cancel");
         return;
     }
+    BatchJob* job = BatchJob::Unwrap<BatchJob>(v8::Local<v8::Object>::Cast(info[0]));
+    job->batch.cancel();
+}
 
-    Nan::Callback cur(v8::Local<v8::Function>::Cast(info[2]));
-    auto& listenerList = listeners->second;
-    auto listener = listenerList.rbegin();
-    const auto end = listenerList.rend();
-    while (listener != end) {
-        if (*listener && **listener == cur) {
-            // got it
-            listenerList.erase(std::next(listener).base());
-            if (listenerList.empty()) {
-                input->ons.erase(name);
-            }
-            info.GetReturnValue().Set(Nan::New<v8::Boolean>(true));
+NAN_METHOD(createSelector) {
+    Selector* selector = new Selector;
+    if (info.Length() >= 1 && info[0]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+        ArraySelector::Options opts;
+        opts.snrWeight = numberOption(options, "snrWeight", opts.snrWeight);
+        opts.vadWeight = numberOption(options, "vadWeight", opts.vadWeight);
+        opts.doaWeight = numberOption(options, "doaWeight", opts.doaWeight);
+        opts.margin = numberOption(options, "margin", opts.margin);
+        opts.holdTime = numberOption(options, "holdTime", opts.holdTime);
+        opts.crossfade = numberOption(options, "crossfade", opts.crossfade);
+        opts.timeConstant = numberOption(options, "timeConstant", opts.timeConstant);
+        if (opts.timeConstant <= 0 || opts.crossfade < 0 || opts.holdTime < 0) {
+            delete selector;
+            Nan::ThrowError("Invalid selector options");
             return;
         }
-        ++listener;
+        selector->selector.setOptions(opts);
     }
-    info.GetReturnValue().Set(Nan::New<v8::Boolean>(false));
+    info.GetReturnValue().Set(selector->makeObject());
 }
 
-NAN_METHOD(removeAllListeners) {
+NAN_METHOD(selectorAdd) {
     if (info.Length() < 1 || !info[0]->IsObject()) {
-        Nan::ThrowError("Need an external for removeAllListeners");
+        Nan::ThrowError("Need a selector to add to");
         return;
     }
-    if (info.Length() < 2 || !info[1]->IsString()) {
-        Nan::ThrowError("Need a string for removeAllListeners");
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an external to add");
         return;
     }
-    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[0]));
-    const std::string name = *Nan::Utf8String(info[1]);
-    auto listeners = input->ons.find(name);
-    if (listeners != input->ons.end()) {
-        input->ons.erase(listeners);
-        info.GetReturnValue().Set(Nan::New<v8::Boolean>(true));
-    } else {
+    Selector* selector = Selector::Unwrap<Selector>(v8::Local<v8::Object>::Cast(info[0]));
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[1]));
+    selector->attach(input);
+    MutexLocker locker(&selector->mutex);
+    info.GetReturnValue().Set(Nan::New<v8::Int32>(selector->sources[input]));
+}
+
+NAN_METHOD(selectorRemove) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need a selector to remove from");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowError("Need an external to remove");
+        return;
+    }
+    Selector* selector = Selector::Unwrap<Selector>(v8::Local<v8::Object>::Cast(info[0]));
+    Input* input = Input::Unwrap<Input>(v8::Local<v8::Object>::Cast(info[1]));
+    if (input->selector != selector) {
         info.GetReturnValue().Set(Nan::New<v8::Boolean>(false));
+        return;
+    }
+    selector->detach(input);
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(true));
+}
+
+NAN_METHOD(selectorScores) {
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowError("Need a selector for scores");
+        return;
     }
+    Selector* selector = Selector::Unwrap<Selector>(v8::Local<v8::Object>::Cast(info[0]));
+    MutexLocker locker(&selector->mutex);
+    const int selected = selector->selector.selected();
+    v8::Local<v8::Array> array = Nan::New<v8::Array>();
+    int pos = 0;
+    for (const ArraySelector::Score& score : selector->selector.scores()) {
+        v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+        obj->Set(Nan::New<v8::String>("source").ToLocalChecked(), Nan::New<v8::Int32>(score.source));
+        obj->Set(Nan::New<v8::String>("selected").ToLocalChecked(), Nan::New<v8::Boolean>(score.source == selected));
+        obj->Set(Nan::New<v8::String>("score").ToLocalChecked(), Nan::New<v8::Number>(score.score));
+        obj->Set(Nan::New<v8::String>("snr").ToLocalChecked(), Nan::New<v8::Number>(score.snr));
+        obj->Set(Nan::New<v8::String>("vad").ToLocalChecked(), Nan::New<v8::Number>(score.vad));
+        obj->Set(Nan::New<v8::String>("stability").ToLocalChecked(), Nan::New<v8::Number>(score.stability));
+        array->Set(pos++, obj);
+    }
+    info.GetReturnValue().Set(array);
 }
 
 NAN_MODULE_INIT(Initialize) {
     NAN_EXPORT(target, create);
     NAN_EXPORT(target, open);
     NAN_EXPORT(target, enumerate);
+    NAN_EXPORT(target, openAll);
     NAN_EXPORT(target, on);
     NAN_EXPORT(target, removeListener);
     NAN_EXPORT(target, removeAllListeners);
+    NAN_EXPORT(target, setPreview);
+    NAN_EXPORT(target, setTriggers);
+    NAN_EXPORT(target, setHealth);
+    NAN_EXPORT(target, setLoudness);
+    NAN_EXPORT(target, setGraph);
+    NAN_EXPORT(target, tap);
+    NAN_EXPORT(target, untap);
+    NAN_EXPORT(target, readTap);
+    NAN_EXPORT(target, getLatestMetadata);
+    NAN_EXPORT(target, setMetadataHistory);
+    NAN_EXPORT(target, metadataHistory);
+    NAN_EXPORT(target, metadataSummary);
+    NAN_EXPORT(target, loudness);
+    NAN_EXPORT(target, resetLoudness);
+    NAN_EXPORT(target, pipe);
+    NAN_EXPORT(target, unpipe);
+    NAN_EXPORT(target, streamRtp);
+    NAN_EXPORT(target, stopRtp);
+    NAN_EXPORT(target, setDelivery);
+    NAN_EXPORT(target, setAudioFormat);
+    NAN_EXPORT(target, setTimestamps);
+    NAN_EXPORT(target, setIsoTuning);
+    NAN_EXPORT(target, setRecorder);
+    NAN_EXPORT(target, triggerRecorder);
+    NAN_EXPORT(target, setOccupancy);
+    NAN_EXPORT(target, stats);
+    NAN_EXPORT(target, getReport);
+    NAN_EXPORT(target, setReport);
+    NAN_EXPORT(target, applyReports);
+    NAN_EXPORT(target, exportMetrics);
+    NAN_EXPORT(target, exporterStatus);
+    NAN_EXPORT(target, batch);
+    NAN_EXPORT(target, batchCancel);
+    NAN_EXPORT(target, createSelector);
+    NAN_EXPORT(target, selectorAdd);
+    NAN_EXPORT(target, selectorRemove);
+    NAN_EXPORT(target, selectorScores);
 }
 
 NODE_MODULE(uma8, Initialize)
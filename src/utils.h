@@ -1,9 +1,23 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <nan.h>
-#include <queue>
+#include <uv.h>
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <utility>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
 
 #define EINTRWRAP(var, op)                      \
     do {                                        \
@@ -94,43 +108,391 @@ private:
     uv_cond_t mCond;
 };
 
+enum { CacheLineSize = 64 };
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// bounded lock free queue for exactly one producer and one consumer thread.
+// capacity is rounded up to a power of two
 template<typename T>
-class Queue
+class SpscQueue
 {
 public:
-    Queue()
+    SpscQueue(size_t capacity)
+        : mCapacity(roundUp(capacity)), mMask(mCapacity - 1), mSlots(new T[mCapacity])
+    {
+        mHead.store(0, std::memory_order_relaxed);
+        mTail.store(0, std::memory_order_relaxed);
+        mCachedHead = mCachedTail = 0;
+    }
+
+    ~SpscQueue()
+    {
+        delete[] mSlots;
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+    // approximate unless called from the producer or the consumer. the tail
+    // goes first, a head read after it can't be behind it
+    size_t size() const
+    {
+        const size_t tail = mTail.load(std::memory_order_acquire);
+        const size_t head = mHead.load(std::memory_order_acquire);
+        return head > tail ? std::min(head - tail, mCapacity) : 0;
+    }
+
+    // producer only, returns false if full
+    bool push(T&& t)
+    {
+        const size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mCachedTail == mCapacity) {
+            mCachedTail = mTail.load(std::memory_order_acquire);
+            if (head - mCachedTail == mCapacity)
+                return false;
+        }
+        mSlots[head & mMask] = std::move(t);
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(const T& t)
+    {
+        T copy(t);
+        return push(std::move(copy));
+    }
+
+    // consumer only, returns false if empty
+    bool pop(T* t)
+    {
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mCachedHead) {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if (tail == mCachedHead)
+                return false;
+        }
+        *t = std::move(mSlots[tail & mMask]);
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only, the oldest element or null
+    T* front()
     {
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire))
+            return nullptr;
+        return &mSlots[tail & mMask];
     }
 
-    ~Queue()
+private:
+    static size_t roundUp(size_t v)
     {
+        size_t ret = 2;
+        while (ret < v)
+            ret <<= 1;
+        return ret;
     }
 
-    void push(T&& t)
+    const size_t mCapacity, mMask;
+    T* const mSlots;
+    // the producer and the consumer each get their own cache line
+    alignas(CacheLineSize) std::atomic<size_t> mHead;
+    size_t mCachedTail;
+    alignas(CacheLineSize) std::atomic<size_t> mTail;
+    size_t mCachedHead;
+};
+
+// bounded lock free queue for any number of producers and one consumer,
+// each slot carries a sequence number (vyukov). capacity is rounded up to a
+// power of two
+template<typename T>
+class MpscQueue
+{
+public:
+    MpscQueue(size_t capacity)
+        : mCapacity(roundUp(capacity)), mMask(mCapacity - 1), mSlots(new Slot[mCapacity])
     {
-        MutexLocker locker(&mMutex);
-        mContainer.push(std::forward<T>(t));
+        for (size_t i = 0; i < mCapacity; ++i)
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        mHead.store(0, std::memory_order_relaxed);
+        mTail = 0;
     }
 
-    T pop(bool* ok = 0)
+    ~MpscQueue()
     {
-        MutexLocker locker(&mMutex);
-        if (!mContainer.empty()) {
-            if (ok)
-                *ok = true;
-            const T t = std::move(mContainer.back());
-            mContainer.pop();
-            return t;
+        delete[] mSlots;
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+    // any thread, returns false if full
+    bool push(T&& t)
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = mSlots[head & mMask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(head);
+            if (diff == 0) {
+                if (mHead.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(t);
+                    slot.sequence.store(head + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                head = mHead.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool push(const T& t)
+    {
+        T copy(t);
+        return push(std::move(copy));
+    }
+
+    // consumer only, returns false if empty
+    bool pop(T* t)
+    {
+        Slot& slot = mSlots[mTail & mMask];
+        const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(mTail + 1) < 0)
+            return false;
+        *t = std::move(slot.value);
+        slot.sequence.store(mTail + mCapacity, std::memory_order_release);
+        ++mTail;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUp(size_t v)
+    {
+        size_t ret = 2;
+        while (ret < v)
+            ret <<= 1;
+        return ret;
+    }
+
+    const size_t mCapacity, mMask;
+    Slot* const mSlots;
+    alignas(CacheLineSize) std::atomic<size_t> mHead;
+    alignas(CacheLineSize) size_t mTail;
+};
+
+// wakes up a thread that's waiting in poll(). eventfd on linux, a pipe elsewhere
+class Notifier
+{
+public:
+    Notifier()
+    {
+#ifdef __linux__
+        mFds[0] = mFds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        if (::pipe(mFds) == 0) {
+            for (int i = 0; i < 2; ++i) {
+                fcntl(mFds[i], F_SETFL, fcntl(mFds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(mFds[i], F_SETFD, FD_CLOEXEC);
+            }
         } else {
-            if (ok)
-                *ok = false;
-            return T();
+            mFds[0] = mFds[1] = -1;
         }
+#endif
+    }
+
+    ~Notifier()
+    {
+        if (mFds[0] != -1)
+            ::close(mFds[0]);
+        if (mFds[1] != mFds[0] && mFds[1] != -1)
+            ::close(mFds[1]);
+    }
+
+    bool isValid() const { return mFds[0] != -1; }
+
+    // the fd to poll for POLLIN
+    int fd() const { return mFds[0]; }
+
+    void notify()
+    {
+        ssize_t ret;
+#ifdef __linux__
+        const uint64_t one = 1;
+        EINTRWRAP(ret, ::write(mFds[1], &one, sizeof(one)));
+#else
+        const char one = 1;
+        EINTRWRAP(ret, ::write(mFds[1], &one, sizeof(one)));
+#endif
+        (void)ret;
+    }
+
+    // clears pending notifications
+    void drain()
+    {
+        uint64_t buf[16];
+        ssize_t ret;
+        do {
+            EINTRWRAP(ret, ::read(mFds[0], buf, sizeof(buf)));
+        } while (ret == static_cast<ssize_t>(sizeof(buf)));
+    }
+
+    // waits up to timeout ms (-1 for ever), returns true if notified
+    bool wait(int timeout)
+    {
+        pollfd pfd = { mFds[0], POLLIN, 0 };
+        int ret;
+        EINTRWRAP(ret, poll(&pfd, 1, timeout));
+        if (ret <= 0)
+            return false;
+        drain();
+        return true;
+    }
+
+private:
+    int mFds[2];
+};
+
+// spins for a while before parking the thread, for short critical sections
+// shared between the usb thread and others. parks on a futex on linux and
+// yields elsewhere
+class SpinLock
+{
+public:
+    SpinLock()
+    {
+        mState.store(Unlocked, std::memory_order_relaxed);
+    }
+
+    void lock()
+    {
+        int expected = Unlocked;
+        for (int i = 0; i < SpinCount; ++i) {
+            if (mState.load(std::memory_order_relaxed) == Unlocked
+                && mState.compare_exchange_weak(expected, Locked, std::memory_order_acquire)) {
+                return;
+            }
+            expected = Unlocked;
+            cpuRelax();
+        }
+        // mark as contended so unlock knows to wake someone up
+        while (mState.exchange(Contended, std::memory_order_acquire) != Unlocked) {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&mState), FUTEX_WAIT_PRIVATE, Contended, nullptr, nullptr, 0);
+#else
+            sched_yield();
+#endif
+        }
+    }
+
+    bool tryLock()
+    {
+        int expected = Unlocked;
+        return mState.compare_exchange_strong(expected, Locked, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        if (mState.exchange(Unlocked, std::memory_order_release) == Contended) {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<int*>(&mState), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+        }
+    }
+
+private:
+    enum { Unlocked, Locked, Contended };
+    enum { SpinCount = 100 };
+
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+    std::atomic<int> mState;
+};
+
+class SpinLocker
+{
+public:
+    SpinLocker(SpinLock* l)
+        : mLock(l)
+    {
+        mLock->lock();
+    }
+
+    ~SpinLocker()
+    {
+        mLock->unlock();
     }
 
 private:
-    Mutex mMutex;
-    std::queue<T> mContainer;
+    SpinLock* mLock;
+};
+
+// the latest value of something for exactly one writer and any number of
+// readers that never block it. readers retry while a write is in
+// progress. T is copied bytewise through relaxed atomic words so a torn
+// read is only ever thrown away, never undefined
+template<typename T>
+class SeqLock
+{
+public:
+    SeqLock()
+    {
+        mSeq.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& word : mWords)
+            word.store(0, std::memory_order_relaxed);
+    }
+
+    void store(const T& value)
+    {
+        uint64_t words[NumWords] = {};
+        memcpy(words, &value, sizeof(T));
+        const uint32_t seq = mSeq.load(std::memory_order_relaxed);
+        mSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < NumWords; ++i)
+            mWords[i].store(words[i], std::memory_order_relaxed);
+        mSeq.store(seq + 2, std::memory_order_release);
+    }
+
+    // the number of stores so far
+    uint32_t load(T* value) const
+    {
+        uint64_t words[NumWords];
+        for (;;) {
+            const uint32_t before = mSeq.load(std::memory_order_acquire);
+            if (before & 1) {
+                cpuRelax();
+                continue;
+            }
+            for (size_t i = 0; i < NumWords; ++i)
+                words[i] = mWords[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mSeq.load(std::memory_order_relaxed) == before) {
+                memcpy(value, words, sizeof(T));
+                return before / 2;
+            }
+        }
+    }
+
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock copies bytewise");
+    enum { NumWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+    alignas(CacheLineSize) std::atomic<uint32_t> mSeq;
+    std::atomic<uint64_t> mWords[NumWords];
 };
 
 #endif
@@ -0,0 +1,254 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include "audio.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// reads pcm (16, 24, 32 bit int or 32 bit float) wav files or raw s32le
+// captures, and hands out s32 frames in the device format
+class WavReader
+{
+public:
+    WavReader()
+        : mFile(nullptr), mChannels(Format::Channels), mBits(32), mFloat(false), mRemaining(0)
+    {
+    }
+
+    ~WavReader()
+    {
+        close();
+    }
+
+    bool open(const std::string& path, bool raw, std::string* error)
+    {
+        close();
+        mFile = fopen(path.c_str(), "rb");
+        if (!mFile) {
+            *error = "Can't open " + path;
+            return false;
+        }
+        if (raw) {
+            mChannels = Format::Channels;
+            mBits = 32;
+            mFloat = false;
+            mRemaining = UINT64_MAX;
+            return true;
+        }
+
+        uint8_t header[12];
+        if (fread(header, 1, sizeof(header), mFile) != sizeof(header)
+            || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+            *error = "Not a wav file";
+            return false;
+        }
+        bool fmt = false;
+        for (;;) {
+            uint8_t chunk[8];
+            if (fread(chunk, 1, sizeof(chunk), mFile) != sizeof(chunk)) {
+                *error = "No data chunk";
+                return false;
+            }
+            const uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | (static_cast<uint32_t>(chunk[7]) << 24);
+            if (!memcmp(chunk, "fmt ", 4)) {
+                uint8_t data[16];
+                if (size < sizeof(data) || fread(data, 1, sizeof(data), mFile) != sizeof(data)) {
+                    *error = "Invalid fmt chunk";
+                    return false;
+                }
+                uint16_t format = data[0] | (data[1] << 8);
+                mChannels = data[2] | (data[3] << 8);
+                const uint32_t rate = data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<uint32_t>(data[7]) << 24);
+                mBits = data[14] | (data[15] << 8);
+                if (format == 0xfffe && size >= 40) {
+                    // extensible, the real format is the start of the subformat guid
+                    uint8_t ext[24];
+                    if (fread(ext, 1, sizeof(ext), mFile) != sizeof(ext)) {
+                        *error = "Invalid fmt chunk";
+                        return false;
+                    }
+                    format = ext[8] | (ext[9] << 8);
+                    fseek(mFile, size - sizeof(data) - sizeof(ext) + (size & 1), SEEK_CUR);
+                } else {
+                    fseek(mFile, size - sizeof(data) + (size & 1), SEEK_CUR);
+                }
+                mFloat = format == 3;
+                if ((format != 1 && format != 3) || (mFloat && mBits != 32)
+                    || (mBits != 16 && mBits != 24 && mBits != 32)) {
+                    *error = "Unsupported wav format";
+                    return false;
+                }
+                if (mChannels < 1 || mChannels > Format::Channels) {
+                    *error = "Unsupported channel count";
+                    return false;
+                }
+                if (rate != Format::SampleRate) {
+                    *error = "Unsupported sample rate";
+                    return false;
+                }
+                fmt = true;
+            } else if (!memcmp(chunk, "data", 4)) {
+                if (!fmt) {
+                    *error = "Missing fmt chunk";
+                    return false;
+                }
+                mRemaining = size;
+                return true;
+            } else {
+                fseek(mFile, size + (size & 1), SEEK_CUR);
+            }
+        }
+    }
+
+    void close()
+    {
+        if (mFile) {
+            fclose(mFile);
+            mFile = nullptr;
+        }
+    }
+
+    // reads up to count frames, returns the number of frames read
+    size_t read(int32_t* frames, size_t count)
+    {
+        const size_t bytesPerSample = mBits / 8;
+        const size_t frameBytes = bytesPerSample * mChannels;
+        const uint64_t available = mRemaining / frameBytes;
+        if (available < count)
+            count = available;
+        mBuffer.resize(count * frameBytes);
+        const size_t read = count ? fread(&mBuffer[0], frameBytes, count, mFile) : 0;
+        if (mRemaining != UINT64_MAX)
+            mRemaining -= read * frameBytes;
+        const uint8_t* src = mBuffer.data();
+        for (size_t i = 0; i < read; ++i) {
+            int32_t in[Format::Channels];
+            for (int c = 0; c < mChannels; ++c, src += bytesPerSample) {
+                switch (mBits) {
+                case 16:
+                    in[c] = static_cast<int32_t>(static_cast<uint32_t>(src[0] | (src[1] << 8)) << 16);
+                    break;
+                case 24:
+                    in[c] = static_cast<int32_t>(static_cast<uint32_t>(src[0] | (src[1] << 8) | (src[2] << 16)) << 8);
+                    break;
+                default: {
+                    uint32_t v = src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+                    if (mFloat) {
+                        float f;
+                        memcpy(&f, &v, sizeof(f));
+                        in[c] = floatToSample(f);
+                    } else {
+                        in[c] = static_cast<int32_t>(v);
+                    }
+                    break; }
+                }
+            }
+            // mono is duplicated to all channels
+            for (int c = 0; c < Format::Channels; ++c)
+                frames[i * Format::Channels + c] = in[c < mChannels ? c : 0];
+        }
+        return read;
+    }
+
+private:
+    FILE* mFile;
+    int mChannels, mBits;
+    bool mFloat;
+    uint64_t mRemaining;
+    std::vector<uint8_t> mBuffer;
+};
+
+// writes little endian pcm wav files, the header is finished on close
+class WavWriter
+{
+public:
+    WavWriter()
+        : mFile(nullptr), mBytes(0)
+    {
+    }
+
+    ~WavWriter()
+    {
+        close();
+    }
+
+    bool open(const std::string& path, int rate, int channels, int bits)
+    {
+        close();
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile)
+            return false;
+        mRate = rate;
+        mChannels = channels;
+        mBits = bits;
+        mBytes = 0;
+        writeHeader();
+        return true;
+    }
+
+    bool isOpen() const { return mFile != nullptr; }
+
+    void write(const void* data, size_t bytes)
+    {
+        if (!mFile)
+            return;
+        mBytes += fwrite(data, 1, bytes, mFile);
+    }
+
+    void close()
+    {
+        if (!mFile)
+            return;
+        fseek(mFile, 0, SEEK_SET);
+        writeHeader();
+        fclose(mFile);
+        mFile = nullptr;
+    }
+
+    // a complete header for bytes of data, for writers that can't seek back
+    static void header(uint8_t out[44], int rate, int channels, int bits, uint32_t bytes)
+    {
+        const uint32_t blockAlign = channels * bits / 8;
+        memcpy(out, "RIFF", 4);
+        put32(out + 4, 36 + bytes);
+        memcpy(out + 8, "WAVEfmt ", 8);
+        put32(out + 16, 16);
+        put16(out + 20, 1);
+        put16(out + 22, channels);
+        put32(out + 24, rate);
+        put32(out + 28, rate * blockAlign);
+        put16(out + 32, blockAlign);
+        put16(out + 34, bits);
+        memcpy(out + 36, "data", 4);
+        put32(out + 40, bytes);
+    }
+
+private:
+    static void put16(uint8_t* out, uint32_t v)
+    {
+        out[0] = v & 0xff;
+        out[1] = (v >> 8) & 0xff;
+    }
+
+    static void put32(uint8_t* out, uint32_t v)
+    {
+        put16(out, v & 0xffff);
+        put16(out + 2, v >> 16);
+    }
+
+    void writeHeader()
+    {
+        uint8_t out[44];
+        header(out, mRate, mChannels, mBits, static_cast<uint32_t>(std::min<uint64_t>(mBytes, UINT32_MAX - 36)));
+        fwrite(out, 1, sizeof(out), mFile);
+    }
+
+    FILE* mFile;
+    int mRate, mChannels, mBits;
+    uint64_t mBytes;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*global require,process,setTimeout,clearTimeout,__filename*/
+
+// calls back into the addon from inside its listeners, which must not
+// deadlock. the calls run in a child so a hang shows up as a timeout here
+// instead of a stuck test
+
+const childProcess = require("child_process");
+const fs = require("fs");
+const os = require("os");
+
+if (process.argv[2] != "child") {
+    const child = childProcess.fork(__filename, ["child"]);
+    const timer = setTimeout(function() {
+        console.log("timed out, a listener deadlocked");
+        child.kill("SIGKILL");
+        process.exit(1);
+    }, 10000);
+    child.on("exit", function(code) {
+        clearTimeout(timer);
+        console.log(code === 0 ? "ok" : "failed");
+        process.exit(code === 0 ? 0 : 1);
+    });
+    return;
+}
+
+const Uma8 = require("..");
+
+let uma8 = new Uma8();
+let candidates = uma8.enumerate();
+
+console.log(candidates);
+
+if (candidates.length == 0)
+    process.exit(0);
+
+uma8.open(candidates[0]);
+// halfway through the array goes to a selector, whose listener gives it back
+let selector = new Uma8.Selector();
+let selected = 0;
+selector.on("audio", function() {
+    if (++selected == 50)
+        selector.remove(uma8);
+});
+// a dump's listener swaps the recorder, which joins the old one's writer
+const recorder = { directory: os.tmpdir(), prefix: "uma8-listeners", before: 1, after: 0.1 };
+let recorded = 0;
+uma8.on("recorded", function(r) {
+    ++recorded;
+    fs.unlink(r.path, function() {});
+    uma8.setRecorder(recorded == 1 ? recorder : null);
+});
+let chunks = 0;
+uma8.on("audio", function(buf) {
+    ++chunks;
+    if (chunks == 20)
+        uma8.setRecorder(recorder);
+    if (chunks == 60)
+        uma8.triggerRecorder("listeners");
+    if (chunks == 100)
+        selector.add(uma8);
+    const stats = uma8.stats();
+    uma8.setDelivery({ mode: chunks % 2 ? "fixed" : "immediate", batch: 2 });
+    // a consumer switching formats as it goes
+    uma8.setAudioFormat({ format: chunks % 2 ? "s16le" : "s32le" });
+    if (chunks == 200) {
+        console.log("200 chunks,", selected, "through the selector,", recorded, "recorded, last", buf.length, "bytes, delivery", stats.delivery);
+        process.exit(recorded ? 0 : 1);
+    }
+});
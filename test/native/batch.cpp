@@ -0,0 +1,127 @@
+// batch processing of recorded files: a wav, a raw capture and a file that
+// isn't there, run over two threads into a temporary directory
+#include "test.h"
+#include "batch.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <sys/stat.h>
+
+static std::string directory;
+
+// a 1 kHz tone at half scale on both channels
+static std::vector<int32_t> tone(size_t frames)
+{
+    std::vector<int32_t> ret(frames * Format::Channels);
+    for (size_t i = 0; i < frames; ++i) {
+        const double x = .5 * sin(2. * M_PI * 1000. * i / Format::SampleRate);
+        ret[i * 2] = ret[i * 2 + 1] = static_cast<int32_t>(x * 2147483647.);
+    }
+    return ret;
+}
+
+static std::vector<std::string> lines(const std::string& path)
+{
+    std::vector<std::string> ret;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+        ret.push_back(line);
+    return ret;
+}
+
+static bool startsWith(const std::string& str, const std::string& prefix)
+{
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+static off_t fileSize(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// the number after "key": in a json line
+static double property(const std::string& line, const std::string& key)
+{
+    const size_t at = line.find("\"" + key + "\":");
+    return at == std::string::npos ? NAN : atof(line.c_str() + at + key.size() + 3);
+}
+
+int main()
+{
+    char dir[] = "/tmp/uma8-batch-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    directory = dir;
+
+    // three seconds as a wav, two as a raw capture
+    const std::vector<int32_t> frames = tone(3 * Format::SampleRate);
+    WavWriter wav;
+    CHECK(wav.open(directory + "/a.wav", Format::SampleRate, Format::Channels, 32));
+    wav.write(frames.data(), frames.size() * sizeof(int32_t));
+    wav.close();
+    FILE* raw = fopen((directory + "/b.raw").c_str(), "wb");
+    CHECK(raw);
+    fwrite(frames.data(), sizeof(int32_t), 2 * Format::SampleRate * Format::Channels, raw);
+    fclose(raw);
+
+    Batch::Options options;
+    options.files = { directory + "/a.wav", directory + "/b.raw", directory + "/missing.wav" };
+    options.output = directory;
+    options.threads = 2;
+    options.settings.preview = true;
+    options.settings.loudness = true;
+    options.settings.loudnessOptions.interval = 1000.;
+    std::atomic<int> notified(0);
+    Batch batch(options, [&]() { ++notified; });
+    batch.start();
+    batch.join();
+    CHECK(batch.finished());
+    CHECK(notified > 0);
+
+    // the last report for each file is the final one
+    std::vector<Batch::Progress> last(options.files.size());
+    for (const Batch::Progress& progress : batch.take()) {
+        CHECK(progress.index < last.size());
+        if (progress.index < last.size())
+            last[progress.index] = progress;
+    }
+    CHECK(last[0].done && last[0].error.empty() && last[0].frames == 3 * Format::SampleRate);
+    CHECK(last[1].done && last[1].error.empty() && last[1].frames == 2 * Format::SampleRate);
+    CHECK(last[2].done && last[2].frames == 0 && startsWith(last[2].error, "Can't open"));
+    CHECK(batch.take().empty());
+
+    // a loudness line a second and the summary, nothing for the previews
+    for (int file = 0; file < 2; ++file) {
+        const std::string base = directory + (file ? "/b" : "/a");
+        const int seconds = file ? 2 : 3;
+        const std::vector<std::string> jsonl = lines(base + ".jsonl");
+        CHECK(jsonl.size() == static_cast<size_t>(seconds + 1));
+        for (int i = 0; i < seconds && i < static_cast<int>(jsonl.size()); ++i) {
+            CHECK(startsWith(jsonl[i], "{\"name\":\"loudness\""));
+            CHECK(property(jsonl[i], "position") == (i + 1) * Format::SampleRate);
+        }
+        if (!jsonl.empty()) {
+            const std::string& summary = jsonl.back();
+            CHECK(startsWith(summary, "{\"name\":\"summary\""));
+            CHECK(property(summary, "position") == seconds * Format::SampleRate);
+            // half scale stereo at 1 kHz, about -6 LUFS
+            const double integrated = property(summary, "integrated");
+            CHECK(integrated > -8. && integrated < -4.);
+        }
+        // 16 bit mono at the preview rate
+        CHECK(fileSize(base + ".preview.wav") == 44 + seconds * 8000 * 2);
+        unlink((base + ".jsonl").c_str());
+        unlink((base + ".preview.wav").c_str());
+    }
+    CHECK(fileSize(directory + "/missing.jsonl") == -1);
+
+    unlink((directory + "/a.wav").c_str());
+    unlink((directory + "/b.raw").c_str());
+    rmdir(dir);
+    return testResult("batch");
+}
@@ -0,0 +1,28 @@
+#ifndef FAKE_LIBUSB_H
+#define FAKE_LIBUSB_H
+
+// the bits of libusb the hid reports use, implemented by the test as a
+// simulated device
+#include <stdint.h>
+
+struct libusb_device_handle;
+
+enum libusb_error {
+    LIBUSB_SUCCESS = 0,
+    LIBUSB_ERROR_IO = -1,
+    LIBUSB_ERROR_INVALID_PARAM = -2,
+    LIBUSB_ERROR_PIPE = -9
+};
+
+enum {
+    LIBUSB_ENDPOINT_IN = 0x80,
+    LIBUSB_ENDPOINT_OUT = 0x00,
+    LIBUSB_REQUEST_TYPE_CLASS = 0x20,
+    LIBUSB_RECIPIENT_INTERFACE = 0x01
+};
+
+int libusb_control_transfer(libusb_device_handle* handle, uint8_t requestType, uint8_t request, uint16_t value,
+                            uint16_t index, unsigned char* data, uint16_t length, unsigned int timeout);
+const char* libusb_error_name(int error);
+
+#endif
@@ -0,0 +1,177 @@
+// processing graphs: what setGraph rejects, how events are named and what
+// condition nodes do to the stream, fused or not
+#include "test.h"
+#include "pipeline.h"
+#include <string>
+#include <vector>
+#include <math.h>
+
+static NodeSpec node(const std::string& id, NodeSpec::Type type, const std::string& input = "capture")
+{
+    NodeSpec spec;
+    spec.id = id;
+    spec.type = type;
+    spec.input = input;
+    return spec;
+}
+
+static NodeSpec condition(const std::string& id, double gain, const std::string& input = "capture")
+{
+    NodeSpec spec = node(id, NodeSpec::Condition, input);
+    spec.condition.gain = gain;
+    return spec;
+}
+
+// a second of a 1 kHz tone at half scale, the events it produced
+static std::vector<Event> run(Pipeline& pipeline)
+{
+    std::vector<int32_t> frames(Format::SampleRate * Format::Channels);
+    for (size_t i = 0; i < frames.size(); ++i) {
+        const double x = .5 * sin(2. * M_PI * 1000. * (i / Format::Channels) / Format::SampleRate);
+        frames[i] = static_cast<int32_t>(x * 2147483647.);
+    }
+    std::vector<Event> events;
+    // in the usb thread's chunk size
+    for (size_t i = 0; i < Format::SampleRate; i += 240)
+        pipeline.process(&frames[i * Format::Channels], 240, events);
+    return events;
+}
+
+static void freeData(std::vector<Event>& events)
+{
+    for (Event& event : events)
+        free(event.data);
+}
+
+static double property(const Event& event, const std::string& key)
+{
+    for (const Event::Property& prop : event.properties) {
+        if (prop.name == key)
+            return prop.number;
+    }
+    return NAN;
+}
+
+static void invalid()
+{
+    Pipeline pipeline;
+    std::string error;
+    const std::vector<NodeSpec> good = { condition("gain", -6.) };
+    CHECK(pipeline.setGraph(good, &error));
+
+    const struct
+    {
+        std::vector<NodeSpec> specs;
+        const char* error;
+    } cases[] = {
+        { { condition("", 0.) }, "Graph node needs an id other than capture" },
+        { { condition("capture", 0.) }, "Graph node needs an id other than capture" },
+        { { condition("a", 0.), condition("a", 0.) }, "Duplicate graph node a" },
+        { { condition("a", 100.) }, "Invalid options for graph node a" },
+        { { node("t", NodeSpec::Triggers) }, "Invalid options for graph node t" },
+        { { node("l", NodeSpec::Loudness, "nowhere") }, "Graph node l reads from unknown node nowhere" },
+        { { node("p", NodeSpec::Preview), node("l", NodeSpec::Loudness, "p") },
+          "Graph node l can't read from p, only condition nodes produce audio" },
+        { { condition("a", 0., "b"), condition("b", 0., "a") }, "Graph has a cycle" }
+    };
+    for (const auto& c : cases) {
+        error.clear();
+        CHECK(!pipeline.setGraph(c.specs, &error));
+        CHECK(error == c.error);
+        // the old graph stays
+        CHECK(pipeline.graph().size() == 1 && pipeline.graph()[0].id == "gain");
+    }
+}
+
+static void events()
+{
+    Pipeline pipeline;
+    std::string error;
+    std::vector<NodeSpec> specs = {
+        node("direct", NodeSpec::Loudness),
+        condition("gain", 20. * log10(.5)),
+        node("quiet", NodeSpec::Preview, "gain"),
+        node("halved", NodeSpec::Loudness, "gain")
+    };
+    specs[0].event = "loudCapture";
+    specs[2].event = "quiet";
+    CHECK(pipeline.setGraph(specs, &error));
+    CHECK(pipeline.preview("quiet") && !pipeline.preview("preview"));
+
+    std::vector<Event> events = run(pipeline);
+    double direct = NAN, halved = NAN;
+    size_t previewBytes = 0;
+    int16_t peak = 0;
+    for (const Event& event : events) {
+        if (event.name == "loudCapture") {
+            direct = property(event, "momentary");
+            CHECK(property(event, "position") == Format::SampleRate);
+        } else if (event.name == "loudness") {
+            halved = property(event, "momentary");
+        } else if (event.name == "quiet") {
+            CHECK(event.properties.empty() && event.data);
+            previewBytes += event.size;
+            const int16_t* samples = reinterpret_cast<const int16_t*>(event.data);
+            for (size_t i = 0; i < event.size / 2; ++i)
+                peak = std::max<int16_t>(peak, samples[i]);
+        } else {
+            CHECK(!"unexpected event");
+        }
+    }
+    // a second at 8 kHz, the tone at a quarter of full scale
+    CHECK(previewBytes == 8000 * 2);
+    CHECK(peak > 32768 / 4 * .95 && peak < 32768 / 4 * 1.05);
+    CHECK(fabs(direct - halved - 20. * log10(2.)) < .1);
+    freeData(events);
+}
+
+static void fusion()
+{
+    // -3 and -3 dB in one pass come out the same as -6 in one node
+    Pipeline fused, single;
+    std::string error;
+    CHECK(fused.setGraph({ condition("a", -3.), condition("b", -3., "a"), node("l", NodeSpec::Loudness, "b") }, &error));
+    CHECK(single.setGraph({ condition("a", -6.), node("l", NodeSpec::Loudness, "a") }, &error));
+
+    const std::vector<Graph::NodeStats> stats = fused.stats();
+    CHECK(stats.size() == 3);
+    for (const Graph::NodeStats& node : stats)
+        CHECK(node.fusedInto == (node.id == "b" ? "a" : ""));
+
+    std::vector<Event> a = run(fused), b = run(single);
+    CHECK(a.size() == 1 && b.size() == 1);
+    if (a.size() == 1 && b.size() == 1)
+        CHECK(fabs(property(a[0], "momentary") - property(b[0], "momentary")) < 1e-6);
+
+    // a condition with two consumers runs on its own
+    CHECK(fused.setGraph({ condition("a", -3.), condition("b", -3., "a"), node("l", NodeSpec::Loudness, "a") }, &error));
+    for (const Graph::NodeStats& node : fused.stats())
+        CHECK(node.fusedInto.empty());
+}
+
+static void stages()
+{
+    // the setters each keep a node, which keeps its state when the others
+    // change
+    Pipeline pipeline;
+    Loudness::Options loudness;
+    Preview::Options preview;
+    pipeline.setLoudness(&loudness);
+    std::vector<Event> events = run(pipeline);
+    CHECK(events.size() == 1);
+    Loudness* stage = pipeline.loudness();
+    pipeline.setPreview(&preview);
+    CHECK(pipeline.loudness() == stage && pipeline.graph().size() == 2);
+    pipeline.setLoudness(nullptr);
+    CHECK(!pipeline.loudness() && pipeline.graph().size() == 1 && pipeline.graph()[0].id == "preview");
+    freeData(events);
+}
+
+int main()
+{
+    invalid();
+    events();
+    fusion();
+    stages();
+    return testResult("graph");
+}
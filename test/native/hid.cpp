@@ -0,0 +1,121 @@
+// the hid report passthrough against a simulated device, built with the
+// fake libusb.h
+#include "test.h"
+#include "hid.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// feature and output reports by id. feature report 3 is clamped to 10 like
+// a dsp limiting a parameter, ids it doesn't know stall
+struct libusb_device_handle
+{
+    bool numbered;
+    std::map<uint8_t, std::vector<uint8_t> > feature, output;
+    // 'g' or 's' per control transfer, in order
+    std::string log;
+};
+
+int libusb_control_transfer(libusb_device_handle* handle, uint8_t requestType, uint8_t request, uint16_t value,
+                            uint16_t index, unsigned char* data, uint16_t length, unsigned int)
+{
+    if (index != 4 || (requestType & 0x7f) != (LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE))
+        return LIBUSB_ERROR_INVALID_PARAM;
+    handle->log += requestType & LIBUSB_ENDPOINT_IN ? 'g' : 's';
+    const int type = value >> 8;
+    const uint8_t id = value & 0xff;
+    std::map<uint8_t, std::vector<uint8_t> >& reports = type == HidReports::Feature ? handle->feature : handle->output;
+    auto report = reports.find(id);
+    if (report == reports.end() || (id != 0) != handle->numbered)
+        return LIBUSB_ERROR_PIPE;
+    const size_t skip = id ? 1 : 0;
+    if (request == 0x09 && !(requestType & LIBUSB_ENDPOINT_IN)) {
+        if (id && (!length || data[0] != id))
+            return LIBUSB_ERROR_PIPE;
+        report->second.assign(data + skip, data + length);
+        if (type == HidReports::Feature && id == 3 && !report->second.empty())
+            report->second[0] = std::min<uint8_t>(report->second[0], 10);
+        return length;
+    }
+    if (request == 0x01 && (requestType & LIBUSB_ENDPOINT_IN) && type == HidReports::Feature) {
+        const size_t size = std::min<size_t>(length, report->second.size() + skip);
+        if (id)
+            data[0] = id;
+        memcpy(data + skip, report->second.data(), size - skip);
+        return static_cast<int>(size);
+    }
+    return LIBUSB_ERROR_PIPE;
+}
+
+const char* libusb_error_name(int error)
+{
+    switch (error) {
+    case LIBUSB_ERROR_PIPE:
+        return "LIBUSB_ERROR_PIPE";
+    case LIBUSB_ERROR_INVALID_PARAM:
+        return "LIBUSB_ERROR_INVALID_PARAM";
+    }
+    return "LIBUSB_ERROR_OTHER";
+}
+
+static void numbered()
+{
+    libusb_device_handle device;
+    device.numbered = true;
+    device.feature[1] = { 1, 2, 3 };
+    device.feature[3] = { 0, 0 };
+    device.output[2] = { 0 };
+    HidReports reports(&device, 4);
+
+    std::vector<uint8_t> out;
+    CHECK(reports.get(HidReports::Feature, 1, 3, &out) == 3);
+    CHECK(out == std::vector<uint8_t>({ 1, 2, 3 }));
+    const uint8_t data[] = { 7, 8, 9 };
+    CHECK(reports.set(HidReports::Feature, 1, data, sizeof(data)) == 3);
+    CHECK(device.feature[1] == std::vector<uint8_t>({ 7, 8, 9 }));
+    CHECK(reports.get(HidReports::Output, 2, 1, &out) < 0);
+
+    device.log.clear();
+    const std::vector<HidReports::Report> batch = {
+        { HidReports::Feature, 1, { 4, 5, 6 } },
+        { HidReports::Output, 2, { 0x10 } },
+        { HidReports::Feature, 3, { 20, 1 } },
+        { HidReports::Feature, 9, { 1 } }
+    };
+    std::vector<HidReports::Result> results = reports.apply(batch, true);
+    CHECK(results.size() == 4);
+    // everything is written before anything is read back, the unknown one
+    // stalls and isn't read
+    CHECK(device.log == "ssssgg");
+    CHECK(results[0].written == 3 && results[0].verified && results[0].error.empty());
+    CHECK(results[1].written == 1 && !results[1].verified && results[1].error.empty() && results[1].readback.empty());
+    CHECK(results[2].written == 2 && !results[2].verified && results[2].error == "Readback mismatch");
+    CHECK(results[2].readback == std::vector<uint8_t>({ 10, 1 }));
+    CHECK(results[3].id == 9 && results[3].written == LIBUSB_ERROR_PIPE && results[3].error == "LIBUSB_ERROR_PIPE");
+    CHECK(device.output[2] == std::vector<uint8_t>({ 0x10 }));
+
+    device.log.clear();
+    results = reports.apply(batch, false);
+    CHECK(device.log == "ssss");
+    CHECK(!results[0].verified && results[0].readback.empty());
+}
+
+static void unnumbered()
+{
+    libusb_device_handle device;
+    device.numbered = false;
+    device.feature[0] = { 0, 0, 0, 0 };
+    HidReports reports(&device, 4);
+    const std::vector<HidReports::Report> batch = { { HidReports::Feature, 0, { 1, 2, 3, 4 } } };
+    const std::vector<HidReports::Result> results = reports.apply(batch, true);
+    CHECK(results.size() == 1 && results[0].written == 4 && results[0].verified);
+    std::vector<uint8_t> out;
+    CHECK(reports.get(HidReports::Feature, 0, 4, &out) == 4 && out == batch[0].data);
+}
+
+int main()
+{
+    numbered();
+    unnumbered();
+    return testResult("hid");
+}
@@ -0,0 +1,155 @@
+// what Input's cache line blocks buy. the usb thread's accounting and the
+// js thread's drain timing are laid out as before the split (next to each
+// other) and as now (a line each). the usb side is timed while js keeps
+// writing its own fields from another core, flat out and paced like real
+// transfers, with the usb thread's cache misses where the kernel exposes
+// the counter. with a single cpu the threads can't contend and the numbers
+// say nothing
+#include "test.h"
+#include "utils.h"
+#include "cpustats.h"
+#include <thread>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum { Iterations = 10000000, PacedIterations = 2000, PaceUs = 1000 };
+
+struct Packed
+{
+    // js thread
+    CallTime drainTime;
+    // usb thread
+    std::atomic<int> activeTransfers;
+    std::atomic<uint64_t> transfers, bytesReceived;
+    CallTime transferTime;
+};
+
+struct Split
+{
+    alignas(CacheLineSize) CallTime drainTime;
+    alignas(CacheLineSize) std::atomic<int> activeTransfers;
+    std::atomic<uint64_t> transfers, bytesReceived;
+    CallTime transferTime;
+};
+
+// a transfer completing, the way transferCallback accounts for it
+template<typename T>
+static void completion(T& input, uint64_t i)
+{
+    ++input.activeTransfers;
+    ++input.transfers;
+    input.bytesReceived += 2400;
+    input.transferTime.add(i, i + 100);
+    --input.activeTransfers;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// cache misses of the calling thread, in user space. -1 where there's no
+// counter, in most vms and containers
+class CacheMisses
+{
+public:
+    CacheMisses()
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        mFd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~CacheMisses()
+    {
+        if (mFd != -1)
+            close(mFd);
+    }
+
+    int64_t read() const
+    {
+        uint64_t count;
+        if (mFd == -1 || ::read(mFd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        return static_cast<int64_t>(count);
+    }
+
+private:
+    int mFd;
+};
+
+template<typename T>
+static void run(const char* name, bool drain, bool paced)
+{
+    T* input = new T();
+    input->activeTransfers = 0;
+    input->transfers = input->bytesReceived = 0;
+    std::atomic<bool> done(false);
+    std::thread js;
+    if (drain) {
+        js = std::thread([&]() {
+                pin(1);
+                uint64_t i = 0;
+                while (!done) {
+                    input->drainTime.add(i, i + 50);
+                    ++i;
+                }
+            });
+    }
+    pin(0);
+    const CacheMisses misses;
+    const int64_t before = misses.read();
+    if (paced) {
+        // a completion every millisecond, the rate of a dozen arrays at
+        // 12.5 ms a transfer, each timed on its own so the sleeps don't
+        // count. the js side has the line to itself in between
+        uint64_t ns = 0;
+        for (uint64_t i = 0; i < PacedIterations; ++i) {
+            usleep(PaceUs);
+            const uint64_t start = uv_hrtime();
+            completion(*input, i);
+            ns += uv_hrtime() - start;
+        }
+        printf("%-40s %10.2f ns/op", name, static_cast<double>(ns) / PacedIterations);
+    } else {
+        const uint64_t start = uv_hrtime();
+        for (uint64_t i = 0; i < Iterations; ++i)
+            completion(*input, i);
+        printf("%-40s %10.2f ns/op", name, static_cast<double>(uv_hrtime() - start) / Iterations);
+    }
+    const int64_t after = misses.read();
+    if (before >= 0 && after >= 0) {
+        printf(" %8.3f misses/op\n", static_cast<double>(after - before) / (paced ? PacedIterations : Iterations));
+    } else {
+        printf("   misses n/a\n");
+    }
+    done = true;
+    if (drain)
+        js.join();
+    delete input;
+}
+
+int main()
+{
+    static_assert(sizeof(Packed) <= 2 * CacheLineSize, "the packed layout shares lines");
+    if (std::thread::hardware_concurrency() < 2)
+        printf("layout: one cpu, the js side can't run alongside and nothing contends\n");
+    run<Packed>("usb accounting, packed, js idle", false, false);
+    run<Split>("usb accounting, split, js idle", false, false);
+    run<Packed>("usb accounting, packed, js draining", true, false);
+    run<Split>("usb accounting, split, js draining", true, false);
+    run<Packed>("paced, packed, js draining", true, true);
+    run<Split>("paced, split, js draining", true, true);
+    return 0;
+}
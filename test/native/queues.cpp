@@ -0,0 +1,323 @@
+// the lock free primitives in utils.h, each checked single threaded for
+// ordering and limits and then under contention
+#include "test.h"
+#include "utils.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+enum { Items = 1000000 };
+
+static void spscOrder()
+{
+    SpscQueue<int> queue(5);
+    CHECK(queue.capacity() == 8);
+    for (int i = 0; i < 8; ++i)
+        CHECK(queue.push(i));
+    CHECK(!queue.push(8));
+    CHECK(queue.size() == 8);
+    int value;
+    for (int i = 0; i < 8; ++i) {
+        CHECK(queue.front() && *queue.front() == i);
+        CHECK(queue.pop(&value) && value == i);
+    }
+    CHECK(!queue.pop(&value));
+    CHECK(!queue.front());
+    CHECK(queue.size() == 0);
+}
+
+static void spscThreads()
+{
+    SpscQueue<size_t> queue(256);
+    std::atomic<bool> done(false);
+    std::thread producer([&]() {
+            for (size_t i = 0; i < Items;) {
+                if (queue.push(i)) {
+                    ++i;
+                } else {
+                    cpuRelax();
+                }
+            }
+        });
+    // size() from a third thread stays within the capacity
+    size_t maxSize = 0;
+    std::thread observer([&]() {
+            while (!done)
+                maxSize = std::max(maxSize, queue.size());
+        });
+    size_t expected = 0, bad = 0, value;
+    while (expected < Items) {
+        if (queue.pop(&value)) {
+            if (value != expected)
+                ++bad;
+            ++expected;
+        }
+    }
+    done = true;
+    producer.join();
+    observer.join();
+    CHECK(bad == 0);
+    CHECK(maxSize <= queue.capacity());
+}
+
+static void mpscThreads()
+{
+    enum { Producers = 4, PerProducer = Items / Producers };
+    MpscQueue<size_t> queue(1024);
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < Producers; ++p) {
+        producers.emplace_back([&queue, p]() {
+                for (size_t i = 0; i < PerProducer;) {
+                    if (queue.push(p * PerProducer + i)) {
+                        ++i;
+                    } else {
+                        cpuRelax();
+                    }
+                }
+            });
+    }
+    // each producer's items come out in its order
+    std::vector<size_t> next(Producers, 0);
+    size_t received = 0, bad = 0, value;
+    while (received < Producers * PerProducer) {
+        if (!queue.pop(&value))
+            continue;
+        const size_t p = value / PerProducer;
+        if (p >= Producers || value % PerProducer != next[p]) {
+            ++bad;
+        } else {
+            ++next[p];
+        }
+        ++received;
+    }
+    for (std::thread& t : producers)
+        t.join();
+    CHECK(bad == 0);
+    CHECK(!queue.pop(&value));
+}
+
+static void notifier()
+{
+    Notifier notifier;
+    CHECK(notifier.isValid());
+    CHECK(!notifier.wait(0));
+    notifier.notify();
+    notifier.notify();
+    CHECK(notifier.wait(0));
+    // both were drained
+    CHECK(!notifier.wait(0));
+    std::thread waker([&]() { notifier.notify(); });
+    CHECK(notifier.wait(1000));
+    waker.join();
+}
+
+static void spinLock()
+{
+    enum { Threads = 4, PerThread = 250000 };
+    SpinLock lock;
+    uint64_t counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < Threads; ++t) {
+        threads.emplace_back([&]() {
+                for (int i = 0; i < PerThread; ++i) {
+                    SpinLocker locker(&lock);
+                    ++counter;
+                }
+            });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    CHECK(counter == Threads * PerThread);
+    CHECK(lock.tryLock());
+    CHECK(!lock.tryLock());
+    lock.unlock();
+}
+
+struct Pair
+{
+    uint64_t a, b, c;
+};
+
+static void seqLock()
+{
+    SeqLock<Pair> latest;
+    Pair pair;
+    CHECK(latest.load(&pair) == 0);
+    std::atomic<bool> done(false);
+    std::thread writer([&]() {
+            for (uint64_t i = 1; i <= Items; ++i)
+                latest.store(Pair{ i, ~i, i * 3 });
+            done = true;
+        });
+    size_t torn = 0;
+    uint32_t last = 0;
+    bool monotonic = true;
+    while (!done) {
+        const uint32_t updates = latest.load(&pair);
+        if (updates && (pair.b != ~pair.a || pair.c != pair.a * 3))
+            ++torn;
+        if (updates < last)
+            monotonic = false;
+        last = updates;
+    }
+    writer.join();
+    CHECK(torn == 0);
+    CHECK(monotonic);
+    CHECK(latest.load(&pair) == Items && pair.a == Items);
+}
+
+static void benchmarks()
+{
+    {
+        SpscQueue<size_t> queue(1024);
+        bench("SpscQueue push+pop, one thread", Items, [&]() {
+                size_t value;
+                for (size_t i = 0; i < Items; ++i) {
+                    queue.push(i);
+                    queue.pop(&value);
+                }
+            });
+        bench("SpscQueue transfer between threads", Items, [&]() {
+                std::thread producer([&]() {
+                        for (size_t i = 0; i < Items;) {
+                            if (queue.push(i)) {
+                                ++i;
+                            } else {
+                                cpuRelax();
+                            }
+                        }
+                    });
+                size_t value;
+                for (size_t received = 0; received < Items;) {
+                    if (queue.pop(&value))
+                        ++received;
+                }
+                producer.join();
+            });
+    }
+    for (int producers : { 1, 4 }) {
+        MpscQueue<size_t> queue(1024);
+        const size_t perProducer = Items / producers;
+        const std::string name = "MpscQueue transfer, " + std::to_string(producers) + " producers";
+        bench(name.c_str(), perProducer * producers, [&]() {
+                std::vector<std::thread> threads;
+                for (int p = 0; p < producers; ++p) {
+                    threads.emplace_back([&]() {
+                            for (size_t i = 0; i < perProducer;) {
+                                if (queue.push(i)) {
+                                    ++i;
+                                } else {
+                                    cpuRelax();
+                                }
+                            }
+                        });
+                }
+                size_t value;
+                for (size_t received = 0; received < perProducer * producers;) {
+                    if (queue.pop(&value))
+                        ++received;
+                }
+                for (std::thread& t : threads)
+                    t.join();
+            });
+    }
+    {
+        SpinLock lock;
+        Mutex mutex;
+        volatile uint64_t counter = 0;
+        bench("SpinLock lock+unlock, uncontended", Items, [&]() {
+                for (size_t i = 0; i < Items; ++i) {
+                    SpinLocker locker(&lock);
+                    counter = counter + 1;
+                }
+            });
+        bench("Mutex lock+unlock, uncontended", Items, [&]() {
+                for (size_t i = 0; i < Items; ++i) {
+                    MutexLocker locker(&mutex);
+                    counter = counter + 1;
+                }
+            });
+        for (int threads : { 2, 4 }) {
+            const std::string spin = "SpinLock, " + std::to_string(threads) + " threads";
+            bench(spin.c_str(), Items, [&]() {
+                    std::vector<std::thread> all;
+                    for (int t = 0; t < threads; ++t) {
+                        all.emplace_back([&]() {
+                                for (size_t i = 0; i < static_cast<size_t>(Items / threads); ++i) {
+                                    SpinLocker locker(&lock);
+                                    counter = counter + 1;
+                                }
+                            });
+                    }
+                    for (std::thread& t : all)
+                        t.join();
+                });
+            const std::string plain = "Mutex, " + std::to_string(threads) + " threads";
+            bench(plain.c_str(), Items, [&]() {
+                    std::vector<std::thread> all;
+                    for (int t = 0; t < threads; ++t) {
+                        all.emplace_back([&]() {
+                                for (size_t i = 0; i < static_cast<size_t>(Items / threads); ++i) {
+                                    MutexLocker locker(&mutex);
+                                    counter = counter + 1;
+                                }
+                            });
+                    }
+                    for (std::thread& t : all)
+                        t.join();
+                });
+        }
+    }
+    {
+        SeqLock<Pair> latest;
+        Pair pair;
+        bench("SeqLock load, no writer", Items, [&]() {
+                for (size_t i = 0; i < Items; ++i)
+                    latest.load(&pair);
+            });
+        std::atomic<bool> done(false);
+        std::thread writer([&]() {
+                uint64_t i = 0;
+                while (!done)
+                    latest.store(Pair{ ++i, 0, 0 });
+            });
+        bench("SeqLock load, busy writer", Items, [&]() {
+                for (size_t i = 0; i < Items; ++i)
+                    latest.load(&pair);
+            });
+        done = true;
+        writer.join();
+    }
+    {
+        enum { RoundTrips = 20000 };
+        Notifier ping, pong;
+        bench("Notifier round trip", RoundTrips, [&]() {
+                std::thread other([&]() {
+                        for (int i = 0; i < RoundTrips; ++i) {
+                            ping.wait(-1);
+                            pong.notify();
+                        }
+                    });
+                for (int i = 0; i < RoundTrips; ++i) {
+                    ping.notify();
+                    pong.wait(-1);
+                }
+                other.join();
+            });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (benchMode(argc, argv)) {
+        benchmarks();
+        return 0;
+    }
+    spscOrder();
+    spscThreads();
+    mpscThreads();
+    notifier();
+    spinLock();
+    seqLock();
+    return testResult("queues");
+}
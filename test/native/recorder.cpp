@@ -0,0 +1,169 @@
+// the flight recorder: dumps on triggers, and on fatal signals chained with
+// whatever handled them before. each signal case runs in a forked child
+#include "test.h"
+#include "recorder.h"
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static std::string directory;
+
+// frame n is { n, -n }
+static void writeFrames(FlightRecorder& recorder, uint64_t from, size_t count)
+{
+    std::vector<int32_t> frames(count * Format::Channels);
+    for (size_t i = 0; i < count; ++i) {
+        frames[i * 2] = static_cast<int32_t>(from + i);
+        frames[i * 2 + 1] = -static_cast<int32_t>(from + i);
+    }
+    recorder.write(frames.data(), count);
+}
+
+// the frames of a dump are the ones written at its position
+static bool checkFile(const std::string& path, uint64_t position, uint64_t frames)
+{
+    WavReader reader;
+    std::string error;
+    if (!reader.open(path, false, &error))
+        return false;
+    std::vector<int32_t> buf(1024 * Format::Channels);
+    uint64_t read = 0;
+    size_t n;
+    while ((n = reader.read(buf.data(), 1024)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            const int32_t expected = static_cast<int32_t>(position + read + i);
+            if (buf[i * 2] != expected || buf[i * 2 + 1] != -expected)
+                return false;
+        }
+        read += n;
+    }
+    return read == frames;
+}
+
+static bool exists(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && st.st_size > 44;
+}
+
+static void triggers()
+{
+    FlightRecorder::Options options;
+    options.directory = directory;
+    options.prefix = "trigger";
+    options.before = 1.;
+    options.after = .5;
+    std::atomic<int> done(0);
+    FlightRecorder::Dump dump;
+    FlightRecorder recorder(options, [&](const FlightRecorder::Dump& d) {
+            dump = d;
+            ++done;
+        });
+    std::string error;
+    CHECK(recorder.start(&error));
+    writeFrames(recorder, 0, 48000);
+    recorder.trigger("first");
+    // folded into the first
+    recorder.trigger("second");
+    writeFrames(recorder, 48000, 24000);
+    for (int i = 0; i < 500 && !done; ++i)
+        usleep(10000);
+    CHECK(done == 1);
+    CHECK(dump.error.empty());
+    CHECK(dump.reason == "first");
+    CHECK(dump.position == 24000 && dump.frames == 36000);
+    CHECK(checkFile(dump.path, dump.position, dump.frames));
+    const FlightRecorder::Stats stats = recorder.stats();
+    CHECK(stats.dumps == 1 && stats.coalesced == 1 && stats.failed == 0 && !stats.pending);
+    recorder.stop();
+    // the writer samples itself, writing the dump took some cpu
+    CHECK(recorder.stats().cpu.cpu > 0.);
+    unlink(dump.path.c_str());
+}
+
+static uint8_t* page;
+
+// faults on the page are fixed up and execution goes on, like node's wasm
+// trap handler does
+static void recover(int, siginfo_t* info, void*)
+{
+    if (info->si_addr == page)
+        mprotect(page, 4096, PROT_READ | PROT_WRITE);
+}
+
+// gives up the way node does, back to the default and raised again
+static void decline(int sig, siginfo_t*, void*)
+{
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+enum Crash { Recovered, Declined, Abort };
+
+// the status of a child with a signal recorder, crashing as told
+static int crashChild(Crash crash, const char* prefix)
+{
+    const pid_t pid = fork();
+    if (pid) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return status;
+    }
+    page = static_cast<uint8_t*>(mmap(nullptr, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (crash != Abort) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = crash == Recovered ? recover : decline;
+        action.sa_flags = SA_SIGINFO;
+        sigaction(SIGSEGV, &action, nullptr);
+    }
+    FlightRecorder::Options options;
+    options.directory = directory;
+    options.prefix = prefix;
+    options.before = 1.;
+    options.after = 0.;
+    options.signals = true;
+    FlightRecorder recorder(options, nullptr);
+    std::string error;
+    if (!recorder.start(&error))
+        _exit(2);
+    writeFrames(recorder, 0, 36000);
+    if (crash == Abort)
+        abort();
+    *reinterpret_cast<volatile uint8_t*>(page) = 1;
+    _exit(0);
+}
+
+static void signals()
+{
+    int status = crashChild(Recovered, "recovered");
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(!exists(directory + "/recovered-crash.wav"));
+
+    status = crashChild(Declined, "declined");
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    CHECK(checkFile(directory + "/declined-crash.wav", 12000, 24000));
+
+    status = crashChild(Abort, "abort");
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    CHECK(checkFile(directory + "/abort-crash.wav", 12000, 24000));
+
+    for (const char* name : { "recovered", "declined", "abort" })
+        unlink((directory + "/" + name + "-crash.wav").c_str());
+}
+
+int main()
+{
+    char dir[] = "/tmp/uma8-recorder-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    directory = dir;
+    triggers();
+    signals();
+    rmdir(dir);
+    return testResult("recorder");
+}
@@ -0,0 +1,107 @@
+// the array selector: two arrays hearing the same room, one of them with a
+// talker close by. it should move over once that one's snr has been ahead
+// for the hold time, and fade rather than jump when it does
+#include "test.h"
+#include "selector.h"
+#include <vector>
+#include <math.h>
+
+enum { ChunkFrames = 240, ChunkNs = 10000000 };
+
+// bursts of a 100 Hz tone, 200 ms on and off, over an offset. whole periods
+// so they start and end at zero crossings
+static double talker(size_t frame)
+{
+    const size_t period = Format::SampleRate / 100;
+    const bool on = (frame / (Format::SampleRate / 5)) % 2 == 0;
+    return -.1 + (on ? .6 * sin(2. * M_PI * (frame % period) / period) : 0.);
+}
+
+// a steady level, the far array
+static double room(size_t frame)
+{
+    return .1 + .001 * sin(frame * 1.3);
+}
+
+static void chunk(double (*signal)(size_t), size_t from, std::vector<int32_t>& frames)
+{
+    frames.resize(ChunkFrames * Format::Channels);
+    for (size_t i = 0; i < ChunkFrames; ++i)
+        frames[i * 2] = frames[i * 2 + 1] = static_cast<int32_t>(signal(from + i) * 2147483647.);
+}
+
+static double sample(int32_t value)
+{
+    return value / 2147483648.;
+}
+
+int main()
+{
+    ArraySelector selector;
+    ArraySelector::Options options;
+    // snr only, there's no metadata here
+    options.vadWeight = options.doaWeight = 0.;
+    selector.setOptions(options);
+    const int far = selector.add(), near = selector.add();
+
+    // the near array only hears its talker after two seconds, before that
+    // it's as flat as the far one
+    enum { Ticks = 600, TalkerTick = 200 };
+    std::vector<int32_t> frames, out, delivered;
+    int switchTick = -1, chunks = 0;
+    ArraySelector::Switch sw{ -1, -1, 0., 0. };
+    for (int tick = 0; tick < Ticks; ++tick) {
+        const uint64_t now = static_cast<uint64_t>(tick) * ChunkNs;
+        const size_t from = static_cast<size_t>(tick) * ChunkFrames;
+        ArraySelector::Switch current{ -1, -1, 0., 0. };
+        chunk(room, from, frames);
+        if (selector.process(far, frames.data(), ChunkFrames, now, out, &current)) {
+            delivered.insert(delivered.end(), out.begin(), out.end());
+            ++chunks;
+        }
+        if (tick >= TalkerTick) {
+            chunk(talker, from - TalkerTick * ChunkFrames, frames);
+        } else {
+            chunk([](size_t) { return -.1; }, from, frames);
+        }
+        if (selector.process(near, frames.data(), ChunkFrames, now, out, &current)) {
+            delivered.insert(delivered.end(), out.begin(), out.end());
+            ++chunks;
+        }
+        if (current.to != -1) {
+            sw = current;
+            switchTick = tick;
+        }
+    }
+
+    CHECK(selector.selected() == near);
+    CHECK(sw.from == far && sw.to == near);
+    CHECK(sw.toScore > sw.fromScore + options.margin);
+    // the smoothed snr needs a while to get past the margin, then it has to
+    // stay there for the hold time. nothing before the talker
+    CHECK(switchTick >= TalkerTick + options.holdTime / 10);
+    CHECK(switchTick < TalkerTick + 100);
+
+    // one chunk per tick, the far array's chunk held back while pairing up
+    // goes out faded into the near one's
+    CHECK(chunks == Ticks);
+
+    // the offsets differ by .2, a hard cut would step by that. faded over
+    // 10 ms the largest step is the tone's own
+    double step = 0.;
+    for (size_t i = Format::Channels; i < delivered.size(); i += Format::Channels)
+        step = std::max(step, fabs(sample(delivered[i]) - sample(delivered[i - Format::Channels])));
+    CHECK(step < .03);
+
+    // the far array up to the switch, then the near one. the faded chunk
+    // starts out as the far one
+    const size_t last = static_cast<size_t>(switchTick) * ChunkFrames - 1;
+    CHECK(fabs(sample(delivered[last * Format::Channels]) - room(last)) < 1e-6);
+    CHECK(fabs(sample(delivered[(last + 1) * Format::Channels]) - room(last + 1)) < .01);
+    CHECK(fabs(sample(delivered.back()) - talker(Ticks * ChunkFrames - TalkerTick * ChunkFrames - 1)) < 1e-6);
+
+    // losing the selected array falls back to the other
+    selector.remove(near);
+    CHECK(selector.selected() == far);
+    return testResult("selector");
+}
@@ -0,0 +1,178 @@
+// the native outputs, each written to a local pipe or socket and read back
+#include "test.h"
+#include "fdsink.h"
+#include "rtpsink.h"
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// reads exactly bytes from a non-blocking fd, giving up after a second
+static bool readAll(int fd, uint8_t* data, size_t bytes)
+{
+    for (int tries = 0; bytes && tries < 1000;) {
+        const ssize_t r = ::read(fd, data, bytes);
+        if (r > 0) {
+            data += r;
+            bytes -= r;
+        } else {
+            usleep(1000);
+            ++tries;
+        }
+    }
+    return !bytes;
+}
+
+static void fdSink()
+{
+    enum { Frames = 2400 };
+    std::vector<int32_t> frames(Frames * Format::Channels);
+    for (size_t i = 0; i < frames.size(); ++i)
+        frames[i] = static_cast<int32_t>((i * 2654435761u) ^ (i << 7));
+    // halfway between two s16 steps, rounds up where a shift truncated
+    frames[0] = 0x00018000;
+
+    for (SampleFormat::Type type : { SampleFormat::S32, SampleFormat::F32, SampleFormat::F16, SampleFormat::S16, SampleFormat::S8 }) {
+        int fds[2];
+        CHECK(pipe(fds) == 0);
+        FdSink::Options options;
+        options.fd = fds[1];
+        options.format.type = type;
+        options.format.scale = 1.f / 64.f;
+        options.format.zeroPoint = 3;
+        options.batch = 0.;
+        CHECK(FdSink::validate(options));
+        FdSink sink(options);
+        std::string error;
+        CHECK(sink.start(&error));
+        sink.push(frames.data(), Frames);
+
+        const size_t bytes = frames.size() * options.format.sampleSize();
+        std::vector<uint8_t> expected(bytes), got(bytes);
+        convertSamples(options.format, frames.data(), frames.size(), expected.data());
+        CHECK(readAll(fds[0], got.data(), bytes));
+        CHECK(got == expected);
+        if (type == SampleFormat::S16)
+            CHECK(got[0] == 2 && got[1] == 0);
+        sink.stop();
+        const FdSink::Stats stats = sink.stats();
+        CHECK(stats.bytesWritten == bytes && stats.overruns == 0 && stats.error.empty());
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // the short names are taken too
+    SampleFormat::Type type;
+    CHECK(SampleFormat::parse("f16", &type) && type == SampleFormat::F16);
+    CHECK(SampleFormat::parse("s8", &type) && type == SampleFormat::S8);
+    CHECK(!SampleFormat::parse("s24le", &type));
+
+    // a reader that went away is an error, not a hang
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    close(fds[0]);
+    signal(SIGPIPE, SIG_IGN);
+    FdSink::Options options;
+    options.fd = fds[1];
+    options.batch = 0.;
+    FdSink sink(options);
+    std::string error;
+    CHECK(sink.start(&error));
+    sink.push(frames.data(), Frames);
+    for (int i = 0; i < 1000 && sink.stats().error.empty(); ++i)
+        usleep(1000);
+    CHECK(!sink.stats().error.empty());
+    sink.stop();
+    close(fds[1]);
+}
+
+// packets to a udp socket on loopback, checked field by field
+static void rtpLoopback(RtpSink::Payload payload)
+{
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    CHECK(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    CHECK(getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0);
+    const timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    RtpSink::Options options;
+    options.host = "127.0.0.1";
+    options.port = ntohs(addr.sin_port);
+    options.payload = payload;
+    options.ptime = 5.;
+    options.randomSsrc = false;
+    options.ssrc = 0x12345678;
+    options.batch = 0.;
+    CHECK(RtpSink::validate(options));
+    RtpSink sink(options);
+    std::string error;
+    CHECK(sink.start(&error));
+
+    // ten packets of 120 frames and a partial one that stays staged
+    enum { Packets = 10, Frames = 120 };
+    const size_t sample = payload == RtpSink::L16 ? 2 : 3;
+    std::vector<int32_t> frames((Packets * Frames + 50) * Format::Channels);
+    for (size_t i = 0; i < frames.size(); ++i)
+        frames[i] = static_cast<int32_t>(i * 2654435761u);
+    // in odd sized chunks like the usb thread hands them over
+    for (size_t pushed = 0; pushed < frames.size() / Format::Channels;) {
+        const size_t n = std::min<size_t>(77, frames.size() / Format::Channels - pushed);
+        sink.push(&frames[pushed * Format::Channels], n);
+        pushed += n;
+    }
+
+    uint8_t packet[2048];
+    uint16_t sequence = 0;
+    uint32_t timestamp = 0;
+    int received = 0;
+    bool payloadOk = true;
+    for (int p = 0; p < Packets; ++p) {
+        const ssize_t n = recv(fd, packet, sizeof(packet), 0);
+        if (n != static_cast<ssize_t>(RtpSink::HeaderSize + Frames * Format::Channels * sample))
+            break;
+        ++received;
+        CHECK(packet[0] == 0x80);
+        // the marker is only on the first
+        CHECK(packet[1] == (96 | (p ? 0 : 0x80)));
+        const uint16_t seq = (packet[2] << 8) | packet[3];
+        const uint32_t ts = (static_cast<uint32_t>(packet[4]) << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+        const uint32_t ssrc = (static_cast<uint32_t>(packet[8]) << 24) | (packet[9] << 16) | (packet[10] << 8) | packet[11];
+        if (p) {
+            CHECK(seq == static_cast<uint16_t>(sequence + 1));
+            CHECK(ts == timestamp + Frames);
+        }
+        sequence = seq;
+        timestamp = ts;
+        CHECK(ssrc == 0x12345678);
+        // network byte order, the top bytes of each sample
+        const uint8_t* data = packet + RtpSink::HeaderSize;
+        for (size_t i = 0; i < Frames * Format::Channels; ++i) {
+            const uint32_t x = static_cast<uint32_t>(frames[p * Frames * Format::Channels + i]);
+            for (size_t b = 0; b < sample; ++b) {
+                if (data[i * sample + b] != static_cast<uint8_t>(x >> (24 - 8 * b)))
+                    payloadOk = false;
+            }
+        }
+    }
+    CHECK(received == Packets);
+    CHECK(payloadOk);
+    sink.stop();
+    const RtpSink::Stats stats = sink.stats();
+    CHECK(stats.packets == Packets && stats.overruns == 0 && stats.sendErrors == 0 && stats.ssrc == 0x12345678);
+    close(fd);
+}
+
+int main()
+{
+    fdSink();
+    rtpLoopback(RtpSink::L24);
+    rtpLoopback(RtpSink::L16);
+    return testResult("sinks");
+}
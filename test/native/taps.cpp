@@ -0,0 +1,173 @@
+// taps: the ring that keeps the newest bytes, the file tap, and taps on a
+// pipeline's capture and graph nodes
+#include "test.h"
+#include "pipeline.h"
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// byte n is n & 0xff, from is where the bytes start
+static std::vector<uint8_t> bytes(size_t from, size_t count)
+{
+    std::vector<uint8_t> ret(count);
+    for (size_t i = 0; i < count; ++i)
+        ret[i] = static_cast<uint8_t>(from + i);
+    return ret;
+}
+
+static void ring()
+{
+    Tap::Options options;
+    options.size = 4096;
+    CHECK(Tap::validate(options));
+    Tap tap(options, "s32le 2ch 24000");
+    std::string error;
+    CHECK(tap.start(&error));
+
+    // wraps a couple of times, the last size bytes are kept
+    for (size_t written = 0; written < 10000; written += 1000) {
+        const std::vector<uint8_t> chunk = bytes(written, 1000);
+        tap.write(chunk.data(), chunk.size());
+    }
+    Tap::Stats stats = tap.stats();
+    CHECK(stats.bytes == 10000 && stats.dropped == 10000 - 4096 && stats.buffered == 4096 && stats.cpu.cpu == 0.);
+    CHECK(tap.take() == bytes(10000 - 4096, 4096));
+    CHECK(tap.stats().buffered == 0 && tap.take().empty());
+
+    // a partly filled ring comes back in order
+    std::vector<uint8_t> chunk = bytes(0, 3000);
+    tap.write(chunk.data(), chunk.size());
+    CHECK(tap.take() == chunk);
+
+    // more than fits at once, only its tail
+    chunk = bytes(0, 5000);
+    tap.write(chunk.data(), 100);
+    tap.write(chunk.data(), chunk.size());
+    stats = tap.stats();
+    CHECK(stats.bytes == 10000 + 3000 + 5100 && stats.dropped == 10000 - 4096 + 100 + 5000 - 4096);
+    CHECK(tap.take() == bytes(5000 - 4096, 4096));
+
+    Tap::Options small;
+    small.size = 1024;
+    CHECK(!Tap::validate(small));
+}
+
+static void file()
+{
+    char path[] = "/tmp/uma8-tap-XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(fd != -1);
+    close(fd);
+
+    const std::vector<uint8_t> data = bytes(0, 100000);
+    {
+        Tap::Options options;
+        options.path = path;
+        // room for all of it, so nothing depends on the writer keeping up
+        options.size = 1 << 17;
+        Tap tap(options, "s32le 2ch 24000");
+        std::string error;
+        CHECK(tap.start(&error));
+        for (size_t i = 0; i < data.size(); i += 10000)
+            tap.write(&data[i], 10000);
+        for (int i = 0; i < 1000 && tap.stats().bytes < data.size(); ++i)
+            usleep(1000);
+        const Tap::Stats stats = tap.stats();
+        CHECK(stats.bytes == data.size() && stats.dropped == 0 && stats.cpu.cpu > 0.);
+        // the ring is only for taps without a file
+        CHECK(tap.take().empty());
+    }
+    std::ifstream in(path, std::ios::binary);
+    const std::vector<uint8_t> written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    CHECK(written == data);
+    unlink(path);
+
+    Tap::Options options;
+    options.path = "/nonexistent/tap";
+    Tap tap(options, "s32le 2ch 24000");
+    std::string error;
+    CHECK(!tap.start(&error) && error.find("Can't open /nonexistent/tap") == 0);
+}
+
+static std::shared_ptr<Tap> ringTap(const std::string& format)
+{
+    Tap::Options options;
+    std::shared_ptr<Tap> tap(new Tap(options, format));
+    std::string error;
+    tap->start(&error);
+    return tap;
+}
+
+static void pipeline()
+{
+    Pipeline pipeline;
+    std::string error;
+    NodeSpec half, unity, preview;
+    half.id = "half";
+    half.condition.gain = 20. * log10(.5);
+    unity.id = "unity";
+    unity.input = "half";
+    preview.id = "preview";
+    preview.type = NodeSpec::Preview;
+    preview.input = "unity";
+    CHECK(pipeline.setGraph({ half, unity, preview }, &error));
+
+    CHECK(pipeline.tapFormat("capture") == "s32le 2ch 24000");
+    CHECK(pipeline.tapFormat("half") == "s32le 2ch 24000");
+    CHECK(pipeline.tapFormat("preview") == "s16le 1ch 8000");
+    CHECK(pipeline.tapFormat("nowhere").empty());
+
+    // unity runs in half's pass until half is tapped
+    CHECK(pipeline.stats()[1].fusedInto == "half");
+    std::shared_ptr<Tap> capture = ringTap(pipeline.tapFormat("capture"));
+    std::shared_ptr<Tap> halved = ringTap(pipeline.tapFormat("half"));
+    std::shared_ptr<Tap> previewed = ringTap(pipeline.tapFormat("preview"));
+    pipeline.setTap("capture", capture);
+    pipeline.setTap("half", halved);
+    pipeline.setTap("preview", previewed);
+    CHECK(pipeline.stats()[1].fusedInto.empty());
+
+    std::vector<int32_t> frames(2400 * Format::Channels);
+    for (size_t i = 0; i < frames.size(); ++i)
+        frames[i] = static_cast<int32_t>((i * 2654435761u) & 0x7fffff00) - (1 << 30);
+    std::vector<Event> events;
+    pipeline.process(frames.data(), 2400, events);
+
+    std::vector<uint8_t> got = capture->take();
+    CHECK(got.size() == frames.size() * 4 && !memcmp(got.data(), frames.data(), got.size()));
+    got = halved->take();
+    CHECK(got.size() == frames.size() * 4);
+    bool halvedOk = got.size() == frames.size() * 4;
+    for (size_t i = 0; halvedOk && i < frames.size(); ++i) {
+        int32_t sample;
+        memcpy(&sample, &got[i * 4], 4);
+        halvedOk = abs(sample - frames[i] / 2) <= 256;
+    }
+    CHECK(halvedOk);
+    // the tap sees what the preview event carries
+    got = previewed->take();
+    CHECK(events.size() == 1 && got.size() == 800 * 2);
+    if (events.size() == 1)
+        CHECK(events[0].size == got.size() && !memcmp(events[0].data, got.data(), got.size()));
+    for (Event& event : events)
+        free(event.data);
+    events.clear();
+
+    // and fused again once the tap is gone
+    pipeline.setTap("half", nullptr);
+    CHECK(pipeline.stats()[1].fusedInto == "half");
+    pipeline.process(frames.data(), 2400, events);
+    CHECK(halved->take().empty() && capture->take().size() == frames.size() * 4);
+    for (Event& event : events)
+        free(event.data);
+}
+
+int main()
+{
+    ring();
+    file();
+    pipeline();
+    return testResult("taps");
+}
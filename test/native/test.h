@@ -0,0 +1,46 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <uv.h>
+#include <stdio.h>
+#include <string.h>
+
+// checks for the native tests, a failed one is printed and makes the
+// program exit non-zero through testResult()
+static int testFailures = 0;
+
+#define CHECK(cond)                                                                      \
+    do {                                                                                 \
+        if (!(cond)) {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);   \
+            ++testFailures;                                                              \
+        }                                                                                \
+    } while (0)
+
+static inline int testResult(const char* name)
+{
+    if (testFailures) {
+        fprintf(stderr, "%s: %d checks failed\n", name, testFailures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+// benchmarks run when the program is started with "bench"
+static inline bool benchMode(int argc, char** argv)
+{
+    return argc > 1 && !strcmp(argv[1], "bench");
+}
+
+// runs fn, which does ops operations, and prints the time per operation
+template<typename F>
+static void bench(const char* name, size_t ops, F fn)
+{
+    const uint64_t start = uv_hrtime();
+    fn();
+    const double ns = static_cast<double>(uv_hrtime() - start);
+    printf("%-40s %10.2f ns/op\n", name, ns / ops);
+}
+
+#endif
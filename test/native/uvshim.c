@@ -0,0 +1,62 @@
+/* the few libuv calls the headers make, on plain pthreads, so the native
+   tests don't need libuv itself. node's uv.h provides the types */
+#include <uv.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct start
+{
+    uv_thread_cb fn;
+    void* arg;
+};
+
+static void* run(void* arg)
+{
+    struct start s = *(struct start*)arg;
+    free(arg);
+    s.fn(s.arg);
+    return NULL;
+}
+
+int uv_thread_create(uv_thread_t* tid, uv_thread_cb entry, void* arg)
+{
+    struct start* s = malloc(sizeof(*s));
+    s->fn = entry;
+    s->arg = arg;
+    return pthread_create(tid, NULL, run, s);
+}
+
+int uv_thread_join(uv_thread_t* tid) { return pthread_join(*tid, NULL); }
+uv_thread_t uv_thread_self(void) { return pthread_self(); }
+
+int uv_mutex_init(uv_mutex_t* mutex) { return pthread_mutex_init(mutex, NULL); }
+void uv_mutex_destroy(uv_mutex_t* mutex) { pthread_mutex_destroy(mutex); }
+void uv_mutex_lock(uv_mutex_t* mutex) { pthread_mutex_lock(mutex); }
+void uv_mutex_unlock(uv_mutex_t* mutex) { pthread_mutex_unlock(mutex); }
+
+int uv_cond_init(uv_cond_t* cond) { return pthread_cond_init(cond, NULL); }
+void uv_cond_destroy(uv_cond_t* cond) { pthread_cond_destroy(cond); }
+void uv_cond_signal(uv_cond_t* cond) { pthread_cond_signal(cond); }
+void uv_cond_broadcast(uv_cond_t* cond) { pthread_cond_broadcast(cond); }
+void uv_cond_wait(uv_cond_t* cond, uv_mutex_t* mutex) { pthread_cond_wait(cond, mutex); }
+
+int uv_cond_timedwait(uv_cond_t* cond, uv_mutex_t* mutex, uint64_t timeout)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000000000;
+    ts.tv_nsec += timeout % 1000000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, mutex, &ts) ? UV_ETIMEDOUT : 0;
+}
+
+uint64_t uv_hrtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,48 @@
+/*global require,process,setTimeout*/
+
+// streams the first array as rtp to a socket on loopback for a few seconds
+// and checks what arrives against the stream's settings
+
+const Uma8 = require("..");
+const dgram = require("dgram");
+
+const ptime = 5;
+const framesPerPacket = 24000 * ptime / 1000;
+
+let uma8 = new Uma8();
+let candidates = uma8.enumerate();
+
+console.log(candidates);
+
+if (candidates.length > 0) {
+    let socket = dgram.createSocket("udp4");
+    let packets = 0, gaps = 0, bad = 0;
+    let last;
+    socket.on("message", function(msg) {
+        const seq = msg.readUInt16BE(2);
+        const ts = msg.readUInt32BE(4);
+        if (msg.length != 12 + framesPerPacket * 2 * 3 || (msg[0] & 0xc0) != 0x80 || (msg[1] & 0x7f) != 96) {
+            ++bad;
+        } else if (last && (seq != ((last.seq + 1) & 0xffff) || ts != ((last.ts + framesPerPacket) >>> 0))) {
+            ++gaps;
+        }
+        last = { seq: seq, ts: ts };
+        ++packets;
+    });
+    socket.bind(0, "127.0.0.1", function() {
+        const port = socket.address().port;
+        uma8.open(candidates[0]);
+        uma8.streamRtp({ host: "127.0.0.1", port: port, payload: "L24", ptime: ptime });
+        console.log("streaming to port", port);
+        setTimeout(function() {
+            const stats = uma8.stats().rtp[0];
+            uma8.stopRtp("127.0.0.1", port);
+            socket.close();
+            console.log("got", packets, "packets,", gaps, "gaps,", bad, "bad", stats);
+            // about 200 packets a second
+            const ok = packets > 500 && !bad && !gaps && stats.sendErrors == 0;
+            console.log(ok ? "ok" : "failed");
+            process.exit(ok ? 0 : 1);
+        }, 3000);
+    });
+}